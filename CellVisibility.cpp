@@ -0,0 +1,262 @@
+#include "CellVisibility.hpp"
+#include "WorkerPool.hpp"
+#include "read_chunk.hpp"
+#include "write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+	//file header ("pvs0" chunk):
+	struct Header {
+		uint32_t width, height;
+		glm::vec2 origin;
+		float cell_size;
+	};
+	static_assert(sizeof(Header) == 4*2+4*2+4, "Header is packed.");
+
+	//edges of a cell, counterclockwise from east:
+	enum : uint32_t { East = 0, North = 1, West = 2, South = 3 };
+	int32_t const StepX[4] = { 1, 0,-1, 0 };
+	int32_t const StepY[4] = { 0, 1, 0,-1 };
+
+	//lines are written w = a * u + b, in coordinates (u,w) = (x + y, y - x) rotated 45 degrees from the grid
+	// (after flipping x and/or y so that every direction being followed points into the first quadrant, no line is vertical);
+	//the lines that pass through a sequence of portals make a convex polygon of (a,b) points:
+	struct Dual {
+		double a, b;
+	};
+	typedef std::vector< Dual > Polygon;
+
+	//clip 'in' to the points with ca * a + cb * b <= c:
+	void clip(Polygon const &in, double ca, double cb, double c, Polygon *out) {
+		out->clear();
+		for (uint32_t i = 0; i < in.size(); ++i) {
+			Dual const &p = in[i];
+			Dual const &q = in[(i + 1) % in.size()];
+			double dp = ca * p.a + cb * p.b - c;
+			double dq = ca * q.a + cb * q.b - c;
+			if (dp <= 0.0) out->emplace_back(p);
+			if ((dp < 0.0 && dq > 0.0) || (dp > 0.0 && dq < 0.0)) {
+				double t = dp / (dp - dq);
+				out->emplace_back(Dual{p.a + t * (q.a - p.a), p.b + t * (q.b - p.b)});
+			}
+		}
+	}
+
+	//computes sets for a grid of cells:
+	struct Builder {
+		uint32_t width, height;
+		std::vector< uint8_t > const &passages;
+
+		bool open(uint32_t x, uint32_t y, uint32_t edge) const {
+			if (edge == East) return x + 1 < width && (passages[y * width + x] & CellVisibility::OpenEast);
+			if (edge == North) return y + 1 < height && (passages[y * width + x] & CellVisibility::OpenNorth);
+			if (edge == West) return x > 0 && (passages[y * width + (x-1)] & CellVisibility::OpenEast);
+			return y > 0 && (passages[(y-1) * width + x] & CellVisibility::OpenNorth);
+		}
+
+		//append (possibly repeated) indices of the cells reached by lines that leave cell (sx,sy) through 'edge_x' (East or West) and 'edge_y' (North or South) edges only:
+		// follows sequences of open edges ("portals") outward, keeping the lines that pass through all of them;
+		// a line through the first portal passes through the source cell too (it's convex), so this covers views from anywhere in it
+		void stab(uint32_t x, uint32_t y, uint32_t sx, uint32_t sy, uint32_t edge_x, uint32_t edge_y, uint32_t depth,
+			std::vector< Polygon > *lines, Polygon *scratch, std::vector< uint32_t > *seen) const {
+			//edge endpoints:
+			static int32_t const Corners[4][2][2] = {
+				{ {1, 0}, {1, 1} },
+				{ {1, 1}, {0, 1} },
+				{ {0, 1}, {0, 0} },
+				{ {0, 0}, {1, 0} },
+			};
+			//lines must clear the ends of each portal by this much:
+			// (so lines that only graze a corner don't count -- real openings are narrower than a whole edge, since walls have thickness)
+			static double const Margin = 1e-9;
+
+			seen->emplace_back(y * width + x);
+			if (lines->size() < depth + 2) lines->resize(depth + 2);
+			double flip_x = (edge_x == East ? 1.0 : -1.0);
+			double flip_y = (edge_y == North ? 1.0 : -1.0);
+			for (uint32_t edge : {edge_x, edge_y}) {
+				if (!open(x, y, edge)) continue;
+				//portal ends relative to the source cell, flipped, then rotated:
+				double u[2], w[2];
+				for (uint32_t e = 0; e < 2; ++e) {
+					double px = flip_x * (int32_t(x - sx) + Corners[edge][e][0]);
+					double py = flip_y * (int32_t(y - sy) + Corners[edge][e][1]);
+					u[e] = px + py;
+					w[e] = py - px;
+				}
+				uint32_t left = (w[0] > w[1] ? 0 : 1);
+				//the left end must be above the line, and the right end below it:
+				clip((*lines)[depth], u[left], 1.0, w[left] - Margin, scratch);
+				clip(*scratch, -u[1-left], -1.0, -(w[1-left] + Margin), &(*lines)[depth + 1]);
+				if ((*lines)[depth + 1].empty()) continue;
+				stab(x + StepX[edge], y + StepY[edge], sx, sy, edge_x, edge_y, depth + 1, lines, scratch, seen);
+			}
+		}
+
+		//compute the set for cell (sx,sy), with 'word' relative to the start of 'bits':
+		void build(uint32_t sx, uint32_t sy, CellVisibility::Set *set, std::vector< uint64_t > *bits) const {
+			//(|b| is less than this for any line through the grid)
+			double const far = 4.0 * (double(width) + double(height)) + 8.0;
+
+			std::vector< Polygon > lines(1);
+			Polygon scratch;
+			std::vector< uint32_t > seen;
+			for (uint32_t edge_x : {East, West}) {
+				for (uint32_t edge_y : {North, South}) {
+					//start from every line with a slope in range:
+					lines[0] = Polygon{ Dual{-1.0, -far}, Dual{1.0, -far}, Dual{1.0, far}, Dual{-1.0, far} };
+					stab(sx, sy, sx, sy, edge_x, edge_y, 0, &lines, &scratch, &seen);
+				}
+			}
+			std::sort(seen.begin(), seen.end());
+			seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+			uint32_t x0 = sx, y0 = sy, x1 = sx, y1 = sy;
+			for (uint32_t cell : seen) {
+				uint32_t x = cell % width, y = cell / width;
+				x0 = std::min(x0, x); x1 = std::max(x1, x);
+				y0 = std::min(y0, y); y1 = std::max(y1, y);
+			}
+			set->x0 = x0;
+			set->y0 = y0;
+			set->w = x1 - x0 + 1;
+			set->h = y1 - y0 + 1;
+			set->word = uint32_t(bits->size());
+			bits->resize(bits->size() + (set->w * set->h + 63) / 64, 0);
+			for (uint32_t cell : seen) {
+				uint32_t i = (cell / width - y0) * set->w + (cell % width - x0);
+				(*bits)[set->word + i / 64] |= uint64_t(1) << (i % 64);
+			}
+		}
+	};
+}
+
+CellVisibility::CellVisibility(uint32_t width_, uint32_t height_, glm::vec2 const &origin_, float cell_size_, std::vector< uint8_t > const &passages, uint32_t threads)
+	: width(width_), height(height_), origin(origin_), cell_size(cell_size_) {
+	if (passages.size() != size_t(width) * size_t(height)) {
+		throw std::runtime_error("CellVisibility given " + std::to_string(passages.size()) + " passages for a "
+			+ std::to_string(width) + "x" + std::to_string(height) + " grid.");
+	}
+
+	Builder builder{width, height, passages};
+
+	//rows of cells are computed in parallel, then concatenated:
+	std::vector< std::vector< Set > > row_sets(height);
+	std::vector< std::vector< uint64_t > > row_bits(height);
+	WorkerPool pool(threads);
+	pool.parallel_for(height, [&](uint32_t y) {
+		row_sets[y].resize(width);
+		for (uint32_t x = 0; x < width; ++x) {
+			builder.build(x, y, &row_sets[y][x], &row_bits[y]);
+		}
+	});
+
+	sets.reserve(size_t(width) * size_t(height));
+	for (uint32_t y = 0; y < height; ++y) {
+		uint32_t base = uint32_t(bits.size());
+		for (Set set : row_sets[y]) {
+			set.word += base;
+			sets.emplace_back(set);
+		}
+		bits.insert(bits.end(), row_bits[y].begin(), row_bits[y].end());
+		std::vector< Set >().swap(row_sets[y]);
+		std::vector< uint64_t >().swap(row_bits[y]);
+	}
+}
+
+CellVisibility::CellVisibility(std::string const &filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open '" + filename + "'.");
+	}
+
+	std::vector< Header > header;
+	read_chunk(file, "pvs0", &header);
+	if (header.size() != 1) {
+		throw std::runtime_error("Expected exactly one header in '" + filename + "'.");
+	}
+	width = header[0].width;
+	height = header[0].height;
+	origin = header[0].origin;
+	cell_size = header[0].cell_size;
+
+	read_chunk(file, "pvc0", &sets);
+	read_chunk(file, "pvb0", &bits);
+
+	if (sets.size() != size_t(width) * size_t(height)) {
+		throw std::runtime_error("'" + filename + "' has the wrong number of sets for its grid.");
+	}
+	for (Set const &set : sets) {
+		if (!(set.x0 + set.w <= width && set.y0 + set.h <= height
+			&& set.word <= bits.size() && (uint64_t(set.w) * set.h + 63) / 64 <= bits.size() - set.word)) {
+			throw std::runtime_error("'" + filename + "' has an out-of-range set.");
+		}
+	}
+}
+
+void CellVisibility::save(std::string const &filename) const {
+	Header header;
+	header.width = width;
+	header.height = height;
+	header.origin = origin;
+	header.cell_size = cell_size;
+
+	std::ofstream file(filename, std::ios::binary);
+	write_chunk(file, "pvs0", std::vector< Header >(1, header));
+	write_chunk(file, "pvc0", sets);
+	write_chunk(file, "pvb0", bits);
+	if (!file) {
+		throw std::runtime_error("Failed to write '" + filename + "'.");
+	}
+}
+
+uint32_t CellVisibility::cell_at(glm::vec3 const &at) const {
+	float x = std::floor((at.x - origin.x) / cell_size);
+	float y = std::floor((at.y - origin.y) / cell_size);
+	if (!(x >= 0.0f && x < float(width) && y >= 0.0f && y < float(height))) return -1U;
+	return uint32_t(y) * width + uint32_t(x);
+}
+
+bool CellVisibility::visible(uint32_t from, uint32_t x, uint32_t y) const {
+	assert(from < sets.size());
+	Set const &set = sets[from];
+	if (x < set.x0 || x >= set.x0 + set.w || y < set.y0 || y >= set.y0 + set.h) return false;
+	uint32_t i = (y - set.y0) * set.w + (x - set.x0);
+	return (bits[set.word + i / 64] >> (i % 64)) & 1;
+}
+
+bool CellVisibility::any_visible(uint32_t from, glm::vec2 const &min, glm::vec2 const &max) const {
+	assert(from < sets.size());
+
+	//cells covered by the rectangle:
+	float fx0 = std::floor((min.x - origin.x) / cell_size), fx1 = std::floor((max.x - origin.x) / cell_size);
+	float fy0 = std::floor((min.y - origin.y) / cell_size), fy1 = std::floor((max.y - origin.y) / cell_size);
+	//(also catches NaN and infinite rectangles)
+	if (!(fx1 >= 0.0f && fx0 < float(width) && fy1 >= 0.0f && fy0 < float(height))) return true;
+
+	//clip to the set's rectangle:
+	Set const &set = sets[from];
+	uint32_t x0 = std::max(set.x0, uint32_t(std::max(fx0, 0.0f)));
+	uint32_t y0 = std::max(set.y0, uint32_t(std::max(fy0, 0.0f)));
+	uint32_t x1 = std::min(set.x0 + set.w, uint32_t(std::min(fx1 + 1.0f, float(width))));
+	uint32_t y1 = std::min(set.y0 + set.h, uint32_t(std::min(fy1 + 1.0f, float(height))));
+	if (x0 >= x1 || y0 >= y1) return false;
+
+	//test each row's run of bits a word at a time:
+	for (uint32_t y = y0; y < y1; ++y) {
+		uint32_t begin = (y - set.y0) * set.w + (x0 - set.x0);
+		uint32_t end = begin + (x1 - x0);
+		while (begin < end) {
+			uint32_t count = std::min(end - begin, 64 - begin % 64);
+			uint64_t mask = (count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1)) << (begin % 64);
+			if (bits[set.word + begin / 64] & mask) return true;
+			begin += count;
+		}
+	}
+	return false;
+}
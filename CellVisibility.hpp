@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//"CellVisibility" is a precomputed potentially-visible set (PVS) for a level laid out on a grid of cells (like Maze):
+// for each cell, which cells might be seen by a camera standing in it, through the open passages between cells.
+//
+//Sets are computed in 2D (on the xy plane), treating the edges between cells as walls taller than the camera,
+// with an open edge acting as a portal the width of the whole edge.
+//Each cell's set holds every cell that some straight line from anywhere in the cell reaches through a sequence of portals,
+// so it is conservative for a camera anywhere in the cell. (Objects that poke past a wall aren't hidden either,
+// as long as they are tested by their bounds with any_visible.)
+//
+//Each set is stored as a bitmap over the smallest rectangle of cells that contains it, so memory scales with how far one can see, not with the size of the level.
+
+struct CellVisibility {
+	//no grid; cell_at() always fails, so nothing is hidden:
+	CellVisibility() = default;
+
+	//compute from a 'width' x 'height' grid of cells, with 'passages' laid out like Maze::cells (threads == 0 means one per hardware thread):
+	// note: will throw if passages.size() isn't width * height
+	CellVisibility(uint32_t width, uint32_t height, glm::vec2 const &origin, float cell_size, std::vector< uint8_t > const &passages, uint32_t threads = 0);
+
+	//load from a file written by save():
+	// note: will throw if file fails to read
+	CellVisibility(std::string const &filename);
+
+	// note: will throw if file fails to write
+	void save(std::string const &filename) const;
+
+	uint32_t width = 0, height = 0;
+	glm::vec2 origin = glm::vec2(0.0f); //world xy of the corner of cell (0,0)
+	float cell_size = 1.0f;
+
+	//passage bits, as in Maze::cells:
+	enum : uint8_t {
+		OpenEast = 1,
+		OpenNorth = 2
+	};
+
+	//index (y * width + x) of the cell containing world point 'at', or -1U if it is outside the grid:
+	uint32_t cell_at(glm::vec3 const &at) const;
+
+	//might cell (x,y) be visible from cell 'from'?
+	bool visible(uint32_t from, uint32_t x, uint32_t y) const;
+
+	//might anything in the world-space xy rectangle [min,max] be visible from cell 'from'?
+	// (rectangles entirely outside the grid count as visible; others are clipped to it)
+	bool any_visible(uint32_t from, glm::vec2 const &min, glm::vec2 const &max) const;
+
+	//------ internals ------
+
+	struct Set {
+		uint32_t x0, y0; //lower-left cell of the rectangle
+		uint32_t w, h; //size of the rectangle (zero if nothing is visible)
+		uint32_t word; //cell (x,y) is bit i % 64 of bits[word + i / 64], where i = (y - y0) * w + (x - x0)
+	};
+	static_assert(sizeof(Set) == 20, "Set is packed.");
+	std::vector< Set > sets; //sets[y * width + x] is cell (x,y)'s set
+	std::vector< uint64_t > bits;
+};
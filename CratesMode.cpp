@@ -4,34 +4,46 @@
 #include "Load.hpp"
 #include "Sound.hpp"
 #include "MeshBuffer.hpp"
+#include "CellVisibility.hpp"
 #include "gl_errors.hpp" //helper for dumpping OpenGL error messages
-#include "read_chunk.hpp" //helper for reading a vector of structures from a file
 #include "data_path.hpp" //helper to get paths relative to executable
 #include "compile_program.hpp" //helper to compile opengl shader programs
 #include "draw_text.hpp" //helper to... um.. draw text
 #include "vertex_color_program.hpp"
 
-#include <glm/gtc/type_ptr.hpp>
-
 #include <iostream>
-#include <fstream>
 #include <map>
 #include <cstddef>
 #include <random>
+#include <stdexcept>
+
+std::string crates_level = "maze";
 
 //Ref from MeshBuffer
 Load< WalkMesh > walk_mesh(LoadTagDefault, []() {
-    return new WalkMesh(data_path("walkmesh.blob"));
+    //(the hand-made maze predates cooked walkmeshes; generated levels are written cooked)
+    return new WalkMesh(data_path(crates_level == "maze" ? "walkmesh.blob" : crates_level + ".walkmesh"));
 });
 
 Load< MeshBuffer > crates_meshes(LoadTagDefault, [](){
-	return new MeshBuffer(data_path("maze.pnc"));
+	return new MeshBuffer(data_path(crates_level + ".pnc"), true); //(vertices kept on the CPU for Scene::bake_static)
+});
+
+//potentially-visible sets for the cells of generated levels:
+// (the hand-made maze isn't on a grid, so it gets an empty one, which hides nothing)
+Load< CellVisibility > crates_visibility(LoadTagDefault, [](){
+	if (crates_level == "maze") return new CellVisibility();
+	return new CellVisibility(data_path(crates_level + ".pvs"));
 });
 
 Load< GLuint > crates_meshes_for_vertex_color_program(LoadTagDefault, [](){
 	return new GLuint(crates_meshes->make_vao_for_program(vertex_color_program->program));
 });
 
+Load< GLuint > crates_meshes_for_vertex_color_program_instanced(LoadTagDefault, [](){
+	return new GLuint(crates_meshes->make_vao_for_program(vertex_color_program_instanced->program));
+});
+
 
 Load< Sound::Sample > sample_roar(LoadTagDefault, [](){
 	return new Sound::Sample(data_path("european_dragon_roaring_and_breathe_fire.wav"));
@@ -45,72 +57,51 @@ Load< Sound::Sample > sample_scary(LoadTagDefault, [](){
 });
 
 
-CratesMode::CratesMode() {
+CratesMode::CratesMode() : path_finder(*walk_mesh) {
 	//----------------
 	//set up scene:
-	//TODO: this should load the scene from a file!
-
-    //Referenced from MeshBuffer.cpp
-	std::ifstream file(data_path("maze.scene"), std::ios::binary);
-    //str0 len < char > * [strings chunk]
-    //xfh0 len < ... > * [transform hierarchy]
-    //msh0 len < uint uint uint > [hierarchy point + mesh name]
-    //cam0 len < uint params > [heirarchy point + camera params]
-    //lig0 len < uint params > [hierarchy point + light params]
-    struct TransformEntry {
-        int32_t parent_ref;
-        uint32_t obj_name_begin, obj_name_end;
-        glm::vec3 position;
-        glm::vec4 rotation;
-        glm::vec3 scale;
-    };
-
-    struct MeshesEntry {
-        int32_t mesh_ref;
-        uint32_t mesh_name_begin, mesh_name_end;
-    };
-
-    std::vector< char > strings;
-    std::vector< TransformEntry > transforms;
-    std::vector< MeshesEntry > meshes;
-
-    read_chunk(file, "str0", &strings);
-    read_chunk(file, "xfh0", &transforms);
-    read_chunk(file, "msh0", &meshes);
-    //read_chunk(file, "cam0", &camera);  //might need to change variable name
-    //read_chunk(file, "lig0", &light);
-
-	auto attach_object = [this](Scene::Transform *transform, std::string const &name) {
-		Scene::Object *object = scene.new_object(transform);
+
+	//load <level>.scene, keeping the floor, walls (of generated levels, see Maze), and monster:
+	scene.load(data_path(crates_level + ".scene"), *crates_meshes, [this](Scene::Object *object, std::string const &mesh_name) {
+		bool is_monster = (mesh_name == "Monster");
+		if (!(is_monster || mesh_name == "CageFloor" || mesh_name == "Wall")) return false;
 		object->program = vertex_color_program->program;
 		object->program_mvp_mat4 = vertex_color_program->object_to_clip_mat4;
 		object->program_mv_mat4x3 = vertex_color_program->object_to_light_mat4x3;
 		object->program_itmv_mat3 = vertex_color_program->normal_to_light_mat3;
+		object->program_tint_vec4 = vertex_color_program->tint_vec4;
 		object->vao = *crates_meshes_for_vertex_color_program;
-		MeshBuffer::Mesh const &mesh = crates_meshes->lookup(name);
-		object->start = mesh.start;
-		object->count = mesh.count;
-		return object;
-	};
-
-
-	{ //build scene from maze.scene
-        for (auto& t : transforms) {
-            Scene::Transform *trans = scene.new_transform();
-            trans->position = t.position;
-            trans->rotation = glm::quat(t.rotation.w, t.rotation.x, t.rotation.y, t.rotation.z);
-            trans->scale = t.scale;
-            std::string name(&strings[0] + t.obj_name_begin, &strings[0] + t.obj_name_end);
-            if (name == "CageFloor") {
-                cage_floor = attach_object(trans, "CageFloor");
-            } else if (name == "Monster") {
-                monster = attach_object(trans, "Monster");
-            } else if (name == "Player") {
-                camera = scene.new_camera(trans);
-                camera->transform->rotation = camera->original_rotation;
-            }
-        }
+		//(copies of a mesh -- e.g., the walls -- are drawn together)
+		object->instanced.program = vertex_color_program_instanced->program;
+		object->instanced.vao = *crates_meshes_for_vertex_color_program_instanced;
+		object->instanced.world_to_clip_mat4 = vertex_color_program_instanced->world_to_clip_mat4;
+		object->instanced.instance_offset_int = vertex_color_program_instanced->instance_offset_int;
+		object->instanced.tint_vec4 = vertex_color_program_instanced->tint_vec4;
+		object->is_static = !is_monster;
+		if (is_monster) monster = object;
+		else if (mesh_name == "CageFloor") cage_floor = object;
+		return true;
+	});
+	if (Scene::Transform *player = scene.find_transform("Player")) {
+		camera = scene.new_camera(player);
+		camera->transform->set_rotation(camera->original_rotation);
 	}
+	if (!camera || !monster) {
+		throw std::runtime_error("Level '" + crates_level + "' is missing its 'Player' or 'Monster'.");
+	}
+
+	//light position + color (uploaded once, for both plain and instanced drawing):
+	scene.lighting.sun_color = glm::vec4(0.81f, 0.81f, 0.76f, 0.0f);
+	scene.lighting.sun_direction = glm::vec4(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f)), 0.0f);
+	scene.lighting.sky_color = glm::vec4(0.4f, 0.4f, 0.45f, 0.0f);
+	scene.lighting.sky_direction = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+
+	//the floor and walls never move, so merge them into batches:
+	// (maze cells are 3 units apart, so each batch covers about 8x8 cells)
+	scene.bake_static(24.0f);
+
+	//only draw what can be seen through the maze's passages from the player's cell:
+	scene.cell_visibility = &*crates_visibility;
 
 	//start the 'loop' sample playing at the large crate:
     //                      (position, volumn, Loop or Once)
@@ -121,9 +112,13 @@ CratesMode::CratesMode() {
 
     walk_point = walk_mesh->start(camera->transform->position);  //do I need make_local_to_world()?
     camera->normal = walk_mesh->world_normal(walk_point);
-    camera->transform->position = walk_mesh->world_point(walk_point) + camera->height * camera->normal;
+    camera->transform->set_position(walk_mesh->world_point(walk_point) + camera->height * camera->normal);
     //camera->elevation can be used to modify camera_up
     //camera_up = walk_mesh->world_normal(walk_point);
+
+    monster_walk_point = walk_mesh->start(monster->transform->position);
+    monster_height = glm::dot(monster->transform->position - walk_mesh->world_point(monster_walk_point),
+                              walk_mesh->world_normal(monster_walk_point));
 }
 
 CratesMode::~CratesMode() {
@@ -176,11 +171,11 @@ bool CratesMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_siz
             camera->azimuth -= yaw;
 			//camera->elevation -= pitch;
             //always re-compute the rotation of the camera from its original rotation
-            camera->transform->rotation = glm::normalize(
+            camera->transform->set_rotation(glm::normalize(
                 camera->original_rotation
                 * glm::angleAxis(camera->azimuth, glm::vec3(0.0f, 1.0f, 0.0f))
                 * glm::angleAxis(camera->elevation, glm::vec3(1.0f, 0.0f, 0.0f))
-            );
+            ));
 			return true;
 		}
 	}
@@ -194,14 +189,59 @@ void CratesMode::update(float elapsed) {
     //if (controls.left) camera->transform->position -= amt * directions[0];
     //if (controls.backward) camera->transform->position += amt * directions[2];
     //if (controls.forward) camera->transform->position -= amt * directions[2];
-    if (controls.right)    walk_mesh->walk(walk_point,  amt * directions[0]);
-    if (controls.left)     walk_mesh->walk(walk_point, -amt * directions[0]);
-    if (controls.backward) walk_mesh->walk(walk_point,  amt * directions[2]);
-    if (controls.forward)  walk_mesh->walk(walk_point, -amt * directions[2]);
+    //combine pressed keys into a single step, so the walk mesh is only walked once per frame:
+    glm::vec3 step = glm::vec3(0.0f);
+    if (controls.right)    step += amt * directions[0];
+    if (controls.left)     step -= amt * directions[0];
+    if (controls.backward) step += amt * directions[2];
+    if (controls.forward)  step -= amt * directions[2];
+    if (step != glm::vec3(0.0f)) walk_mesh->walk(walk_point, step);
 
     //update camera normal and position
     camera->normal = walk_mesh->world_normal(walk_point);
-    camera->transform->position = walk_mesh->world_point(walk_point) + camera->height * camera->normal;
+    camera->transform->set_position(walk_mesh->world_point(walk_point) + camera->height * camera->normal);
+
+	{ //monster chases the player:
+		monster_repath_countdown -= elapsed;
+		if (monster_repath_countdown <= 0.0f) {
+			monster_repath_countdown = 0.5f;
+			monster_query.from = monster_walk_point;
+			monster_query.to = walk_point;
+			path_finder.enqueue(&monster_query);
+		}
+		path_finder.update(0.001f);
+
+		//switch paths only once the new search is done (searches on big levels take many frames):
+		if (monster_query.status == PathFinder::Query::Found) {
+			monster_path.swap(monster_query.path);
+			monster_query.status = PathFinder::Query::Idle;
+		} else if (monster_query.status == PathFinder::Query::NotFound) {
+			monster_path.clear();
+			monster_query.status = PathFinder::Query::Idle;
+		}
+
+		if (monster_path.size() >= 2) {
+			std::vector< glm::vec3 > &path = monster_path;
+			glm::vec3 at = walk_mesh->world_point(monster_walk_point);
+			float travel = monster_speed * elapsed;
+			while (path.size() >= 2 && travel > 0.0f) {
+				glm::vec3 to = path[1] - at;
+				float dist = glm::length(to);
+				if (dist <= travel) {
+					walk_mesh->walk(monster_walk_point, to);
+					at = walk_mesh->world_point(monster_walk_point);
+					travel -= dist;
+					path.erase(path.begin()); //reached this corner
+				} else {
+					walk_mesh->walk(monster_walk_point, to * (travel / dist));
+					at = walk_mesh->world_point(monster_walk_point);
+					travel = 0.0f;
+				}
+			}
+			monster->transform->set_position(walk_mesh->world_point(monster_walk_point)
+				+ monster_height * walk_mesh->world_normal(monster_walk_point));
+		}
+	}
 
 	{ //set sound positions:
 		glm::mat4 cam_to_world = camera->transform->make_local_to_world();
@@ -218,8 +258,17 @@ void CratesMode::update(float elapsed) {
 	roar_countdown -= elapsed;
 	if (roar_countdown <= 0.0f) {
 		roar_countdown = (rand() / float(RAND_MAX) * 8.0f) + 0.5f;  //Reset the countdown
-        glm::mat4x3 monster_to_world = monster->transform->make_local_to_world();
-        sample_roar->play( monster_to_world * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), 0.5f );
+		//only roar if the monster is within earshot (found through the scene's spatial index, not by checking every object):
+		scene.update_spatial_index();
+		glm::vec3 listener = glm::vec3(camera->transform->make_local_to_world()[3]);
+		bool heard = false;
+		scene.spatial_index.for_each_within(listener, roar_distance, [this, &heard](Scene::Object *object){
+			if (object == monster) heard = true;
+		});
+		if (heard) {
+			glm::mat4x3 monster_to_world = monster->transform->make_local_to_world();
+			sample_roar->play( monster_to_world * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), 0.5f );
+		}
 	}
 }
 
@@ -230,14 +279,6 @@ void CratesMode::draw(glm::uvec2 const &drawable_size) {
 	glBlendEquation(GL_FUNC_ADD);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	//set up light position + color:
-	glUseProgram(vertex_color_program->program);
-	glUniform3fv(vertex_color_program->sun_color_vec3, 1, glm::value_ptr(glm::vec3(0.81f, 0.81f, 0.76f)));
-	glUniform3fv(vertex_color_program->sun_direction_vec3, 1, glm::value_ptr(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f))));
-	glUniform3fv(vertex_color_program->sky_color_vec3, 1, glm::value_ptr(glm::vec3(0.4f, 0.4f, 0.45f)));
-	glUniform3fv(vertex_color_program->sky_direction_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 1.0f, 0.0f)));
-	glUseProgram(0);
-
 	//fix aspect ratio of camera
 	camera->aspect = drawable_size.x / float(drawable_size.y);
 
@@ -4,6 +4,7 @@
 
 #include "MeshBuffer.hpp"
 #include "WalkMesh.hpp"
+#include "PathFinder.hpp"
 #include "GL.hpp"
 #include "Scene.hpp"
 #include "Sound.hpp"
@@ -13,6 +14,11 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include <vector>
+#include <string>
+
+//level to play: loads "<level>.pnc", "<level>.scene", "<level>.walkmesh", and "<level>.pvs" from the data directory
+// (set before call_load_functions(); the default "maze" is the hand-made level, which uses "walkmesh.blob" and has no "<level>.pvs")
+extern std::string crates_level;
 
 // The 'CratesMode' shows scene with some crates in it:
 
@@ -52,8 +58,18 @@ struct CratesMode : public Mode {
     WalkMesh::WalkPoint walk_point;
     glm::vec3 camera_up, camera_at;
 
-	//when this reaches zero, the 'roar' sample is triggered at the small crate:
+    //the monster chases the player along the walk mesh:
+    PathFinder path_finder;
+    std::vector< glm::vec3 > monster_path; //monster_path[0] is the last corner the monster passed
+    PathFinder::Query monster_query; //search for the next path (the monster keeps following monster_path until it is found)
+    WalkMesh::WalkPoint monster_walk_point;
+    float monster_height = 0.0f; //height of monster's origin above the walk mesh
+    float monster_speed = 2.0f;
+    float monster_repath_countdown = 0.0f; //when this reaches zero, a new path to the player is requested
+
+	//when this reaches zero, the 'roar' sample is triggered at the monster (if it is within 'roar_distance' of the player):
 	float roar_countdown = 8.0f;
+	float roar_distance = 30.0f;
 
 	//this 'loop' sample is played at the monster:
 	std::shared_ptr< Sound::PlayingSample > loop;
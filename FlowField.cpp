@@ -0,0 +1,198 @@
+#include "FlowField.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+namespace {
+	uint32_t float_bits(float f) {
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+	float bits_float(uint32_t bits) {
+		float f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+}
+
+FlowField::FlowField(WalkMesh const &mesh_) : mesh(mesh_),
+	distance(mesh.triangles.size(), std::numeric_limits< float >::infinity()),
+	next_corner(mesh.triangles.size(), uint8_t(-1)),
+	distance_bits(mesh.triangles.size()),
+	queued(mesh.triangles.size()) {
+
+	centroids.reserve(mesh.triangles.size());
+	for (auto const &tri : mesh.triangles) {
+		centroids.emplace_back((mesh.vertices[tri[0]] + mesh.vertices[tri[1]] + mesh.vertices[tri[2]]) / 3.0f);
+	}
+	edge_lengths.assign(mesh.triangles.size(), glm::vec3(std::numeric_limits< float >::infinity()));
+	for (uint32_t t = 0; t < mesh.triangles.size(); ++t) {
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			uint32_t n = mesh.neighbors[t][corner];
+			if (n != -1U) edge_lengths[t][corner] = glm::distance(centroids[t], centroids[n]);
+		}
+	}
+	for (auto &q : queued) q.store(0);
+	open.reserve(mesh.triangles.size());
+}
+
+bool FlowField::update(WalkMesh::WalkPoint const &target) {
+	target_point = mesh.world_point(target);
+	if (target.triangle == target_triangle) return false;
+	rebuild(target);
+	return true;
+}
+
+void FlowField::rebuild(WalkMesh::WalkPoint const &target) {
+	assert(target.triangle < mesh.triangles.size());
+	target_triangle = target.triangle;
+	target_point = mesh.world_point(target);
+	if (!workers || workers->threads <= 1) {
+		rebuild_serial();
+	} else {
+		rebuild_parallel();
+	}
+}
+
+void FlowField::set_threads(uint32_t threads) {
+	workers.reset(threads == 1 ? nullptr : new WorkerPool(threads));
+}
+
+void FlowField::rebuild_serial() {
+	std::fill(distance.begin(), distance.end(), std::numeric_limits< float >::infinity());
+
+	auto heap_order = [](OpenEntry const &a, OpenEntry const &b) {
+		return a.distance > b.distance; //(min-heap)
+	};
+
+	open.clear();
+	distance[target_triangle] = 0.0f;
+	open.push_back(OpenEntry{0.0f, target_triangle});
+	while (!open.empty()) {
+		std::pop_heap(open.begin(), open.end(), heap_order);
+		OpenEntry entry = open.back();
+		open.pop_back();
+		if (entry.distance > distance[entry.triangle]) continue; //stale entry
+
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			uint32_t n = mesh.neighbors[entry.triangle][corner];
+			if (n == -1U) continue;
+			float d = entry.distance + edge_lengths[entry.triangle][corner];
+			if (d < distance[n]) {
+				distance[n] = d;
+				open.push_back(OpenEntry{d, n});
+				std::push_heap(open.begin(), open.end(), heap_order);
+			}
+		}
+	}
+
+	compute_next_corners(0, uint32_t(mesh.triangles.size()));
+}
+
+void FlowField::rebuild_parallel() {
+	uint32_t const threads = workers->threads;
+	uint32_t const count = uint32_t(mesh.triangles.size());
+	uint32_t const infinity_bits = float_bits(std::numeric_limits< float >::infinity());
+
+	next_frontiers.resize(threads);
+	frontier.clear();
+	frontier.emplace_back(target_triangle);
+	++round;
+
+	auto chunk_begin = [&](uint32_t id) { return uint32_t(uint64_t(count) * id / threads); };
+
+	//reset distances:
+	workers->parallel_for(threads, [&](uint32_t id) {
+		for (uint32_t t = chunk_begin(id); t < chunk_begin(id + 1); ++t) {
+			distance_bits[t].store(t == target_triangle ? float_bits(0.0f) : infinity_bits, std::memory_order_relaxed);
+		}
+	});
+
+	//relax edges out of the frontier until no distance changes:
+	// (parallel_for returns once every slice is done, so each round sees all of the previous round's results)
+	uint32_t slices = 1;
+	std::function< void(uint32_t) > const relax = [&](uint32_t id) {
+		std::vector< uint32_t > &next = next_frontiers[id];
+		next.clear();
+		for (uint32_t i = id; i < frontier.size(); i += slices) {
+			uint32_t t = frontier[i];
+			float dt = bits_float(distance_bits[t].load(std::memory_order_relaxed));
+			for (uint32_t corner = 0; corner < 3; ++corner) {
+				uint32_t n = mesh.neighbors[t][corner];
+				if (n == -1U) continue;
+				uint32_t d = float_bits(dt + edge_lengths[t][corner]);
+				uint32_t old = distance_bits[n].load(std::memory_order_relaxed);
+				bool lowered = false;
+				while (d < old) {
+					if (distance_bits[n].compare_exchange_weak(old, d, std::memory_order_relaxed)) {
+						lowered = true;
+						break;
+					}
+				}
+				if (lowered && queued[n].exchange(round + 1, std::memory_order_relaxed) != round + 1) {
+					next.emplace_back(n);
+				}
+			}
+		}
+	};
+	while (!frontier.empty()) {
+		//(small frontiers, like the first few rounds, aren't worth waking the pool for)
+		slices = uint32_t(std::min< size_t >(threads, (frontier.size() + 63) / 64));
+		workers->parallel_for(slices, relax);
+		frontier.clear();
+		for (uint32_t id = 0; id < slices; ++id) {
+			frontier.insert(frontier.end(), next_frontiers[id].begin(), next_frontiers[id].end());
+		}
+		++round;
+	}
+
+	//publish distances, then pick directions (which read neighbors' distances):
+	workers->parallel_for(threads, [&](uint32_t id) {
+		for (uint32_t t = chunk_begin(id); t < chunk_begin(id + 1); ++t) {
+			distance[t] = bits_float(distance_bits[t].load(std::memory_order_relaxed));
+		}
+	});
+	workers->parallel_for(threads, [&](uint32_t id) {
+		compute_next_corners(chunk_begin(id), chunk_begin(id + 1));
+	});
+}
+
+void FlowField::compute_next_corners(uint32_t begin, uint32_t end) {
+	for (uint32_t t = begin; t < end; ++t) {
+		uint8_t best_corner = uint8_t(-1);
+		if (t != target_triangle) {
+			//(ties go to the lowest corner, so the result doesn't depend on how the distances were found)
+			float best = std::numeric_limits< float >::infinity();
+			for (uint32_t corner = 0; corner < 3; ++corner) {
+				uint32_t n = mesh.neighbors[t][corner];
+				if (n == -1U || !(distance[n] < distance[t])) continue;
+				float d = distance[n] + edge_lengths[t][corner];
+				if (d < best) {
+					best = d;
+					best_corner = uint8_t(corner);
+				}
+			}
+		}
+		next_corner[t] = best_corner;
+	}
+}
+
+glm::vec3 FlowField::direction(WalkMesh::WalkPoint const &wp) const {
+	assert(wp.triangle < mesh.triangles.size());
+	glm::vec3 at = mesh.world_point(wp);
+	glm::vec3 to;
+	if (wp.triangle == target_triangle) {
+		to = target_point - at;
+	} else {
+		uint8_t corner = next_corner[wp.triangle];
+		if (corner == uint8_t(-1)) return glm::vec3(0.0f);
+		glm::uvec3 const &tri = mesh.triangles[wp.triangle];
+		to = 0.5f * (mesh.vertices[tri[(corner + 1) % 3]] + mesh.vertices[tri[(corner + 2) % 3]]) - at;
+	}
+	float length = glm::length(to);
+	return (length > 0.0f ? to / length : glm::vec3(0.0f));
+}
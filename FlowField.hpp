@@ -0,0 +1,74 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+#include "WorkerPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+//"FlowField" stores, for every triangle of a WalkMesh, the distance to a target
+// and which neighboring triangle is next on the way there.
+//
+//Useful when many agents chase the same target: the field is recomputed only when
+// the target moves to a different triangle, and each agent just reads the direction
+// for the triangle it is standing on.
+//
+//Distances are measured between triangle centroids (and from the target point in the target's triangle).
+
+struct FlowField {
+	FlowField(WalkMesh const &mesh);
+
+	WalkMesh const &mesh;
+
+	//rebuild the field across 'threads' threads (1 means build on the calling thread, 0 means one per hardware thread):
+	// (the threads are kept around between rebuilds)
+	void set_threads(uint32_t threads);
+	std::unique_ptr< WorkerPool > workers;
+
+	//per-triangle results:
+	std::vector< float > distance; //distance to target (infinity if unreachable)
+	std::vector< uint8_t > next_corner; //neighbor to head for is mesh.neighbors[t][next_corner[t]] (or -1 at the target / if unreachable)
+
+	uint32_t target_triangle = -1U;
+
+	//set the target, rebuilding the field if the target is on a different triangle than last time:
+	// returns true if the field was rebuilt
+	bool update(WalkMesh::WalkPoint const &target);
+
+	//rebuild the field from scratch for the target:
+	void rebuild(WalkMesh::WalkPoint const &target);
+
+	//the (unit-length) direction an agent at 'wp' should walk:
+	// toward the middle of the edge to the next triangle, or toward the target in its own triangle.
+	// (zero if the target is unreachable or already reached)
+	glm::vec3 direction(WalkMesh::WalkPoint const &wp) const;
+
+	//------ internals ------
+	glm::vec3 target_point = glm::vec3(0.0f);
+	std::vector< glm::vec3 > centroids;
+	std::vector< glm::vec3 > edge_lengths; //edge_lengths[t][corner] = distance between centroids of t and neighbors[t][corner]
+
+	//serial build (Dijkstra):
+	struct OpenEntry {
+		float distance;
+		uint32_t triangle;
+	};
+	std::vector< OpenEntry > open;
+	void rebuild_serial();
+
+	//parallel build (frontier-based Bellman-Ford; converges to the same distances as Dijkstra):
+	// (distances are non-negative, so their bit patterns order the same way as their values and can be atomically min'd as integers)
+	std::vector< std::atomic< uint32_t > > distance_bits;
+	std::vector< std::atomic< uint32_t > > queued; //round in which the triangle was last added to the frontier
+	uint32_t round = 0;
+	std::vector< uint32_t > frontier;
+	std::vector< std::vector< uint32_t > > next_frontiers; //one per slice of the frontier
+	void rebuild_parallel();
+
+	//choose next_corner from converged distances:
+	void compute_next_corners(uint32_t begin, uint32_t end);
+};
@@ -10,6 +10,7 @@
 #include "compile_program.hpp" //helper to compile opengl shader programs
 #include "draw_text.hpp" //helper to... um.. draw text
 #include "vertex_color_program.hpp"
+#include "Scene.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -42,6 +43,21 @@ Load< GLuint > meshes_for_vertex_color_program(LoadTagDefault, [](){
 	return new GLuint(meshes->make_vao_for_program(vertex_color_program->program));
 });
 
+//the board's light position + color, as a uniform buffer laid out like Scene::Lighting:
+Load< GLuint > board_lighting(LoadTagDefault, [](){
+	Scene::Lighting lighting;
+	lighting.sun_color = glm::vec4(0.81f, 0.81f, 0.76f, 0.0f);
+	lighting.sun_direction = glm::vec4(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f)), 0.0f);
+	lighting.sky_color = glm::vec4(0.2f, 0.2f, 0.3f, 0.0f);
+	lighting.sky_direction = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(lighting), &lighting, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return new GLuint(buffer);
+});
+
 
 GameMode::GameMode() {
 	//----------------
@@ -178,10 +194,8 @@ void GameMode::draw(glm::uvec2 const &drawable_size) {
 	glBindVertexArray(*meshes_for_vertex_color_program);
 	glUseProgram(vertex_color_program->program);
 
-	glUniform3fv(vertex_color_program->sun_color_vec3, 1, glm::value_ptr(glm::vec3(0.81f, 0.81f, 0.76f)));
-	glUniform3fv(vertex_color_program->sun_direction_vec3, 1, glm::value_ptr(glm::normalize(glm::vec3(-0.2f, 0.2f, 1.0f))));
-	glUniform3fv(vertex_color_program->sky_color_vec3, 1, glm::value_ptr(glm::vec3(0.2f, 0.2f, 0.3f)));
-	glUniform3fv(vertex_color_program->sky_direction_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 1.0f, 0.0f)));
+	glBindBufferBase(GL_UNIFORM_BUFFER, Scene::LightingBinding, *board_lighting);
+	glUniform4f(vertex_color_program->tint_vec4, 1.0f, 1.0f, 1.0f, 1.0f);
 
 	//helper function to draw a given mesh with a given transformation:
 	auto draw_mesh = [&](MeshBuffer::Mesh const &mesh, glm::mat4 const &object_to_world) {
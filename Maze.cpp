@@ -0,0 +1,381 @@
+#include "Maze.hpp"
+#include "WalkMesh.hpp"
+#include "CellVisibility.hpp"
+#include "write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+constexpr float Maze::CellSize;
+constexpr float Maze::WallThickness;
+constexpr float Maze::WallHeight;
+constexpr uint32_t Maze::BlockSize;
+
+namespace {
+	void append_string(std::vector< char > *strings, std::string const &str, uint32_t *begin, uint32_t *end) {
+		*begin = uint32_t(strings->size());
+		strings->insert(strings->end(), str.begin(), str.end());
+		*end = uint32_t(strings->size());
+	}
+
+	//axis-aligned box, with faces CCW when seen from outside:
+	void append_box(std::vector< Maze::Vertex > *vertices, glm::vec3 const &min, glm::vec3 const &max, glm::u8vec4 const &color) {
+		auto corner = [&](uint32_t i, uint32_t j, uint32_t k) {
+			return glm::vec3(i ? max.x : min.x, j ? max.y : min.y, k ? max.z : min.z);
+		};
+		auto quad = [&](glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::vec3 const &d, glm::vec3 const &normal) {
+			for (glm::vec3 const &p : {a, b, c, a, c, d}) {
+				Maze::Vertex v;
+				v.Position = p;
+				v.Normal = normal;
+				v.Color = color;
+				vertices->emplace_back(v);
+			}
+		};
+		quad(corner(1,0,0), corner(1,1,0), corner(1,1,1), corner(1,0,1), glm::vec3( 1.0f, 0.0f, 0.0f));
+		quad(corner(0,0,0), corner(0,0,1), corner(0,1,1), corner(0,1,0), glm::vec3(-1.0f, 0.0f, 0.0f));
+		quad(corner(0,1,0), corner(0,1,1), corner(1,1,1), corner(1,1,0), glm::vec3( 0.0f, 1.0f, 0.0f));
+		quad(corner(0,0,0), corner(1,0,0), corner(1,0,1), corner(0,0,1), glm::vec3( 0.0f,-1.0f, 0.0f));
+		quad(corner(0,0,1), corner(1,0,1), corner(1,1,1), corner(0,1,1), glm::vec3( 0.0f, 0.0f, 1.0f));
+		quad(corner(0,0,0), corner(0,1,0), corner(1,1,0), corner(1,0,0), glm::vec3( 0.0f, 0.0f,-1.0f));
+	}
+}
+
+Maze::Maze(uint32_t width_, uint32_t height_, uint32_t seed_, uint32_t threads_) : width(width_), height(height_), seed(seed_), threads(threads_) {
+	if (width == 0 || height == 0) {
+		throw std::runtime_error("Maze must be at least one cell wide and tall.");
+	}
+	//(the walk mesh numbers the corners of its 3x3-per-cell grid with 32-bit indices)
+	if (uint64_t(3 * uint64_t(width) + 1) * (3 * uint64_t(height) + 1) > uint64_t(-1U)) {
+		throw std::runtime_error("Maze of " + std::to_string(width) + "x" + std::to_string(height) + " cells is too large.");
+	}
+	workers.reset(new WorkerPool(threads));
+	threads = workers->threads;
+
+	cells.assign(size_t(width) * height, 0);
+
+	uint32_t blocks_x = (width + BlockSize - 1) / BlockSize;
+	uint32_t blocks_y = (height + BlockSize - 1) / BlockSize;
+
+	//carve each block independently with a randomized depth-first search:
+	// (each block only writes its own cells, and passages between blocks are opened below)
+	workers->parallel_for(blocks_x * blocks_y, [&](uint32_t block) {
+		uint32_t x0 = (block % blocks_x) * BlockSize;
+		uint32_t y0 = (block / blocks_x) * BlockSize;
+		uint32_t w = std::min(BlockSize, width - x0);
+		uint32_t h = std::min(BlockSize, height - y0);
+
+		std::seed_seq seq{seed, block};
+		std::mt19937 mt(seq);
+		std::vector< bool > visited(w * h, false);
+		std::vector< uint32_t > stack;
+		stack.emplace_back(mt() % (w * h));
+		visited[stack.back()] = true;
+		while (!stack.empty()) {
+			uint32_t at = stack.back();
+			uint32_t x = at % w, y = at / w;
+			uint32_t options[4];
+			uint32_t count = 0;
+			if (x > 0 && !visited[at - 1]) options[count++] = at - 1;
+			if (x + 1 < w && !visited[at + 1]) options[count++] = at + 1;
+			if (y > 0 && !visited[at - w]) options[count++] = at - w;
+			if (y + 1 < h && !visited[at + w]) options[count++] = at + w;
+			if (count == 0) {
+				stack.pop_back();
+				continue;
+			}
+			uint32_t next = options[mt() % count];
+			uint32_t lo = std::min(at, next);
+			uint32_t hi = std::max(at, next);
+			uint8_t &cell = cells[(y0 + lo / w) * width + (x0 + lo % w)];
+			cell |= (hi == lo + w ? OpenNorth : OpenEast); //(checked this way around since w may be 1)
+			visited[next] = true;
+			stack.emplace_back(next);
+		}
+	});
+
+	//join the blocks with a randomized depth-first search over blocks, opening one passage per tree edge:
+	{
+		std::seed_seq seq{seed, uint32_t(-1U)};
+		std::mt19937 mt(seq);
+		std::vector< bool > visited(blocks_x * blocks_y, false);
+		std::vector< uint32_t > stack;
+		stack.emplace_back(0);
+		visited[0] = true;
+		while (!stack.empty()) {
+			uint32_t at = stack.back();
+			uint32_t bx = at % blocks_x, by = at / blocks_x;
+			uint32_t options[4];
+			uint32_t count = 0;
+			if (bx > 0 && !visited[at - 1]) options[count++] = at - 1;
+			if (bx + 1 < blocks_x && !visited[at + 1]) options[count++] = at + 1;
+			if (by > 0 && !visited[at - blocks_x]) options[count++] = at - blocks_x;
+			if (by + 1 < blocks_y && !visited[at + blocks_x]) options[count++] = at + blocks_x;
+			if (count == 0) {
+				stack.pop_back();
+				continue;
+			}
+			uint32_t next = options[mt() % count];
+			uint32_t lo = std::min(at, next);
+			uint32_t hi = std::max(at, next);
+			uint32_t x0 = (lo % blocks_x) * BlockSize;
+			uint32_t y0 = (lo / blocks_x) * BlockSize;
+			uint32_t w = std::min(BlockSize, width - x0);
+			uint32_t h = std::min(BlockSize, height - y0);
+			if (hi != lo + blocks_x) {
+				//through the east side of block 'lo':
+				cells[(y0 + mt() % h) * width + (x0 + w - 1)] |= OpenEast;
+			} else {
+				//through the north side of block 'lo':
+				cells[(y0 + h - 1) * width + (x0 + mt() % w)] |= OpenNorth;
+			}
+			visited[next] = true;
+			stack.emplace_back(next);
+		}
+	}
+}
+
+void Maze::make_walkmesh(std::vector< glm::vec3 > *vertices_, std::vector< glm::uvec3 > *triangles_) const {
+	assert(vertices_);
+	assert(triangles_);
+	auto &vertices = *vertices_;
+	auto &triangles = *triangles_;
+
+	//corners of the squares are numbered on a grid with three squares per cell (plus one) on a side:
+	uint32_t stride = 3 * width + 1;
+	auto coordinate = [](uint32_t f) {
+		static float const offsets[3] = {0.0f, 0.5f * WallThickness, CellSize - 0.5f * WallThickness};
+		return float(f / 3) * CellSize + offsets[f % 3];
+	};
+
+	//triangles for rows of blocks, in parallel:
+	uint32_t block_rows = (height + BlockSize - 1) / BlockSize;
+	std::vector< std::vector< glm::uvec3 > > row_triangles(block_rows);
+	workers->parallel_for(block_rows, [&](uint32_t row) {
+		std::vector< glm::uvec3 > &out = row_triangles[row];
+		auto square = [&](uint32_t fx, uint32_t fy) {
+			uint32_t a = fy * stride + fx;
+			uint32_t b = a + 1;
+			uint32_t c = a + stride;
+			uint32_t d = c + 1;
+			out.emplace_back(a, b, d);
+			out.emplace_back(a, d, c);
+		};
+		for (uint32_t y = row * BlockSize; y < std::min(height, (row + 1) * BlockSize); ++y) {
+			for (uint32_t x = 0; x < width; ++x) {
+				uint32_t fx = 3 * x, fy = 3 * y;
+				square(fx + 1, fy + 1);
+				if (x > 0 && open_east(x - 1, y)) square(fx + 0, fy + 1);
+				if (open_east(x, y)) square(fx + 2, fy + 1);
+				if (y > 0 && open_north(x, y - 1)) square(fx + 1, fy + 0);
+				if (open_north(x, y)) square(fx + 1, fy + 2);
+			}
+		}
+	});
+
+	size_t total = 0;
+	for (auto const &row : row_triangles) total += row.size();
+	triangles.clear();
+	triangles.reserve(total);
+	for (auto &row : row_triangles) {
+		triangles.insert(triangles.end(), row.begin(), row.end());
+		std::vector< glm::uvec3 >().swap(row);
+	}
+
+	//keep only the corners in use (numbered in grid order):
+	std::vector< uint32_t > remap(size_t(stride) * (3 * height + 1), -1U);
+	for (auto const &tri : triangles) {
+		remap[tri.x] = remap[tri.y] = remap[tri.z] = 0;
+	}
+	vertices.clear();
+	for (uint32_t f = 0; f < remap.size(); ++f) {
+		if (remap[f] == -1U) continue;
+		remap[f] = uint32_t(vertices.size());
+		vertices.emplace_back(coordinate(f % stride), coordinate(f / stride), 0.0f);
+	}
+	uint32_t chunk = 1 << 16;
+	workers->parallel_for(uint32_t((triangles.size() + chunk - 1) / chunk), [&](uint32_t c) {
+		for (size_t i = size_t(c) * chunk; i < std::min(triangles.size(), size_t(c + 1) * chunk); ++i) {
+			glm::uvec3 &tri = triangles[i];
+			tri = glm::uvec3(remap[tri.x], remap[tri.y], remap[tri.z]);
+		}
+	});
+}
+
+void Maze::make_meshes(std::vector< Vertex > *vertices_, std::vector< char > *strings_, std::vector< MeshEntry > *index_) const {
+	assert(vertices_);
+	assert(strings_);
+	assert(index_);
+	auto &vertices = *vertices_;
+	auto &strings = *strings_;
+	auto &index = *index_;
+	vertices.clear();
+	strings.clear();
+	index.clear();
+
+	auto begin_mesh = [&](std::string const &name) {
+		MeshEntry entry;
+		append_string(&strings, name, &entry.name_begin, &entry.name_end);
+		entry.vertex_begin = entry.vertex_end = uint32_t(vertices.size());
+		index.emplace_back(entry);
+	};
+	auto end_mesh = [&]() {
+		index.back().vertex_end = uint32_t(vertices.size());
+	};
+
+	//floor is a single quad under the whole maze:
+	begin_mesh("CageFloor");
+	{
+		glm::vec3 max = glm::vec3(width * CellSize, height * CellSize, 0.0f);
+		for (glm::vec3 const &p : {glm::vec3(0.0f), glm::vec3(max.x, 0.0f, 0.0f), max, glm::vec3(0.0f), max, glm::vec3(0.0f, max.y, 0.0f)}) {
+			Vertex v;
+			v.Position = p;
+			v.Normal = glm::vec3(0.0f, 0.0f, 1.0f);
+			v.Color = glm::u8vec4(0x88, 0x88, 0x88, 0xff);
+			vertices.emplace_back(v);
+		}
+	}
+	end_mesh();
+
+	//walls run along x, from the middle of one corner post to the middle of the next, and stand on z = 0:
+	begin_mesh("Wall");
+	append_box(&vertices,
+		glm::vec3(-0.5f * (CellSize + WallThickness), -0.5f * WallThickness, 0.0f),
+		glm::vec3( 0.5f * (CellSize + WallThickness),  0.5f * WallThickness, WallHeight),
+		glm::u8vec4(0xbb, 0xaa, 0x99, 0xff));
+	end_mesh();
+
+	begin_mesh("Monster");
+	append_box(&vertices, glm::vec3(-0.4f, -0.4f, -0.8f), glm::vec3(0.4f, 0.4f, 0.8f), glm::u8vec4(0xcc, 0x22, 0x11, 0xff));
+	end_mesh();
+}
+
+void Maze::make_scene(std::vector< char > *strings_, std::vector< TransformEntry > *transforms_, std::vector< SceneMeshEntry > *meshes_) const {
+	assert(strings_);
+	assert(transforms_);
+	assert(meshes_);
+	auto &strings = *strings_;
+	auto &transforms = *transforms_;
+	auto &meshes = *meshes_;
+	strings.clear();
+	transforms.clear();
+	meshes.clear();
+
+	glm::vec4 const no_rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	glm::vec4 const quarter_turn = glm::vec4(0.0f, 0.0f, 0.70710678f, 0.70710678f); //about z, so walls run along y
+	auto add_transform = [&](int32_t parent, std::string const &name, glm::vec3 const &position, glm::vec4 const &rotation) {
+		TransformEntry entry;
+		entry.parent_ref = parent;
+		append_string(&strings, name, &entry.name_begin, &entry.name_end);
+		entry.position = position;
+		entry.rotation = rotation;
+		entry.scale = glm::vec3(1.0f);
+		transforms.emplace_back(entry);
+		return int32_t(transforms.size() - 1);
+	};
+	auto add_mesh = [&](int32_t transform, std::string const &name) {
+		SceneMeshEntry entry;
+		entry.transform_ref = transform;
+		append_string(&strings, name, &entry.name_begin, &entry.name_end);
+		meshes.emplace_back(entry);
+	};
+
+	int32_t root = add_transform(-1, "Maze", glm::vec3(0.0f), no_rotation);
+	add_mesh(add_transform(root, "CageFloor", glm::vec3(0.0f), no_rotation), "CageFloor");
+	add_mesh(add_transform(-1, "Monster", glm::vec3((width - 0.5f) * CellSize, (height - 0.5f) * CellSize, 0.8f), no_rotation), "Monster");
+	add_transform(-1, "Player", glm::vec3(0.5f * CellSize, 0.5f * CellSize, 1.0f), glm::vec4(0.5f));
+
+	//all walls share the mesh name:
+	SceneMeshEntry wall_mesh;
+	wall_mesh.transform_ref = -1;
+	append_string(&strings, "Wall", &wall_mesh.name_begin, &wall_mesh.name_end);
+
+	//walls of each block, in parallel (positions relative to the block):
+	struct Wall {
+		std::string name;
+		glm::vec3 position;
+		glm::vec4 rotation;
+	};
+	uint32_t blocks_x = (width + BlockSize - 1) / BlockSize;
+	uint32_t blocks_y = (height + BlockSize - 1) / BlockSize;
+	std::vector< std::vector< Wall > > block_walls(blocks_x * blocks_y);
+	workers->parallel_for(blocks_x * blocks_y, [&](uint32_t block) {
+		uint32_t x0 = (block % blocks_x) * BlockSize;
+		uint32_t y0 = (block / blocks_x) * BlockSize;
+		std::vector< Wall > &out = block_walls[block];
+		auto wall = [&](uint32_t x, uint32_t y, char const *side, float px, float py, glm::vec4 const &rotation) {
+			Wall w;
+			w.name = "Wall." + std::to_string(x) + "." + std::to_string(y) + "." + side;
+			w.position = glm::vec3((px - x0) * CellSize, (py - y0) * CellSize, 0.0f);
+			w.rotation = rotation;
+			out.emplace_back(w);
+		};
+		for (uint32_t y = y0; y < std::min(height, y0 + BlockSize); ++y) {
+			for (uint32_t x = x0; x < std::min(width, x0 + BlockSize); ++x) {
+				if (y == 0) wall(x, y, "s", x + 0.5f, float(y), no_rotation);
+				if (x == 0) wall(x, y, "w", float(x), y + 0.5f, quarter_turn);
+				if (!open_east(x, y)) wall(x, y, "e", x + 1.0f, y + 0.5f, quarter_turn);
+				if (!open_north(x, y)) wall(x, y, "n", x + 0.5f, y + 1.0f, no_rotation);
+			}
+		}
+	});
+
+	for (uint32_t block = 0; block < block_walls.size(); ++block) {
+		uint32_t bx = block % blocks_x, by = block / blocks_x;
+		int32_t block_ref = add_transform(root, "Block." + std::to_string(bx) + "." + std::to_string(by),
+			glm::vec3(bx * BlockSize * CellSize, by * BlockSize * CellSize, 0.0f), no_rotation);
+		for (auto const &w : block_walls[block]) {
+			wall_mesh.transform_ref = add_transform(block_ref, w.name, w.position, w.rotation);
+			meshes.emplace_back(wall_mesh);
+		}
+		std::vector< Wall >().swap(block_walls[block]);
+	}
+}
+
+void Maze::save(std::string const &prefix) const {
+	{ //walk mesh:
+		std::vector< glm::vec3 > vertices;
+		std::vector< glm::uvec3 > triangles;
+		make_walkmesh(&vertices, &triangles);
+		WalkMesh walk_mesh(vertices, triangles);
+		walk_mesh.save_cooked(prefix + ".walkmesh");
+	}
+
+	{ //meshes:
+		std::vector< Vertex > vertices;
+		std::vector< char > strings;
+		std::vector< MeshEntry > index;
+		make_meshes(&vertices, &strings, &index);
+		std::ofstream file(prefix + ".pnc", std::ios::binary);
+		write_chunk(file, "pnc.", vertices);
+		write_chunk(file, "str0", strings);
+		write_chunk(file, "idx0", index);
+		if (!file) {
+			throw std::runtime_error("Failed to write '" + prefix + ".pnc'.");
+		}
+	}
+
+	{ //scene:
+		std::vector< char > strings;
+		std::vector< TransformEntry > transforms;
+		std::vector< SceneMeshEntry > meshes;
+		make_scene(&strings, &transforms, &meshes);
+		std::ofstream file(prefix + ".scene", std::ios::binary);
+		write_chunk(file, "str0", strings);
+		write_chunk(file, "xfh0", transforms);
+		write_chunk(file, "msh0", meshes);
+		write_chunk(file, "cam0", std::vector< char >());
+		write_chunk(file, "lmp0", std::vector< char >());
+		if (!file) {
+			throw std::runtime_error("Failed to write '" + prefix + ".scene'.");
+		}
+	}
+
+	{ //potentially-visible sets:
+		CellVisibility visibility(width, height, glm::vec2(0.0f), CellSize, cells, threads);
+		visibility.save(prefix + ".pvs");
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "WorkerPool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//"Maze" generates a random (perfect) maze on a grid of cells, along with the assets needed to play it:
+// - a walk mesh covering the floor of the cells and the passages between them;
+// - meshes in MeshBuffer's ".pnc" layout ("CageFloor", "Wall", and "Monster");
+// - a scene in the layout written by meshes/export-scene.py, with a transform per wall grouped into blocks of cells;
+// - potentially-visible sets for the cells (see CellVisibility).
+//
+//save() writes these as "<prefix>.walkmesh", "<prefix>.pnc", "<prefix>.scene", and "<prefix>.pvs", which CratesMode can load as a level.
+//
+//Generation is split across threads by blocks of cells; the results depend only on the size and seed, not on the number of threads.
+//The maze lies on the xy plane (+z up, like the levels exported from blender), with cell (0,0) at the origin.
+
+struct Maze {
+	//generate a 'width' x 'height' maze (threads == 0 means one per hardware thread):
+	// note: will throw if either dimension is zero
+	Maze(uint32_t width, uint32_t height, uint32_t seed = 0, uint32_t threads = 0);
+
+	uint32_t width = 0, height = 0;
+	uint32_t seed = 0;
+	uint32_t threads = 1;
+	std::unique_ptr< WorkerPool > workers; //(kept for the make_* functions, so they don't start threads of their own)
+
+	//cells[y * width + x] holds which passages out of cell (x,y) are open:
+	enum : uint8_t {
+		OpenEast = 1, //to cell (x+1,y)
+		OpenNorth = 2 //to cell (x,y+1)
+	};
+	std::vector< uint8_t > cells;
+
+	bool open_east(uint32_t x, uint32_t y) const { return x + 1 < width && (cells[y * width + x] & OpenEast); }
+	bool open_north(uint32_t x, uint32_t y) const { return y + 1 < height && (cells[y * width + x] & OpenNorth); }
+
+	//layout, in world units:
+	static constexpr float CellSize = 3.0f; //(the wall spacing in maze.blend)
+	static constexpr float WallThickness = 0.3f;
+	static constexpr float WallHeight = 2.5f;
+	//cells per side of the blocks that are carved independently (and grouped under one transform in the scene):
+	static constexpr uint32_t BlockSize = 32;
+
+	//------ assets ------
+
+	//walk mesh: each cell is split 3x3 by the wall thickness; the middle square is always walkable,
+	// the squares along its sides are walkable if there is a passage that way, and the corners never are:
+	void make_walkmesh(std::vector< glm::vec3 > *vertices, std::vector< glm::uvec3 > *triangles) const;
+
+	//meshes, as in a ".pnc" file:
+	struct Vertex {
+		glm::vec3 Position;
+		glm::vec3 Normal;
+		glm::u8vec4 Color;
+	};
+	static_assert(sizeof(Vertex) == 3*4+3*4+4*1, "Vertex is packed.");
+	struct MeshEntry {
+		uint32_t name_begin, name_end;
+		uint32_t vertex_begin, vertex_end;
+	};
+	static_assert(sizeof(MeshEntry) == 16, "MeshEntry is packed.");
+	void make_meshes(std::vector< Vertex > *vertices, std::vector< char > *strings, std::vector< MeshEntry > *index) const;
+
+	//scene, as in a ".scene" file:
+	// "Maze" is the root, with "CageFloor" and a "Block.<bx>.<by>" per block as children, and a "Wall.<x>.<y>.<side>" per wall under its block;
+	// "Monster" (in the far corner cell) and "Player" (in cell (0,0)) are roots.
+	struct TransformEntry {
+		int32_t parent_ref;
+		uint32_t name_begin, name_end;
+		glm::vec3 position;
+		glm::vec4 rotation; //quaternion as x,y,z,w
+		glm::vec3 scale;
+	};
+	static_assert(sizeof(TransformEntry) == 4+4*2+4*3+4*4+4*3, "TransformEntry is packed.");
+	struct SceneMeshEntry {
+		int32_t transform_ref;
+		uint32_t name_begin, name_end;
+	};
+	static_assert(sizeof(SceneMeshEntry) == 12, "SceneMeshEntry is packed.");
+	void make_scene(std::vector< char > *strings, std::vector< TransformEntry > *transforms, std::vector< SceneMeshEntry > *meshes) const;
+
+	//write "<prefix>.walkmesh" (cooked), "<prefix>.pnc", "<prefix>.scene", and "<prefix>.pvs":
+	// note: will throw if a file fails to write
+	void save(std::string const &prefix) const;
+};
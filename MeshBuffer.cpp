@@ -3,6 +3,8 @@
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
@@ -10,8 +12,9 @@
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cstring>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
+MeshBuffer::MeshBuffer(std::string const &filename, bool keep_vertex_data_) : keep_vertex_data(keep_vertex_data_) {
 	glGenBuffers(1, &vbo);
 
 	std::ifstream file(filename, std::ios::binary);
@@ -33,6 +36,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		vertex_data.assign(reinterpret_cast< uint8_t const * >(data.data()), reinterpret_cast< uint8_t const * >(data.data() + data.size()));
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -53,6 +57,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		vertex_data.assign(reinterpret_cast< uint8_t const * >(data.data()), reinterpret_cast< uint8_t const * >(data.data() + data.size()));
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -75,6 +80,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		vertex_data.assign(reinterpret_cast< uint8_t const * >(data.data()), reinterpret_cast< uint8_t const * >(data.data() + data.size()));
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -99,6 +105,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
+		vertex_data.assign(reinterpret_cast< uint8_t const * >(data.data()), reinterpret_cast< uint8_t const * >(data.data() + data.size()));
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -134,6 +141,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			Mesh mesh;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
+			compute_bounds(&mesh);
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
@@ -145,6 +153,9 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
+	//(bounds are computed, so the copy is only needed if asked for)
+	if (!keep_vertex_data) std::vector< uint8_t >().swap(vertex_data);
+
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
 	for (auto const &m : meshes) {
@@ -156,6 +167,52 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	*/
 }
 
+MeshBuffer::MeshBuffer(MeshBuffer const &format, std::vector< uint8_t > &&vertex_data_, std::map< std::string, Mesh > const &meshes_)
+	: Position(format.Position), Normal(format.Normal), Color(format.Color), TexCoord(format.TexCoord),
+	  vertex_data(std::move(vertex_data_)), meshes(meshes_) {
+	GLuint total = GLuint(vertex_data.size() / vertex_stride());
+	for (auto &name_mesh : meshes) {
+		Mesh &mesh = name_mesh.second;
+		if (!(mesh.start <= total && mesh.count <= total - mesh.start)) {
+			throw std::runtime_error("mesh '" + name_mesh.first + "' has out-of-range vertex start/count");
+		}
+		compute_bounds(&mesh);
+	}
+}
+
+void MeshBuffer::upload() {
+	if (vbo == 0) glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertex_data.size(), vertex_data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (!keep_vertex_data) std::vector< uint8_t >().swap(vertex_data);
+}
+
+glm::vec3 MeshBuffer::position(GLuint vertex) const {
+	assert(Position.size == 3 && Position.type == GL_FLOAT);
+	glm::vec3 ret;
+	std::memcpy(&ret, vertex_data.data() + vertex * vertex_stride() + Position.offset, sizeof(ret));
+	return ret;
+}
+
+void MeshBuffer::compute_bounds(Mesh *mesh_) const {
+	assert(mesh_);
+	Mesh &mesh = *mesh_;
+	if (mesh.count == 0) return;
+	mesh.min = mesh.max = position(mesh.start);
+	for (GLuint v = mesh.start; v < mesh.start + mesh.count; ++v) {
+		mesh.min = glm::min(mesh.min, position(v));
+		mesh.max = glm::max(mesh.max, position(v));
+	}
+	mesh.center = 0.5f * (mesh.min + mesh.max);
+	float radius2 = 0.0f;
+	for (GLuint v = mesh.start; v < mesh.start + mesh.count; ++v) {
+		glm::vec3 to = position(v) - mesh.center;
+		radius2 = std::max(radius2, glm::dot(to, to));
+	}
+	mesh.radius = std::sqrt(radius2);
+}
+
 const MeshBuffer::Mesh &MeshBuffer::lookup(std::string const &name) const {
 	auto f = meshes.find(name);
 	if (f == meshes.end()) {
@@ -1,7 +1,13 @@
 #pragma once
 
 #include "GL.hpp"
+
+#include <glm/glm.hpp>
+
 #include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
 
 //"MeshBuffer" holds a collection of meshes loaded from a file
 // (note that meshes in a single collection will share a vbo/vao)
@@ -30,22 +36,45 @@ struct MeshBuffer {
 
 
 	//construct from a file:
+	// (with keep_vertex_data, a copy of the vertices stays in vertex_data -- needed to bake static geometry or be an occluder, see Scene;
+	//  otherwise it is freed once mesh bounds are computed)
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	MeshBuffer(std::string const &filename, bool keep_vertex_data = false);
+
+	//empty buffer with no OpenGL objects (e.g., to describe a vertex layout by hand):
+	MeshBuffer() = default;
 
 	//look up a particular mesh in the DB:
 	// note: will throw if mesh not found.
 	struct Mesh {
 		GLuint start = 0;
 		GLuint count = 0;
+		//bounds of the mesh's vertices (for culling):
+		glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f); //axis-aligned box
+		glm::vec3 center = glm::vec3(0.0f); //sphere (around the box's center)
+		float radius = 0.0f;
 	};
 	const Mesh &lookup(std::string const &name) const;
 
+	//construct from vertex data in memory, laid out like 'format' (e.g., for baked geometry; see Scene::bake_static):
+	// (mesh bounds are computed here; makes no OpenGL calls -- call upload() before drawing)
+	// note: will throw if a mesh is out of range.
+	MeshBuffer(MeshBuffer const &format, std::vector< uint8_t > &&vertex_data, std::map< std::string, Mesh > const &meshes);
+	//copy vertex_data to vbo (creating it if needed), then free vertex_data unless keep_vertex_data is set:
+	void upload();
+
 	//build a vertex array object that links this vbo to attributes to a program:
 	//  will throw if program defines attributes not contained in this buffer
 	//  and warn if this buffer contains attributes not active in the program
 	GLuint make_vao_for_program(GLuint program) const;
 
+	//copy of the vertex data (empty unless kept):
+	std::vector< uint8_t > vertex_data;
+	bool keep_vertex_data = true;
+	GLsizei vertex_stride() const { return Position.stride; }
+	glm::vec3 position(GLuint vertex) const; //(Position must be three floats)
+
 	//internals:
 	std::map< std::string, Mesh > meshes;
+	void compute_bounds(Mesh *mesh) const;
 };
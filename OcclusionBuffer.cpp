@@ -0,0 +1,205 @@
+#include "OcclusionBuffer.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define OCCLUSION_SSE 1
+#include <emmintrin.h>
+#endif
+
+constexpr uint32_t OcclusionBuffer::BandHeight;
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width_, uint32_t height_) : width((width_ + 3) / 4 * 4), height(height_) {
+	depth.assign(width * height, 0.0f);
+}
+
+void OcclusionBuffer::clear(glm::mat4 const &world_to_clip_, float near_) {
+	assert(near_ > 0.0f && "Occlusion culling needs a near plane in front of the camera.");
+	world_to_clip = world_to_clip_;
+	near = near_;
+	std::fill(depth.begin(), depth.end(), 0.0f);
+	triangles.clear();
+}
+
+void OcclusionBuffer::add_triangle(glm::vec4 const &a, glm::vec4 const &b, glm::vec4 const &c) {
+	//clip to the near plane (w >= near), which leaves at most four corners:
+	glm::vec4 const in[3] = {a, b, c};
+	glm::vec4 out[4];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < 3; ++i) {
+		glm::vec4 const &p = in[i];
+		glm::vec4 const &q = in[(i + 1) % 3];
+		float dp = p.w - near, dq = q.w - near;
+		if (dp >= 0.0f) out[count++] = p;
+		if ((dp >= 0.0f) != (dq >= 0.0f)) out[count++] = p + (dp / (dp - dq)) * (q - p);
+	}
+	if (count < 3) return;
+
+	//to pixel coordinates and 1/w:
+	glm::vec3 screen[4];
+	for (uint32_t i = 0; i < count; ++i) {
+		float inv_w = 1.0f / std::max(out[i].w, near);
+		screen[i] = glm::vec3(
+			(out[i].x * inv_w * 0.5f + 0.5f) * width,
+			(out[i].y * inv_w * 0.5f + 0.5f) * height,
+			inv_w
+		);
+	}
+	for (uint32_t i = 2; i < count; ++i) {
+		add_screen_triangle(screen[0], screen[i-1], screen[i]);
+	}
+}
+
+void OcclusionBuffer::add_screen_triangle(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c) {
+	glm::vec3 const v[3] = {a, b, c};
+
+	//(computed in double, as corners can be far off screen)
+	double area = (double(b.x) - a.x) * (double(c.y) - a.y) - (double(b.y) - a.y) * (double(c.x) - a.x);
+	if (!(area > 0.0)) return; //back-facing or degenerate
+
+	Triangle tri;
+	float min_x = std::min(a.x, std::min(b.x, c.x)), max_x = std::max(a.x, std::max(b.x, c.x));
+	float min_y = std::min(a.y, std::min(b.y, c.y)), max_y = std::max(a.y, std::max(b.y, c.y));
+	if (!(max_x > 0.0f && min_x < float(width) && max_y > 0.0f && min_y < float(height))) return;
+	tri.x0 = uint32_t(std::max(0.0f, std::floor(min_x)));
+	tri.y0 = uint32_t(std::max(0.0f, std::floor(min_y)));
+	tri.x1 = uint32_t(std::min(float(width), std::ceil(max_x)));
+	tri.y1 = uint32_t(std::min(float(height), std::ceil(max_y)));
+	if (tri.x0 >= tri.x1 || tri.y0 >= tri.y1) return;
+
+	//edge i runs from corner i to corner i+1, and is positive on the side of the corner opposite it:
+	// (moved inward by half a pixel in x and y, so it is positive only at pixels the triangle covers entirely;
+	//  plus a little extra for rounding)
+	double z_x = 0.0, z_y = 0.0, z_c = 0.0;
+	for (uint32_t i = 0; i < 3; ++i) {
+		glm::vec3 const &p = v[i];
+		glm::vec3 const &q = v[(i + 1) % 3];
+		double ex = double(p.y) - q.y;
+		double ey = double(q.x) - p.x;
+		double ec = -(ex * p.x + ey * p.y);
+		double slack = 0.5 * (std::abs(ex) + std::abs(ey)) + 1e-5 * (std::abs(ex) * width + std::abs(ey) * height + std::abs(ec));
+		tri.edge_x[i] = float(ex);
+		tri.edge_y[i] = float(ey);
+		tri.edge_c[i] = float(ec - slack);
+		//(edge i over the area is the barycentric weight of the opposite corner)
+		z_x += ex * v[(i + 2) % 3].z;
+		z_y += ey * v[(i + 2) % 3].z;
+		z_c += ec * v[(i + 2) % 3].z;
+	}
+	z_x /= area;
+	z_y /= area;
+	z_c /= area;
+	//least 1/w within the pixel:
+	double z_slack = 0.5 * (std::abs(z_x) + std::abs(z_y)) + 1e-5 * (std::abs(z_x) * width + std::abs(z_y) * height + std::abs(z_c));
+	tri.z_x = float(z_x);
+	tri.z_y = float(z_y);
+	tri.z_c = float(z_c - z_slack);
+
+	triangles.emplace_back(tri);
+}
+
+void OcclusionBuffer::rasterize(WorkerPool *workers) {
+	uint32_t bands = (height + BandHeight - 1) / BandHeight;
+	if (workers) {
+		workers->parallel_for(bands, [this](uint32_t band){ rasterize_band(band); });
+	} else {
+		for (uint32_t band = 0; band < bands; ++band) rasterize_band(band);
+	}
+}
+
+void OcclusionBuffer::rasterize_band(uint32_t band) {
+	uint32_t band_y0 = band * BandHeight;
+	uint32_t band_y1 = std::min(height, band_y0 + BandHeight);
+	for (Triangle const &tri : triangles) {
+		uint32_t y0 = std::max(tri.y0, band_y0);
+		uint32_t y1 = std::min(tri.y1, band_y1);
+		for (uint32_t y = y0; y < y1; ++y) {
+			float cy = y + 0.5f;
+			float e0 = tri.edge_y[0] * cy + tri.edge_c[0];
+			float e1 = tri.edge_y[1] * cy + tri.edge_c[1];
+			float e2 = tri.edge_y[2] * cy + tri.edge_c[2];
+			float z = tri.z_y * cy + tri.z_c;
+			float *row = &depth[y * width];
+			uint32_t x = tri.x0 & ~3U;
+#ifdef OCCLUSION_SSE
+			//four pixels at a time (rows are a multiple of four pixels long, so this never runs off the end):
+			__m128 const zero = _mm_setzero_ps();
+			__m128 const ex0 = _mm_set1_ps(tri.edge_x[0]), ex1 = _mm_set1_ps(tri.edge_x[1]), ex2 = _mm_set1_ps(tri.edge_x[2]);
+			__m128 const ey0 = _mm_set1_ps(e0), ey1 = _mm_set1_ps(e1), ey2 = _mm_set1_ps(e2);
+			__m128 const zx = _mm_set1_ps(tri.z_x), zy = _mm_set1_ps(z);
+			__m128 cx = _mm_add_ps(_mm_set1_ps(float(x)), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+			__m128 const step = _mm_set1_ps(4.0f);
+			for (; x < tri.x1; x += 4) {
+				__m128 inside = _mm_and_ps(
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex0, cx), ey0), zero),
+					_mm_and_ps(
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex1, cx), ey1), zero),
+						_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex2, cx), ey2), zero)
+					)
+				);
+				__m128 value = _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(zx, cx), zy));
+				_mm_storeu_ps(row + x, _mm_max_ps(_mm_loadu_ps(row + x), value));
+				cx = _mm_add_ps(cx, step);
+			}
+#else
+			for (; x < tri.x1; ++x) {
+				float cx = x + 0.5f;
+				if (tri.edge_x[0] * cx + e0 >= 0.0f && tri.edge_x[1] * cx + e1 >= 0.0f && tri.edge_x[2] * cx + e2 >= 0.0f) {
+					row[x] = std::max(row[x], tri.z_x * cx + z);
+				}
+			}
+#endif
+		}
+	}
+}
+
+bool OcclusionBuffer::occluded(glm::vec3 const &center, float radius) const {
+	glm::vec4 at = world_to_clip * glm::vec4(center, 1.0f);
+
+	//nearest point of the sphere:
+	// (w grows along the view direction, at a rate given by the last row of world_to_clip)
+	float nearest = at.w - radius * glm::length(glm::vec3(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3]));
+	if (!(nearest > near)) return false;
+	float z = 1.0f / nearest;
+
+	//pixels covered by the sphere's bounding cube:
+	float min_x = float(width), max_x = 0.0f, min_y = float(height), max_y = 0.0f;
+	for (uint32_t corner = 0; corner < 8; ++corner) {
+		glm::vec4 p = at
+			+ ((corner & 1) ? radius : -radius) * world_to_clip[0]
+			+ ((corner & 2) ? radius : -radius) * world_to_clip[1]
+			+ ((corner & 4) ? radius : -radius) * world_to_clip[2];
+		if (!(p.w > near)) return false;
+		float x = (p.x / p.w * 0.5f + 0.5f) * width;
+		float y = (p.y / p.w * 0.5f + 0.5f) * height;
+		min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+	}
+	if (!(max_x >= 0.0f && min_x < float(width) && max_y >= 0.0f && min_y < float(height))) return false; //(off screen)
+	uint32_t x0 = uint32_t(std::max(0.0f, std::floor(min_x)));
+	uint32_t y0 = uint32_t(std::max(0.0f, std::floor(min_y)));
+	uint32_t x1 = uint32_t(std::min(float(width - 1), std::floor(max_x))) + 1;
+	uint32_t y1 = uint32_t(std::min(float(height - 1), std::floor(max_y))) + 1;
+
+	//occluded only if every pixel holds something nearer:
+	for (uint32_t y = y0; y < y1; ++y) {
+		float const *row = &depth[y * width];
+		uint32_t x = x0;
+#ifdef OCCLUSION_SSE
+		for (; x < x1 && (x & 3); ++x) {
+			if (!(row[x] > z)) return false;
+		}
+		__m128 const vz = _mm_set1_ps(z);
+		for (; x + 4 <= x1; x += 4) {
+			if (_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(row + x), vz)) != 0xf) return false;
+		}
+#endif
+		for (; x < x1; ++x) {
+			if (!(row[x] > z)) return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct WorkerPool;
+
+//"OcclusionBuffer" is a small software depth buffer for occlusion culling (it makes no OpenGL calls):
+//
+// buffer.clear(world_to_clip, camera->near);
+// for (...) buffer.add_triangle(a, b, c); //clip-space corners of occluder triangles
+// buffer.rasterize(workers);
+// if (buffer.occluded(center, radius)) { /* ...skip drawing... */ }
+//
+//Occluders are rasterized conservatively -- a pixel only takes an occluder's depth if the occluder covers all of it,
+// and then the depth of the farthest point of the occluder in that pixel -- so occluded() never hides anything the GPU would draw.
+//Only front-facing (counterclockwise) triangles are rasterized, since back faces are either culled or behind front faces.
+//
+//Depths are stored as 1/w (so they interpolate linearly across the screen): larger is closer, and zero means nothing was drawn.
+
+struct OcclusionBuffer {
+	//'width' is rounded up to a multiple of four:
+	OcclusionBuffer(uint32_t width = 256, uint32_t height = 128);
+
+	uint32_t width, height;
+	std::vector< float > depth; //depth[y * width + x] is pixel (x,y), with y = 0 at the bottom of the screen
+
+	//start a new frame, seen through 'world_to_clip' (a perspective projection whose near plane is at w == 'near'):
+	void clear(glm::mat4 const &world_to_clip, float near);
+
+	//add an occluder triangle (corners in clip space); triangles are clipped to the near plane here and drawn in rasterize():
+	void add_triangle(glm::vec4 const &a, glm::vec4 const &b, glm::vec4 const &c);
+
+	//draw added triangles into 'depth', split by bands of rows across 'workers' (if given):
+	void rasterize(WorkerPool *workers = nullptr);
+
+	//is the (world-space) sphere entirely behind what was rasterized?
+	bool occluded(glm::vec3 const &center, float radius) const;
+
+	//------ internals ------
+
+	glm::mat4 world_to_clip = glm::mat4(1.0f);
+	float near = 0.01f;
+
+	//a triangle ready to rasterize, as functions of pixel-center coordinates:
+	// (all three edges are >= 0 at pixels the triangle covers entirely; 'z' is the least 1/w within the pixel)
+	struct Triangle {
+		float edge_x[3], edge_y[3], edge_c[3];
+		float z_x, z_y, z_c;
+		uint32_t x0, y0, x1, y1; //pixels [x0,x1) x [y0,y1) contain the triangle
+	};
+	std::vector< Triangle > triangles;
+	void add_screen_triangle(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c); //(corners as pixel x, pixel y, 1/w)
+
+	static constexpr uint32_t BandHeight = 16; //rows rasterized by one parallel_for index
+	void rasterize_band(uint32_t band);
+};
@@ -0,0 +1,211 @@
+#include "PathFinder.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+PathFinder::PathFinder(WalkMesh const &mesh_) : mesh(mesh_) {
+	nodes.resize(mesh.triangles.size());
+	open.reserve(mesh.triangles.size());
+}
+
+//twice the signed area of triangle abc, as seen looking down 'up' (positive if counter-clockwise):
+static float triarea2(glm::vec3 const &up, glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c) {
+	return glm::dot(up, glm::cross(b - a, c - a));
+}
+
+bool PathFinder::find_path(WalkMesh::WalkPoint const &from, WalkMesh::WalkPoint const &to, std::vector< glm::vec3 > *path) {
+	begin_search(from, to);
+	SearchStatus status = continue_search(-1U);
+	assert(status != Searching);
+	return finish_search(status, path);
+}
+
+static bool heap_order(PathFinder::OpenEntry const &a, PathFinder::OpenEntry const &b) {
+	return a.estimate > b.estimate; //(min-heap)
+}
+
+void PathFinder::begin_search(WalkMesh::WalkPoint const &from, WalkMesh::WalkPoint const &to) {
+	assert(from.triangle < mesh.triangles.size());
+	assert(to.triangle < mesh.triangles.size());
+
+	search_from = from;
+	search_to = to;
+	start = mesh.world_point(from);
+	goal = mesh.world_point(to);
+
+	//new search; stamps mark which nodes belong to it, so nothing needs clearing:
+	++stamp;
+	if (stamp == 0) { //wrapped around; old stamps might collide
+		for (auto &node : nodes) node.stamp = 0;
+		stamp = 1;
+	}
+
+	open.clear();
+	Node &node = nodes[from.triangle];
+	node.stamp = stamp;
+	node.parent = -1U;
+	node.parent_corner = -1U;
+	node.cost = 0.0f;
+	node.at = start;
+	open.push_back(OpenEntry{glm::distance(start, goal), 0.0f, from.triangle});
+}
+
+PathFinder::SearchStatus PathFinder::continue_search(uint32_t max_expansions) {
+	for (uint32_t expansions = 0; expansions < max_expansions; ++expansions) {
+		if (open.empty()) return NotFound;
+
+		std::pop_heap(open.begin(), open.end(), heap_order);
+		OpenEntry entry = open.back();
+		open.pop_back();
+
+		Node const &node = nodes[entry.triangle];
+		if (entry.cost > node.cost) continue; //stale entry
+
+		if (entry.triangle == search_to.triangle) return Found;
+
+		glm::uvec3 const &tri = mesh.triangles[entry.triangle];
+		for (uint32_t corner = 0; corner < 3; ++corner) {
+			uint32_t next = mesh.neighbors[entry.triangle][corner];
+			if (next == -1U) continue;
+
+			glm::vec3 portal = 0.5f * (mesh.vertices[tri[(corner + 1) % 3]] + mesh.vertices[tri[(corner + 2) % 3]]);
+			float cost = node.cost + glm::distance(node.at, portal);
+			//(the goal's true position is known, so measure to it directly once there)
+			if (next == search_to.triangle) cost += glm::distance(portal, goal);
+
+			Node &next_node = nodes[next];
+			if (next_node.stamp == stamp && next_node.cost <= cost) continue;
+			next_node.stamp = stamp;
+			next_node.parent = entry.triangle;
+			next_node.parent_corner = corner;
+			next_node.cost = cost;
+			next_node.at = portal;
+			float heuristic = (next == search_to.triangle ? 0.0f : glm::distance(portal, goal));
+			open.push_back(OpenEntry{cost + heuristic, cost, next});
+			std::push_heap(open.begin(), open.end(), heap_order);
+		}
+	}
+	return Searching;
+}
+
+bool PathFinder::finish_search(SearchStatus status, std::vector< glm::vec3 > *path_) {
+	assert(path_);
+	auto &path = *path_;
+	assert(status != Searching);
+
+	path.clear();
+	if (status != Found) return false;
+
+
+	//collect portals from goal back to start, as seen walking from start to goal:
+	// (crossing out of a CCW triangle through the edge opposite 'corner',
+	//  vertex corner+1 is on the right and corner+2 is on the left)
+	portal_left.clear();
+	portal_right.clear();
+	portal_left.emplace_back(goal);
+	portal_right.emplace_back(goal);
+	for (uint32_t t = search_to.triangle; nodes[t].parent != -1U; t = nodes[t].parent) {
+		Node const &node = nodes[t];
+		glm::uvec3 const &tri = mesh.triangles[node.parent];
+		portal_right.emplace_back(mesh.vertices[tri[(node.parent_corner + 1) % 3]]);
+		portal_left.emplace_back(mesh.vertices[tri[(node.parent_corner + 2) % 3]]);
+	}
+	portal_left.emplace_back(start);
+	portal_right.emplace_back(start);
+	std::reverse(portal_left.begin(), portal_left.end());
+	std::reverse(portal_right.begin(), portal_right.end());
+
+	//"simple stupid funnel" (after Mikko Mononen's description):
+	// keep a funnel from 'apex' through the narrowest left and right portal points seen so far;
+	// when one side crosses over the other, the crossed point becomes a corner of the path.
+	path.emplace_back(start);
+	glm::vec3 apex = start, left = start, right = start;
+	uint32_t apex_index = 0, left_index = 0, right_index = 0;
+	for (uint32_t i = 1; i < portal_left.size(); ++i) {
+		glm::vec3 const &l = portal_left[i];
+		glm::vec3 const &r = portal_right[i];
+
+		//try to narrow the right side:
+		if (triarea2(up, apex, right, r) >= 0.0f) {
+			if (apex == right || triarea2(up, apex, left, r) < 0.0f) {
+				right = r;
+				right_index = i;
+			} else {
+				//right crossed over left; left is a corner:
+				if (path.back() != left) path.emplace_back(left);
+				apex = left;
+				apex_index = left_index;
+				right = apex;
+				right_index = apex_index;
+				i = apex_index;
+				continue;
+			}
+		}
+
+		//try to narrow the left side:
+		if (triarea2(up, apex, left, l) <= 0.0f) {
+			if (apex == left || triarea2(up, apex, right, l) > 0.0f) {
+				left = l;
+				left_index = i;
+			} else {
+				//left crossed over right; right is a corner:
+				if (path.back() != right) path.emplace_back(right);
+				apex = right;
+				apex_index = right_index;
+				left = apex;
+				left_index = apex_index;
+				i = apex_index;
+				continue;
+			}
+		}
+	}
+	if (path.back() != goal) path.emplace_back(goal);
+
+	return true;
+}
+
+void PathFinder::enqueue(Query *query) {
+	assert(query);
+	if (query->status != Query::Pending) {
+		query->status = Query::Pending;
+		//reclaim space used by already-run queries before growing:
+		if (queue_head == queue.size()) {
+			queue.clear();
+			queue_head = 0;
+		}
+		queue.emplace_back(query);
+	}
+}
+
+uint32_t PathFinder::update(float budget) {
+	auto before = std::chrono::high_resolution_clock::now();
+	uint32_t finished = 0;
+	while (queue_head < queue.size()) {
+		Query *query = queue[queue_head];
+		if (!query_searching) {
+			begin_search(query->from, query->to);
+			query_searching = true;
+		}
+		//(searches are run in slices so that one long search can't blow the budget)
+		SearchStatus status = continue_search(ExpansionsPerSlice);
+		if (status != Searching) {
+			query->status = (finish_search(status, &query->path) ? Query::Found : Query::NotFound);
+			query_searching = false;
+			++queue_head;
+			++finished;
+		}
+
+		float elapsed = std::chrono::duration< float >(std::chrono::high_resolution_clock::now() - before).count();
+		if (elapsed >= budget) break;
+	}
+	if (queue_head == queue.size()) {
+		queue.clear();
+		queue_head = 0;
+	} else if (queue_head > queue.size() / 2) {
+		//shift remaining queries down (in place) so the queue doesn't keep growing:
+		queue.erase(queue.begin(), queue.begin() + queue_head);
+		queue_head = 0;
+	}
+	return finished;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+//"PathFinder" searches for paths across a WalkMesh:
+// - A* runs over the triangle adjacency graph (WalkMesh::neighbors), with
+//   costs measured between the midpoints of the edges ("portals") crossed;
+// - the resulting corridor of triangles is smoothed into a list of world points
+//   with the "simple stupid funnel" algorithm;
+// - all search storage lives in the PathFinder and is reused, so (once warmed up)
+//   a query does not allocate.
+//
+//A PathFinder is not thread-safe; use one per thread.
+
+struct PathFinder {
+	PathFinder(WalkMesh const &mesh);
+
+	WalkMesh const &mesh;
+
+	//direction used to tell the left side of a portal from the right when smoothing paths:
+	// (floors exported from blender are +z up)
+	glm::vec3 up = glm::vec3(0.0f, 0.0f, 1.0f);
+
+	//find a path from 'from' to 'to':
+	// returns false if there is no path.
+	// otherwise, 'path' is overwritten with points from the start to the goal (inclusive).
+	bool find_path(WalkMesh::WalkPoint const &from, WalkMesh::WalkPoint const &to, std::vector< glm::vec3 > *path);
+
+	//------ budgeted queries ------
+	//Many agents can share a fixed amount of path-finding time per frame by queueing queries:
+
+	struct Query {
+		WalkMesh::WalkPoint from, to;
+		enum Status : uint32_t {
+			Idle,     //never queued
+			Pending,  //queued, not yet run
+			Found,    //'path' holds the result
+			NotFound  //no path exists
+		} status = Idle;
+		std::vector< glm::vec3 > path;
+	};
+
+	//add a query to the queue (the query must stay alive until it is no longer pending):
+	// (re-queueing a pending query just updates its endpoints)
+	void enqueue(Query *query);
+
+	//run queued queries (oldest first) until 'budget' seconds have been spent:
+	// (long searches are split across calls, so the budget is only overrun by one small slice of work)
+	// (changing the endpoints of the query currently being searched takes effect the next time it is queued)
+	// returns number of queries finished
+	uint32_t update(float budget);
+
+	//number of triangles update() expands between checks of the clock:
+	static constexpr uint32_t ExpansionsPerSlice = 128;
+
+	//number of queries waiting to run:
+	size_t pending() const { return queue.size() - queue_head; }
+
+	//------ internals ------
+
+	//find_path() and update() are built from these steps:
+	enum SearchStatus {
+		Searching,
+		Found,
+		NotFound
+	};
+	void begin_search(WalkMesh::WalkPoint const &from, WalkMesh::WalkPoint const &to);
+	SearchStatus continue_search(uint32_t max_expansions);
+	bool finish_search(SearchStatus status, std::vector< glm::vec3 > *path); //builds path if found
+
+	//current search:
+	WalkMesh::WalkPoint search_from, search_to;
+	glm::vec3 start = glm::vec3(0.0f), goal = glm::vec3(0.0f);
+
+	//per-triangle search state, valid only if 'stamp' matches the current search:
+	struct Node {
+		uint32_t stamp = 0;
+		uint32_t parent = -1U; //triangle this one was reached from
+		uint32_t parent_corner = -1U; //the corner of 'parent' opposite the edge crossed
+		float cost = 0.0f; //cost from the start to 'at'
+		glm::vec3 at = glm::vec3(0.0f); //where the path enters this triangle (start point or portal midpoint)
+	};
+	std::vector< Node > nodes;
+	uint32_t stamp = 0;
+
+	//open list (binary heap, lazily-deleted):
+	struct OpenEntry {
+		float estimate; //cost + heuristic
+		float cost; //if more than the node's cost, this entry is stale
+		uint32_t triangle;
+	};
+	std::vector< OpenEntry > open;
+
+	//portals along the found corridor:
+	std::vector< glm::vec3 > portal_left, portal_right;
+
+	std::vector< Query * > queue;
+	size_t queue_head = 0;
+	bool query_searching = false; //is queue[queue_head] partway through its search?
+};
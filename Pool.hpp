@@ -0,0 +1,107 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include <cassert>
+#include <cstddef>
+
+//"Pool" hands out T's from contiguous slabs of 'SlabSize' slots, instead of allocating each one separately:
+// - create() reuses the most recently freed slot (kept on a free list) before taking a fresh one;
+// - destroy() runs the destructor and puts the slot back on the free list;
+// - reserve() allocates slabs ahead of time, e.g. before loading a known number of items;
+// - clear() destroys everything left and releases the slabs in one go;
+// - for_each() visits live items in memory order.
+//Pointers to items stay valid until they are destroyed (slabs never move).
+
+template< typename T, size_t SlabSize = 1024 >
+struct Pool {
+	Pool() = default;
+	Pool(Pool const &) = delete;
+	Pool &operator=(Pool const &) = delete;
+	~Pool() { clear(); }
+
+	template< typename... Args >
+	T *create(Args&&... args) {
+		if (!free_list) add_slab();
+		Slot *slot = free_list;
+		T *t = new (slot->storage) T(std::forward< Args >(args)...); //(if this throws, the slot stays free)
+		free_list = slot->next_free;
+		slot->next_free = nullptr;
+		slot->live = true;
+		++live;
+		return t;
+	}
+
+	void destroy(T *t) {
+		assert(t);
+		Slot *slot = reinterpret_cast< Slot * >(t); //(storage is the first member of Slot)
+		assert(slot->live && "Pool::destroy() of an item not from this pool (or already destroyed).");
+		t->~T();
+		slot->live = false;
+		slot->next_free = free_list;
+		free_list = slot;
+		--live;
+	}
+
+	//make sure the next 'count' create()s won't allocate:
+	// (fresh slots are still handed out in memory order, after any freed ones)
+	void reserve(size_t count) {
+		size_t free = slabs.size() * SlabSize - live;
+		if (free >= count) return;
+		Slot **tail = &free_list;
+		while (*tail) tail = &(*tail)->next_free;
+		for (; free < count; free += SlabSize) {
+			slabs.emplace_back(new Slot[SlabSize]);
+			Slot *slab = slabs.back().get();
+			for (size_t i = 0; i + 1 < SlabSize; ++i) {
+				slab[i].next_free = &slab[i+1];
+			}
+			*tail = slab;
+			tail = &slab[SlabSize-1].next_free;
+		}
+	}
+
+	//destroy all items and release all slabs:
+	void clear() {
+		for_each([](T *t){ t->~T(); });
+		slabs.clear();
+		free_list = nullptr;
+		live = 0;
+	}
+
+	template< typename F >
+	void for_each(F const &f) {
+		for (auto &slab : slabs) {
+			for (Slot *slot = slab.get(), *end = slab.get() + SlabSize; slot != end; ++slot) {
+				if (slot->live) f(reinterpret_cast< T * >(slot->storage));
+			}
+		}
+	}
+
+	size_t size() const { return live; }
+	size_t slab_count() const { return slabs.size(); } //(i.e., the number of allocations the pool has made)
+
+	//------ internals ------
+
+	struct Slot {
+		alignas(T) unsigned char storage[sizeof(T)];
+		Slot *next_free = nullptr;
+		bool live = false;
+	};
+	std::vector< std::unique_ptr< Slot[] > > slabs;
+	Slot *free_list = nullptr;
+	size_t live = 0;
+
+	void add_slab() {
+		slabs.emplace_back(new Slot[SlabSize]);
+		Slot *slab = slabs.back().get();
+		//(threaded so that slots are handed out in memory order)
+		for (size_t i = 0; i + 1 < SlabSize; ++i) {
+			slab[i].next_free = &slab[i+1];
+		}
+		slab[SlabSize-1].next_free = free_list;
+		free_list = slab;
+	}
+};
@@ -0,0 +1,70 @@
+#include "RenderQueue.hpp"
+
+#include <cstring>
+
+constexpr uint32_t RenderQueue::ProgramBits;
+constexpr uint32_t RenderQueue::VAOBits;
+constexpr uint32_t RenderQueue::MaterialBits;
+constexpr uint32_t RenderQueue::DepthBits;
+
+uint64_t RenderQueue::make_key(uint32_t program, uint32_t vao, uint32_t material, float depth) {
+	//the bits of a non-negative float increase with its value, so the top bits of them make an ordered depth:
+	uint32_t depth_bits = 0;
+	if (depth > 0.0f) {
+		std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+		depth_bits >>= (31 - DepthBits); //(the sign bit is always zero)
+	}
+	auto field = [](uint32_t value, uint32_t bits) {
+		return uint64_t(value) & ((uint64_t(1) << bits) - 1);
+	};
+	return (field(program, ProgramBits) << (VAOBits + MaterialBits + DepthBits))
+	     | (field(vao, VAOBits) << (MaterialBits + DepthBits))
+	     | (field(material, MaterialBits) << DepthBits)
+	     | field(depth_bits, DepthBits);
+}
+
+void RenderQueue::clear() {
+	keys.clear();
+	items.clear();
+}
+
+void RenderQueue::push(uint64_t key, uint32_t item) {
+	keys.emplace_back(key);
+	items.emplace_back(item);
+}
+
+void RenderQueue::sort() {
+	uint32_t count = uint32_t(keys.size());
+	keys_temp.resize(count);
+	items_temp.resize(count);
+
+	//histogram every byte in one pass over the keys:
+	uint32_t offsets[8][256];
+	std::memset(offsets, 0, sizeof(offsets));
+	for (uint64_t key : keys) {
+		for (uint32_t b = 0; b < 8; ++b) {
+			++offsets[b][(key >> (8 * b)) & 0xff];
+		}
+	}
+
+	for (uint32_t b = 0; b < 8; ++b) {
+		//skip bytes that every key shares (e.g., the program field, when there's only one program):
+		if (count == 0 || offsets[b][(keys[0] >> (8 * b)) & 0xff] == count) continue;
+
+		//counts to starting offsets:
+		uint32_t total = 0;
+		for (uint32_t v = 0; v < 256; ++v) {
+			uint32_t c = offsets[b][v];
+			offsets[b][v] = total;
+			total += c;
+		}
+
+		for (uint32_t i = 0; i < count; ++i) {
+			uint32_t at = offsets[b][(keys[i] >> (8 * b)) & 0xff]++;
+			keys_temp[at] = keys[i];
+			items_temp[at] = items[i];
+		}
+		keys.swap(keys_temp);
+		items.swap(items_temp);
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+//"RenderQueue" orders a frame's draws by a 64-bit sort key, so that draws sharing state end up next to each other:
+//
+// queue.clear();
+// for (...) queue.push(RenderQueue::make_key(program, vao, material, depth), draw_index);
+// queue.sort();
+// for (uint32_t i = 0; i < queue.items.size(); ++i) { /* ...submit draw queue.items[i]... */ }
+//
+//Keys sort by program, then vertex array, then material, then depth (near to far).
+//Fields are truncated to fit their bits, so distinct state can share a key value:
+// that only costs a few extra state changes -- submission should still compare the actual state.
+
+struct RenderQueue {
+	//key layout, from most to least significant bits:
+	static constexpr uint32_t ProgramBits = 12;
+	static constexpr uint32_t VAOBits = 16;
+	static constexpr uint32_t MaterialBits = 12;
+	static constexpr uint32_t DepthBits = 24;
+	static_assert(ProgramBits + VAOBits + MaterialBits + DepthBits == 64, "key fields fill 64 bits");
+
+	//'depth' is distance in front of the camera (negative depths sort as zero):
+	static uint64_t make_key(uint32_t program, uint32_t vao, uint32_t material, float depth);
+
+	void clear();
+	void push(uint64_t key, uint32_t item);
+	//stable LSD radix sort on keys, a byte at a time (bytes that are the same in every key are skipped):
+	void sort();
+
+	//after sort(), items in key order:
+	std::vector< uint64_t > keys;
+	std::vector< uint32_t > items;
+
+	//------ internals ------
+	std::vector< uint64_t > keys_temp;
+	std::vector< uint32_t > items_temp;
+};
@@ -1,11 +1,29 @@
 #include "Scene.hpp"
+#include "CellVisibility.hpp"
+#include "read_chunk.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <stdexcept>
+#include <string>
+#include <cmath>
+#include <cstring>
 
-glm::mat4 Scene::Transform::make_local_to_parent() const {
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SCENE_SSE 1
+#include <emmintrin.h>
+#endif
+
+//local-to-parent matrix from a transform's specification:
+static glm::mat4 local_to_parent(glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
 	return glm::mat4( //translate
 		glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
 		glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
@@ -21,6 +39,19 @@ glm::mat4 Scene::Transform::make_local_to_parent() const {
 	);
 }
 
+//normal matrix of a world matrix that only rotates, translates, and scales uniformly:
+// (the upper 3x3 is s * R, so its inverse transpose is R / s = (s * R) / s^2 -- no inverse needed)
+static glm::mat3 uniform_normal_to_world(glm::mat4 const &local_to_world) {
+	glm::vec3 x = glm::vec3(local_to_world[0]);
+	float s2 = glm::dot(x, x);
+	float inv_s2 = (s2 == 0.0f ? 0.0f : 1.0f / s2);
+	return glm::mat3(x * inv_s2, glm::vec3(local_to_world[1]) * inv_s2, glm::vec3(local_to_world[2]) * inv_s2);
+}
+
+glm::mat4 Scene::Transform::make_local_to_parent() const {
+	return local_to_parent(position, rotation, scale);
+}
+
 glm::mat4 Scene::Transform::make_parent_to_local() const {
 	glm::vec3 inv_scale;
 	inv_scale.x = (scale.x == 0.0f ? 0.0f : 1.0f / scale.x);
@@ -41,19 +72,73 @@ glm::mat4 Scene::Transform::make_parent_to_local() const {
 	);
 }
 
-glm::mat4 Scene::Transform::make_local_to_world() const {
-	if (parent) {
-		return parent->make_local_to_world() * make_local_to_parent();
-	} else {
-		return make_local_to_parent();
+glm::mat4 const &Scene::Transform::make_local_to_world() const {
+	if (flat) {
+		flat->update();
+		return flat->local_to_world[flat_index];
 	}
+	if (local_to_world_dirty) {
+		if (parent) {
+			local_to_world_cache = parent->make_local_to_world() * make_local_to_parent();
+			uniform_scale_cache = parent->uniform_scale_cache && has_uniform_scale();
+		} else {
+			local_to_world_cache = make_local_to_parent();
+			uniform_scale_cache = has_uniform_scale();
+		}
+		if (!uniform_scale_cache) {
+			normal_to_world_cache = glm::inverse(glm::transpose(glm::mat3(local_to_world_cache)));
+		}
+		local_to_world_dirty = false;
+	}
+	return local_to_world_cache;
 }
 
-glm::mat4 Scene::Transform::make_world_to_local() const {
-	if (parent) {
-		return make_parent_to_local() * parent->make_world_to_local();
-	} else {
-		return make_parent_to_local();
+glm::mat3 Scene::Transform::make_normal_to_world() const {
+	glm::mat4 const &local_to_world = make_local_to_world();
+	if (flat) {
+		if (flat->uniform_scale[flat_index]) return uniform_normal_to_world(local_to_world);
+		return flat->normal_to_world[flat_index];
+	}
+	if (uniform_scale_cache) return uniform_normal_to_world(local_to_world);
+	return normal_to_world_cache;
+}
+
+glm::mat4 const &Scene::Transform::make_world_to_local() const {
+	if (flat) {
+		flat->update();
+		if (flat->world_to_local_dirty[flat_index]) {
+			uint32_t parent_index = flat->parents[flat_index];
+			if (parent_index != -1U) {
+				flat->world_to_local[flat_index] = make_parent_to_local() * flat->handles[parent_index]->make_world_to_local();
+			} else {
+				flat->world_to_local[flat_index] = make_parent_to_local();
+			}
+			flat->world_to_local_dirty[flat_index] = 0;
+		}
+		return flat->world_to_local[flat_index];
+	}
+	if (world_to_local_dirty) {
+		if (parent) {
+			world_to_local_cache = make_parent_to_local() * parent->make_world_to_local();
+		} else {
+			world_to_local_cache = make_parent_to_local();
+		}
+		world_to_local_dirty = false;
+	}
+	return world_to_local_cache;
+}
+
+void Scene::Transform::mark_dirty() {
+	if (flat) {
+		//(the next update() sweep propagates changes to descendants)
+		flat->sync(this);
+		return;
+	}
+	if (local_to_world_dirty && world_to_local_dirty) return; //(descendants are already dirty)
+	local_to_world_dirty = true;
+	world_to_local_dirty = true;
+	for (Transform *child = last_child; child != nullptr; child = child->prev_sibling) {
+		child->mark_dirty();
 	}
 }
 
@@ -96,77 +181,1476 @@ void Scene::Transform::set_parent(Transform *new_parent, Transform *before) {
 		}
 		if (prev_sibling) prev_sibling->next_sibling = this;
 	}
+	if (flat) flat->reparent(this);
+	else mark_dirty();
 	DEBUG_assert_valid_pointers();
 }
 
 //---------------------------
 
-glm::mat4 Scene::Camera::make_projection() const {
-	return glm::infinitePerspective( fovy, aspect, near );
+void Scene::FlatTransforms::update() {
+	if (order_dirty) sort();
+	if (dirty_slots.empty()) return;
+
+	auto compute = [this](uint32_t i) {
+		uint32_t parent = parents[i];
+		glm::mat4 local = local_to_parent(positions[i], rotations[i], scales[i]);
+		local_to_world[i] = (parent != -1U ? local_to_world[parent] * local : local);
+		glm::vec3 const &scale = scales[i];
+		uniform_scale[i] = (parent == -1U || uniform_scale[parent]) && scale.x == scale.y && scale.y == scale.z;
+		if (!uniform_scale[i]) {
+			normal_to_world[i] = glm::inverse(glm::transpose(glm::mat3(local_to_world[i])));
+		}
+		world_to_local_dirty[i] = 1;
+	};
+
+	//only a few changes, so walk just the changed subtrees:
+	// (in slot order, so a subtree containing other dirty slots is walked -- clearing their flags -- before they come up;
+	//  walking is slower per transform than sweeping, so give up and sweep the rest once the subtrees turn out to be large)
+	uint32_t remaining = 0;
+	if (dirty_slots.size() * 128 <= handles.size()) {
+		std::sort(dirty_slots.begin(), dirty_slots.end());
+		uint32_t budget = uint32_t(handles.size() / 32);
+		for (; remaining < dirty_slots.size(); ++remaining) {
+			uint32_t slot = dirty_slots[remaining];
+			if (!dirty[slot]) continue;
+			subtree.clear();
+			subtree.emplace_back(handles[slot]);
+			for (; !subtree.empty() && budget > 0; --budget) {
+				Transform *t = subtree.back();
+				subtree.pop_back();
+				compute(t->flat_index);
+				dirty[t->flat_index] = 0;
+				for (Transform *child = t->last_child; child != nullptr; child = child->prev_sibling) {
+					if (child->flat == this) subtree.emplace_back(child);
+				}
+			}
+			if (!subtree.empty()) {
+				//(flag the subtree's root again, so the sweep redoes all of it)
+				dirty[slot] = 1;
+				break;
+			}
+		}
+		if (remaining == dirty_slots.size()) {
+			dirty_slots.clear();
+			return;
+		}
+	}
+
+	//nothing before the first (remaining) dirty slot can change:
+	uint32_t first = *std::min_element(dirty_slots.begin() + remaining, dirty_slots.end());
+	auto sweep = [&](uint32_t i) {
+		uint32_t parent = parents[i];
+		if (parent != -1U && dirty[parent]) dirty[i] = 1; //(parents come first, so their flags are final)
+		if (dirty[i]) compute(i);
+	};
+	if (workers && workers->threads > 1 && chunks_dirty) split();
+	if (workers && workers->threads > 1 && chunks.size() > 2) {
+		for (uint32_t i : shallow) {
+			if (i >= first) sweep(i);
+		}
+		uint32_t first_chunk = uint32_t(std::upper_bound(chunks.begin(), chunks.end(), first) - chunks.begin()) - 1;
+		workers->parallel_for(uint32_t(chunks.size() - 1 - first_chunk), [&](uint32_t c) {
+			c += first_chunk;
+			for (uint32_t i = std::max(first, chunks[c]); i < chunks[c+1]; ++i) {
+				if (depth[i] >= split_depth) sweep(i);
+			}
+		});
+	} else {
+		for (uint32_t i = first; i < handles.size(); ++i) {
+			sweep(i);
+		}
+	}
+	std::fill(dirty.begin() + first, dirty.end(), 0);
+	dirty_slots.clear();
 }
 
-//---------------------------
+void Scene::FlatTransforms::split() {
+	uint32_t count = uint32_t(handles.size());
+	uint32_t threads = (workers ? workers->threads : 1);
+	//a few chunks per thread, so uneven chunks even out:
+	uint32_t target = std::max(1024U, count / (8 * threads));
+
+	//depth of each slot (parents come first, so theirs is already known):
+	depth.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		depth[i] = (parents[i] == -1U ? 0 : depth[parents[i]] + 1);
+	}
+
+	//split below successively deeper levels until there are enough chunks to go around:
+	// (a transform exactly 'split' deep has its parent swept beforehand, so it never keeps a chunk from starting)
+	std::vector< uint32_t > best;
+	uint32_t best_split = 0;
+	uint32_t above = 0; //slots less than 'split' deep
+	for (uint32_t split = 0; split < 4; ++split) {
+		if (split > 0) above += uint32_t(std::count(depth.begin(), depth.end(), split - 1));
+		if (above * 16 > count) break; //(too much to sweep on one thread first)
 
-//templated helper functions to avoid having to write the same new/delete code three times:
-template< typename T, typename... Args >
-T *list_new(T * &first, Args&&... args) {
-	T *t = new T(std::forward< Args >(args)...); //"perfect forwarding"
-	if (first) {
-		t->alloc_next = first;
-		first->alloc_prev_next = &t->alloc_next;
+		//slot b can start a chunk only if no slot from b on that's deeper than 'split' has a parent before b:
+		min_parent_after.resize(count + 1);
+		min_parent_after[count] = -1U;
+		for (uint32_t i = count; i > 0; --i) {
+			min_parent_after[i-1] = std::min(min_parent_after[i], depth[i-1] > split ? parents[i-1] : -1U);
+		}
+		chunks.clear();
+		chunks.emplace_back(0);
+		for (uint32_t b = 1; b < count; ++b) {
+			if (b - chunks.back() >= target && min_parent_after[b] >= b) chunks.emplace_back(b);
+		}
+		chunks.emplace_back(count);
+
+		if (split == 0 || chunks.size() > best.size()) {
+			best = chunks;
+			best_split = split;
+		}
+		if (chunks.size() - 1 >= 2 * threads) break;
 	}
-	t->alloc_prev_next = &first;
-	first = t;
-	return t;
+	chunks.swap(best);
+	split_depth = best_split;
+
+	shallow.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		if (handles[i] && depth[i] < split_depth) shallow.emplace_back(i);
+	}
+	chunks_dirty = false;
 }
 
+//copy of 'values' reordered so that slot i holds values[from[i]]:
 template< typename T >
-void list_delete(T * t) {
-	assert(t && "It is invalid to delete a null scene object [yes this is different than 'delete']");
-	assert(t->alloc_prev_next);
-	if (t->alloc_next) {
-		t->alloc_next->alloc_prev_next = t->alloc_prev_next;
+static void permute(std::vector< T > &values, std::vector< uint32_t > const &from) {
+	std::vector< T > permuted;
+	permuted.reserve(from.size());
+	for (uint32_t i : from) permuted.emplace_back(values[i]);
+	values = std::move(permuted);
+}
+
+void Scene::FlatTransforms::sort() {
+	//keep the current order (usually allocation order, which is also the order transforms sit in memory),
+	// except that each transform's ancestors are pulled ahead of it if they came later:
+	// (a transform whose parent isn't stored here -- e.g., was deleted -- is treated as a root)
+	std::vector< uint32_t > from; //new slot -> old slot
+	from.reserve(handles.size() - tombstones);
+	std::vector< uint8_t > placed(handles.size(), 0);
+	std::vector< uint32_t > chain;
+	for (uint32_t i = 0; i < handles.size(); ++i) {
+		if (!handles[i] || placed[i]) continue;
+		chain.clear();
+		for (Transform const *t = handles[i]; ; t = t->parent) {
+			if (placed[t->flat_index]) break;
+			placed[t->flat_index] = 1;
+			chain.emplace_back(t->flat_index);
+			if (t->parent == nullptr || t->parent->flat != this) break;
+		}
+		from.insert(from.end(), chain.rbegin(), chain.rend());
+	}
+
+	//move everything (including computed matrices and dirty flags) to its new slot:
+	// (often -- e.g., right after set_flat_transforms -- nothing needs to move)
+	bool moved = (from.size() != handles.size());
+	for (uint32_t i = 0; i < from.size() && !moved; ++i) moved = (from[i] != i);
+	if (moved) {
+		permute(handles, from);
+		for (uint32_t i = 0; i < handles.size(); ++i) {
+			handles[i]->flat_index = i;
+		}
+		permute(positions, from);
+		permute(rotations, from);
+		permute(scales, from);
+		permute(local_to_world, from);
+		permute(uniform_scale, from);
+		permute(normal_to_world, from);
+		permute(world_to_local, from);
+		permute(world_to_local_dirty, from);
+		permute(dirty, from);
+		parents.resize(handles.size());
+		dirty_slots.clear();
+		for (uint32_t i = 0; i < handles.size(); ++i) {
+			if (dirty[i]) dirty_slots.emplace_back(i);
+		}
+	}
+	for (uint32_t i = 0; i < handles.size(); ++i) {
+		Transform const *parent = handles[i]->parent;
+		parents[i] = (parent && parent->flat == this ? parent->flat_index : -1U);
+	}
+	tombstones = 0;
+	order_dirty = false;
+	chunks_dirty = true;
+}
+
+void Scene::FlatTransforms::relocate(Transform *transform) {
+	assert(transform && transform->flat == this);
+	//append the subtree depth-first (so parents still come first), leaving tombstones in the old slots:
+	dirty_slots.emplace_back(uint32_t(handles.size()));
+	std::vector< Transform * > stack;
+	stack.emplace_back(transform);
+	while (!stack.empty()) {
+		Transform *t = stack.back();
+		stack.pop_back();
+		uint32_t old = t->flat_index;
+		uint32_t i = uint32_t(handles.size());
+		//(the subtree's world matrices are recomputed in the next update(), so only the specification moves)
+		handles.emplace_back(t);
+		parents.emplace_back(t->parent && t->parent->flat == this ? t->parent->flat_index : -1U);
+		positions.emplace_back(t->position);
+		rotations.emplace_back(t->rotation);
+		scales.emplace_back(t->scale);
+		local_to_world.emplace_back(1.0f);
+		uniform_scale.emplace_back(1);
+		normal_to_world.emplace_back(1.0f);
+		world_to_local.emplace_back(1.0f);
+		world_to_local_dirty.emplace_back(1);
+		dirty.emplace_back(1);
+		t->flat_index = i;
+
+		handles[old] = nullptr;
+		parents[old] = -1U;
+		dirty[old] = 0;
+		++tombstones;
+
+		for (Transform *child = t->last_child; child != nullptr; child = child->prev_sibling) {
+			stack.emplace_back(child);
+		}
+	}
+	if (tombstones * 2 > handles.size()) order_dirty = true;
+}
+
+void Scene::FlatTransforms::add(Transform *transform) {
+	assert(transform && transform->flat == nullptr);
+	transform->flat = this;
+	transform->flat_index = uint32_t(handles.size());
+	handles.emplace_back(transform);
+	parents.emplace_back(-1U);
+	positions.emplace_back(transform->position);
+	rotations.emplace_back(transform->rotation);
+	scales.emplace_back(transform->scale);
+	local_to_world.emplace_back(1.0f);
+	uniform_scale.emplace_back(1);
+	normal_to_world.emplace_back(1.0f);
+	world_to_local.emplace_back(1.0f);
+	world_to_local_dirty.emplace_back(1);
+	dirty.emplace_back(1);
+	dirty_slots.emplace_back(transform->flat_index);
+	chunks_dirty = true;
+	if (transform->parent) reparent(transform);
+}
+
+void Scene::FlatTransforms::reserve(size_t count) {
+	count += handles.size();
+	handles.reserve(count);
+	parents.reserve(count);
+	positions.reserve(count);
+	rotations.reserve(count);
+	scales.reserve(count);
+	local_to_world.reserve(count);
+	uniform_scale.reserve(count);
+	normal_to_world.reserve(count);
+	world_to_local.reserve(count);
+	world_to_local_dirty.reserve(count);
+	dirty.reserve(count);
+}
+
+void Scene::FlatTransforms::remove(Transform *transform) {
+	assert(transform && transform->flat == this);
+	uint32_t i = transform->flat_index;
+	handles[i] = nullptr;
+	parents[i] = -1U;
+	dirty[i] = 0;
+	transform->flat = nullptr;
+	transform->flat_index = -1U;
+	if (++tombstones * 2 > handles.size()) order_dirty = true;
+}
+
+void Scene::FlatTransforms::sync(Transform const *transform) {
+	assert(transform && transform->flat == this);
+	uint32_t i = transform->flat_index;
+	positions[i] = transform->position;
+	rotations[i] = transform->rotation;
+	scales[i] = transform->scale;
+	if (!dirty[i]) {
+		dirty[i] = 1;
+		dirty_slots.emplace_back(i);
+	}
+}
+
+void Scene::FlatTransforms::reparent(Transform const *transform) {
+	assert(transform && transform->flat == this);
+	uint32_t i = transform->flat_index;
+	Transform const *parent = transform->parent;
+	if (parent && parent->flat == this && parent->flat_index > i) {
+		//(the new parent comes later, so move this subtree behind it; the descendants are already after this transform)
+		relocate(handles[i]);
+		i = transform->flat_index;
 	}
-	*t->alloc_prev_next = t->alloc_next;
-	//PARANOIA:
-	t->alloc_next = nullptr;
-	t->alloc_prev_next = nullptr;
+	parents[i] = (parent && parent->flat == this ? parent->flat_index : -1U);
+	//(listed even if already flagged, since the ancestor that covered it may no longer be an ancestor)
+	dirty[i] = 1;
+	dirty_slots.emplace_back(i);
+	chunks_dirty = true;
 }
 
+//---------------------------
+
+glm::mat4 Scene::Camera::make_projection() const {
+	return glm::infinitePerspective( fovy, aspect, near );
+}
+
+//---------------------------
+
 Scene::Transform *Scene::new_transform() {
-	return list_new< Scene::Transform >(first_transform);
+	Scene::Transform *transform = transforms.create();
+	if (flat) flat_transforms.add(transform);
+	return transform;
 }
 
 void Scene::delete_transform(Scene::Transform *transform) {
-	list_delete< Scene::Transform >(transform);
+	assert(transform && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+	if (flat) flat_transforms.remove(transform);
+	if (transform->name_slot != -1U) name_slots[transform->name_slot].transform = nullptr;
+	transforms.destroy(transform);
 }
 
 Scene::Object *Scene::new_object(Scene::Transform *transform) {
 	assert(transform && "Scene::Object must be attached to a transform.");
-	return list_new< Scene::Object >(first_object, transform);
+	Scene::Object *object = objects.create(transform);
+	object->spatial_entry = spatial_index.add(object);
+	return object;
 }
 
 void Scene::delete_object(Scene::Object *object) {
-	list_delete< Scene::Object >(object);
+	assert(object && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+	spatial_index.remove(object->spatial_entry);
+	objects.destroy(object);
+}
+
+uint32_t Scene::new_material(Scene::Material const &material) {
+	materials.emplace_back(material);
+	return uint32_t(materials.size()) - 1;
 }
 
 Scene::Camera *Scene::new_camera(Scene::Transform *transform) {
 	assert(transform && "Scene::Camera must be attached to a transform.");
-	return list_new< Scene::Camera >(first_camera, transform);
+	return cameras.create(transform);
+}
+
+void Scene::delete_camera(Scene::Camera *camera) {
+	assert(camera && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+	cameras.destroy(camera);
+}
+
+Scene::Lamp *Scene::new_lamp(Scene::Transform *transform) {
+	assert(transform && "Scene::Lamp must be attached to a transform.");
+	return lamps.create(transform);
+}
+
+void Scene::delete_lamp(Scene::Lamp *lamp) {
+	assert(lamp && "It is invalid to delete a null scene object [yes this is different than 'delete']");
+	lamps.destroy(lamp);
+}
+
+void Scene::load(std::string const &filename, MeshBuffer const &meshes,
+	std::function< bool(Scene::Object *, std::string const &) > const &on_object) {
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open scene '" + filename + "'.");
+	}
+
+	struct TransformEntry {
+		int32_t parent_ref;
+		uint32_t name_begin, name_end;
+		glm::vec3 position;
+		glm::vec4 rotation; //quaternion as x,y,z,w
+		glm::vec3 scale;
+	};
+	static_assert(sizeof(TransformEntry) == 4+4*2+4*3+4*4+4*3, "TransformEntry is packed.");
+	struct MeshEntry {
+		int32_t transform_ref;
+		uint32_t name_begin, name_end;
+	};
+	static_assert(sizeof(MeshEntry) == 4+4*2, "MeshEntry is packed.");
+	struct CameraEntry {
+		int32_t transform_ref;
+		char type[4]; //"pers" or "orth"
+		float fov; //vertical fov (in degrees) or ortho size
+		float clip_near, clip_far;
+	};
+	static_assert(sizeof(CameraEntry) == 4+4+4+4*2, "CameraEntry is packed.");
+	struct LampEntry {
+		int32_t transform_ref;
+		char type; //(as in Lamp::Type)
+		glm::u8vec3 color;
+		float energy;
+		float distance;
+		float fov; //(spot lamps) in degrees
+	};
+	static_assert(sizeof(LampEntry) == 4+1+3+4*3, "LampEntry is packed.");
+
+	std::vector< char > strings;
+	std::vector< TransformEntry > transform_entries;
+	std::vector< MeshEntry > mesh_entries;
+	std::vector< CameraEntry > camera_entries;
+	std::vector< LampEntry > lamp_entries;
+	read_chunk(file, "str0", &strings);
+	read_chunk(file, "xfh0", &transform_entries);
+	read_chunk(file, "msh0", &mesh_entries);
+	//(older scenes stop after the meshes)
+	if (file.peek() != EOF) read_chunk(file, "cam0", &camera_entries);
+	if (file.peek() != EOF) read_chunk(file, "lmp0", &lamp_entries);
+	if (file.peek() != EOF) {
+		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
+	}
+
+	auto check_name = [&](uint32_t begin, uint32_t end) {
+		if (!(begin <= end && end <= strings.size())) {
+			throw std::runtime_error("Scene '" + filename + "' has an out-of-range name.");
+		}
+	};
+	auto check_ref = [&](int32_t ref) {
+		if (!(ref >= 0 && uint32_t(ref) < transform_entries.size())) {
+			throw std::runtime_error("Scene '" + filename + "' refers to a missing transform.");
+		}
+	};
+
+	//make room for everything at once:
+	transforms.reserve(transform_entries.size());
+	if (flat) flat_transforms.reserve(transform_entries.size());
+	objects.reserve(mesh_entries.size());
+	spatial_index.entries.reserve(spatial_index.entries.size() + mesh_entries.size());
+	cameras.reserve(camera_entries.size());
+	lamps.reserve(lamp_entries.size());
+	reserve_names(uint32_t(transform_entries.size()));
+
+	//names point into a copy of the strings chunk:
+	uint32_t names_offset = uint32_t(name_strings.size());
+	name_strings.insert(name_strings.end(), strings.begin(), strings.end());
+
+	std::vector< Scene::Transform * > loaded;
+	loaded.reserve(transform_entries.size());
+	for (auto const &entry : transform_entries) {
+		check_name(entry.name_begin, entry.name_end);
+		Scene::Transform *transform = new_transform();
+		transform->set_position(entry.position);
+		transform->set_rotation(glm::quat(entry.rotation.w, entry.rotation.x, entry.rotation.y, entry.rotation.z));
+		transform->set_scale(entry.scale);
+		if (entry.parent_ref >= 0) {
+			//(exporters write parents before their children)
+			if (uint32_t(entry.parent_ref) >= loaded.size()) {
+				throw std::runtime_error("Scene '" + filename + "' has a transform whose parent comes after it.");
+			}
+			transform->set_parent(loaded[entry.parent_ref]);
+		}
+		add_name(transform, names_offset + entry.name_begin, names_offset + entry.name_end);
+		loaded.emplace_back(transform);
+	}
+
+	//mesh names repeat (e.g., every wall of a generated maze is a "Wall"), so each is looked up once:
+	std::unordered_map< std::string, MeshBuffer::Mesh const * > mesh_lookup;
+	for (auto const &entry : mesh_entries) {
+		check_ref(entry.transform_ref);
+		check_name(entry.name_begin, entry.name_end);
+		auto f = mesh_lookup.emplace(std::string(strings.begin() + entry.name_begin, strings.begin() + entry.name_end), nullptr).first;
+		if (!f->second) f->second = &meshes.lookup(f->first);
+		MeshBuffer::Mesh const &mesh = *f->second;
+
+		Scene::Object *object = new_object(loaded[entry.transform_ref]);
+		object->start = mesh.start;
+		object->count = mesh.count;
+		object->bounds_min = mesh.min;
+		object->bounds_max = mesh.max;
+		object->bounds_center = mesh.center;
+		object->bounds_radius = mesh.radius;
+		object->mesh_buffer = &meshes;
+		if (on_object && !on_object(object, f->first)) {
+			delete_object(object);
+		}
+	}
+
+	for (auto const &entry : camera_entries) {
+		check_ref(entry.transform_ref);
+		if (std::string(entry.type, 4) != "pers") {
+			std::cerr << "WARNING: skipping non-perspective camera '" << transform_name(loaded[entry.transform_ref])
+				<< "' in scene '" << filename << "'." << std::endl;
+			continue;
+		}
+		Scene::Camera *camera = new_camera(loaded[entry.transform_ref]);
+		camera->fovy = glm::radians(entry.fov);
+		camera->near = entry.clip_near;
+	}
+
+	for (auto const &entry : lamp_entries) {
+		check_ref(entry.transform_ref);
+		if (!(entry.type == Lamp::Point || entry.type == Lamp::Hemisphere || entry.type == Lamp::Spot || entry.type == Lamp::Directional)) {
+			throw std::runtime_error("Scene '" + filename + "' has a lamp of unknown type.");
+		}
+		Scene::Lamp *lamp = new_lamp(loaded[entry.transform_ref]);
+		lamp->type = Lamp::Type(entry.type);
+		lamp->color = entry.color;
+		lamp->energy = entry.energy;
+		lamp->distance = entry.distance;
+		lamp->spot_fov = glm::radians(entry.fov);
+	}
+}
+
+//FNV-1a:
+static uint32_t hash_name(char const *begin, char const *end) {
+	uint32_t hash = 2166136261U;
+	for (char const *c = begin; c != end; ++c) {
+		hash = (hash ^ uint8_t(*c)) * 16777619U;
+	}
+	return hash;
+}
+
+Scene::Transform *Scene::find_transform(std::string const &name) const {
+	if (name_slots.empty()) return nullptr;
+	uint32_t hash = hash_name(name.data(), name.data() + name.size());
+	uint32_t mask = uint32_t(name_slots.size()) - 1;
+	for (uint32_t i = hash & mask; name_slots[i].used; i = (i + 1) & mask) {
+		NameSlot const &slot = name_slots[i];
+		if (slot.transform && slot.hash == hash && slot.end - slot.begin == name.size()
+		 && std::memcmp(name_strings.data() + slot.begin, name.data(), name.size()) == 0) {
+			return slot.transform;
+		}
+	}
+	return nullptr;
+}
+
+std::string Scene::transform_name(Scene::Transform const *transform) const {
+	assert(transform);
+	if (transform->name_slot == -1U) return "";
+	NameSlot const &slot = name_slots[transform->name_slot];
+	return std::string(name_strings.data() + slot.begin, name_strings.data() + slot.end);
+}
+
+void Scene::reserve_names(uint32_t count) {
+	uint32_t size = std::max(uint32_t(name_slots.size()), 16U);
+	while (2 * (uint64_t(name_slots_used) + count) > size) size *= 2;
+	if (size == name_slots.size()) return;
+
+	//re-insert names of live transforms (dropping those of deleted ones):
+	std::vector< NameSlot > old(size);
+	std::swap(old, name_slots);
+	name_slots_used = 0;
+	uint32_t mask = size - 1;
+	for (NameSlot const &slot : old) {
+		if (!slot.transform) continue;
+		uint32_t i = slot.hash & mask;
+		while (name_slots[i].used) i = (i + 1) & mask;
+		name_slots[i] = slot;
+		slot.transform->name_slot = i;
+		++name_slots_used;
+	}
+}
+
+void Scene::add_name(Scene::Transform *transform, uint32_t begin, uint32_t end) {
+	assert(transform && transform->name_slot == -1U);
+	assert(begin <= end && end <= name_strings.size());
+	reserve_names(1);
+	NameSlot slot;
+	slot.begin = begin;
+	slot.end = end;
+	slot.hash = hash_name(name_strings.data() + begin, name_strings.data() + end);
+	slot.used = true;
+	slot.transform = transform;
+	uint32_t mask = uint32_t(name_slots.size()) - 1;
+	uint32_t i = slot.hash & mask;
+	while (name_slots[i].used) i = (i + 1) & mask;
+	name_slots[i] = slot;
+	transform->name_slot = i;
+	++name_slots_used;
+}
+
+Scene::Prefab Scene::make_prefab(Scene::Transform const *root) {
+	assert(root && "Prefabs are made from a root transform.");
+	Prefab prefab;
+
+	//nodes in depth-first order, so parents come before their children:
+	std::unordered_map< Scene::Transform const *, uint32_t > node_of;
+	std::vector< std::pair< Scene::Transform const *, uint32_t > > todo; //(transform, parent node)
+	todo.emplace_back(root, -1U);
+	std::vector< Scene::Transform const * > children;
+	while (!todo.empty()) {
+		Scene::Transform const *transform = todo.back().first;
+		uint32_t parent = todo.back().second;
+		todo.pop_back();
+
+		uint32_t node = uint32_t(prefab.nodes.size());
+		node_of.emplace(transform, node);
+		prefab.nodes.emplace_back();
+		prefab.nodes.back().parent = parent;
+		prefab.nodes.back().position = transform->position;
+		prefab.nodes.back().rotation = transform->rotation;
+		prefab.nodes.back().scale = transform->scale;
+
+		//(pushed last-to-first so that they come back off 'todo' in sibling order)
+		for (Scene::Transform const *child = transform->last_child; child; child = child->prev_sibling) {
+			todo.emplace_back(child, node);
+		}
+	}
+
+	objects.for_each([&](Scene::Object *object){
+		auto f = node_of.find(object->transform);
+		if (f == node_of.end()) return;
+		prefab.objects.emplace_back(*object);
+		prefab.objects.back().baked = false;
+		prefab.objects.back().spatial_entry = -1U;
+		prefab.object_nodes.emplace_back(f->second);
+	});
+
+	return prefab;
+}
+
+void Scene::instantiate(Scene::Prefab const &prefab, uint32_t count, Scene::Transform *parent, std::vector< Scene::Transform * > *roots) {
+	assert(!prefab.nodes.empty() && "Prefab should have a root.");
+
+	size_t nodes = prefab.nodes.size();
+	//(the pools already hand out slots from slabs, which are faster to fill as they are added than to reserve all at once)
+	if (flat) flat_transforms.reserve(nodes * count);
+	spatial_index.entries.reserve(spatial_index.entries.size() + prefab.objects.size() * count);
+	if (roots) roots->reserve(roots->size() + count);
+
+	std::vector< Scene::Transform * > made(nodes);
+	for (uint32_t copy = 0; copy < count; ++copy) {
+		for (size_t n = 0; n < nodes; ++n) {
+			Prefab::Node const &node = prefab.nodes[n];
+			Scene::Transform *transform = transforms.create();
+			transform->position = node.position;
+			transform->rotation = node.rotation;
+			transform->scale = node.scale;
+			//(a new transform is the last child of its parent, and its caches start dirty, so there is nothing else to fix up)
+			Scene::Transform *p = (node.parent == -1U ? parent : made[node.parent]);
+			if (p) {
+				transform->parent = p;
+				transform->prev_sibling = p->last_child;
+				if (p->last_child) p->last_child->next_sibling = transform;
+				p->last_child = transform;
+			}
+			if (flat) flat_transforms.add(transform);
+			made[n] = transform;
+		}
+		for (size_t o = 0; o < prefab.objects.size(); ++o) {
+			Scene::Object *object = objects.create(prefab.objects[o]);
+			object->transform = made[prefab.object_nodes[o]];
+			object->spatial_entry = spatial_index.add(object);
+		}
+		if (roots) roots->emplace_back(made[0]);
+	}
+}
+
+void Scene::set_flat_transforms(bool flat_) {
+	if (flat_ == flat) return;
+	flat = flat_;
+	flat_transforms = FlatTransforms();
+	flat_transforms.workers = update_workers.get();
+	if (flat) flat_transforms.reserve(transforms.size());
+	transforms.for_each([](Scene::Transform *transform){
+		transform->flat = nullptr;
+		transform->flat_index = -1U;
+		transform->local_to_world_dirty = true;
+		transform->world_to_local_dirty = true;
+	});
+	if (flat) {
+		transforms.for_each([this](Scene::Transform *transform){
+			flat_transforms.add(transform);
+		});
+		flat_transforms.order_dirty = true; //(allocation order isn't always parent-before-child)
+	}
+}
+
+void Scene::update_world_matrices() {
+	if (flat) flat_transforms.update();
+}
+
+void Scene::set_update_threads(uint32_t threads) {
+	update_workers.reset(new WorkerPool(threads));
+	flat_transforms.workers = update_workers.get();
+	flat_transforms.chunks_dirty = true;
+}
+
+void Scene::bake_static(float cell_size, bool upload) {
+	assert(cell_size > 0.0f && "Baking needs a positive cell size.");
+
+	//replace any previous batches:
+	for (Scene::Object *object : baked_objects) {
+		delete_object(object);
+	}
+	baked_objects.clear();
+	for (auto const &buffer : baked_buffers) {
+		if (buffer->vbo != 0) glDeleteBuffers(1, &buffer->vbo);
+	}
+	baked_buffers.clear();
+	for (GLuint vao : baked_vaos) {
+		glDeleteVertexArrays(1, &vao);
+	}
+	baked_vaos.clear();
+	objects.for_each([](Scene::Object *object){ object->baked = false; });
+	//(which objects are baked is about to change, so spatial_index needs to look at static objects again)
+	for (auto &entry : spatial_index.entries) entry.fixed = false;
+	if (!baked_transform) {
+		baked_transform = new_transform();
+		baked_transform->set_rotation(glm::quat(1.0f, 0.0f, 0.0f, 0.0f)); //(batches are already in world space)
+	}
+
+	update_world_matrices();
+
+	//group static objects by what they are drawn with (including material), then by cell:
+	typedef std::tuple< int32_t, int32_t, int32_t > Cell;
+	struct Group {
+		Scene::Object const *like = nullptr; //(for program and material settings)
+		std::map< Cell, std::vector< Scene::Object * > > cells;
+	};
+	std::map< std::tuple< MeshBuffer const *, GLuint, uint32_t >, Group > groups;
+	objects.for_each([&](Scene::Object *object){
+		if (!object->is_static || !object->mesh_buffer) return;
+		glm::vec3 center = glm::vec3(object->transform->make_local_to_world() * glm::vec4(object->bounds_center, 1.0f));
+		Cell cell(int32_t(std::floor(center.x / cell_size)), int32_t(std::floor(center.y / cell_size)), int32_t(std::floor(center.z / cell_size)));
+		Group &group = groups[std::make_tuple(object->mesh_buffer, object->program, object->material)];
+		if (!group.like) group.like = object;
+		group.cells[cell].emplace_back(object);
+	});
+
+	for (auto const &key_group : groups) {
+		MeshBuffer const &source = *std::get< 0 >(key_group.first);
+		Group const &group = key_group.second;
+		if (!(source.Position.size == 3 && source.Position.type == GL_FLOAT)) {
+			throw std::runtime_error("Can only bake meshes with three-float positions.");
+		}
+		if (source.vertex_data.empty()) {
+			throw std::runtime_error("Can only bake meshes from a MeshBuffer that kept its vertex data.");
+		}
+		bool has_normals = (source.Normal.size == 3 && source.Normal.type == GL_FLOAT);
+		uint32_t stride = source.vertex_stride();
+
+		//copy each cell's vertices into one range of a new buffer, moving positions and normals to world space:
+		std::vector< uint8_t > data;
+		std::map< std::string, MeshBuffer::Mesh > meshes;
+		for (auto const &cell_objects : group.cells) {
+			MeshBuffer::Mesh mesh;
+			mesh.start = GLuint(data.size() / stride);
+			for (Scene::Object *object : cell_objects.second) {
+				glm::mat4 const &local_to_world = object->transform->make_local_to_world();
+				glm::mat3 normal_to_world = object->transform->make_normal_to_world();
+				size_t begin = data.size();
+				data.insert(data.end(),
+					source.vertex_data.begin() + size_t(object->start) * stride,
+					source.vertex_data.begin() + size_t(object->start + object->count) * stride);
+				for (size_t at = begin; at < data.size(); at += stride) {
+					glm::vec3 position;
+					std::memcpy(&position, &data[at + source.Position.offset], sizeof(position));
+					position = glm::vec3(local_to_world * glm::vec4(position, 1.0f));
+					std::memcpy(&data[at + source.Position.offset], &position, sizeof(position));
+					if (has_normals) {
+						glm::vec3 normal;
+						std::memcpy(&normal, &data[at + source.Normal.offset], sizeof(normal));
+						normal = glm::normalize(normal_to_world * normal);
+						std::memcpy(&data[at + source.Normal.offset], &normal, sizeof(normal));
+					}
+				}
+				object->baked = true;
+			}
+			mesh.count = GLuint(data.size() / stride) - mesh.start;
+			meshes.insert(std::make_pair(
+				"Cell." + std::to_string(std::get< 0 >(cell_objects.first))
+				+ "." + std::to_string(std::get< 1 >(cell_objects.first))
+				+ "." + std::to_string(std::get< 2 >(cell_objects.first)), mesh));
+		}
+
+		baked_buffers.emplace_back(new MeshBuffer(source, std::move(data), meshes));
+		//(the batches only need a CPU copy to be occluders)
+		baked_buffers.back()->keep_vertex_data = occlusion_culling;
+		MeshBuffer const &baked = *baked_buffers.back();
+		GLuint vao = 0;
+		if (upload) {
+			baked_buffers.back()->upload();
+			vao = baked.make_vao_for_program(group.like->program);
+			baked_vaos.emplace_back(vao);
+		}
+
+		//an object per cell, drawn like the objects that went into it:
+		for (auto const &name_mesh : baked.meshes) {
+			MeshBuffer::Mesh const &mesh = name_mesh.second;
+			Scene::Object *object = new_object(baked_transform);
+			object->program = group.like->program;
+			object->program_mvp_mat4 = group.like->program_mvp_mat4;
+			object->program_mv_mat4x3 = group.like->program_mv_mat4x3;
+			object->program_itmv_mat3 = group.like->program_itmv_mat3;
+			object->program_tint_vec4 = group.like->program_tint_vec4;
+			object->material = group.like->material;
+			object->vao = vao;
+			object->start = mesh.start;
+			object->count = mesh.count;
+			object->bounds_min = mesh.min;
+			object->bounds_max = mesh.max;
+			object->bounds_center = mesh.center;
+			object->bounds_radius = mesh.radius;
+			object->is_static = true;
+			object->mesh_buffer = &baked;
+			baked_objects.emplace_back(object);
+		}
+	}
+}
+
+//mark which of 'count' spheres are at least partly on the inside of all 'plane_count' planes:
+// (planes are (normal, offset) with unit normals facing inward)
+static void spheres_inside_planes(glm::vec4 const *planes, uint32_t plane_count,
+	float const *x, float const *y, float const *z, float const *radius, uint32_t count, uint8_t *inside) {
+	uint32_t i = 0;
+#ifdef SCENE_SSE
+	//four spheres at a time:
+	for (; i + 4 <= count; i += 4) {
+		__m128 sx = _mm_loadu_ps(x + i);
+		__m128 sy = _mm_loadu_ps(y + i);
+		__m128 sz = _mm_loadu_ps(z + i);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+		__m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (uint32_t p = 0; p < plane_count; ++p) {
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(sx, _mm_set1_ps(planes[p].x)), _mm_mul_ps(sy, _mm_set1_ps(planes[p].y))),
+				_mm_add_ps(_mm_mul_ps(sz, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w))
+			);
+			in = _mm_and_ps(in, _mm_cmpge_ps(dist, neg_r));
+		}
+		int mask = _mm_movemask_ps(in);
+		inside[i+0] = (mask >> 0) & 1;
+		inside[i+1] = (mask >> 1) & 1;
+		inside[i+2] = (mask >> 2) & 1;
+		inside[i+3] = (mask >> 3) & 1;
+	}
+#endif
+	//remaining spheres (or all of them, without SSE):
+	for (; i < count; ++i) {
+		bool in = true;
+		for (uint32_t p = 0; p < plane_count; ++p) {
+			float dist = planes[p].x * x[i] + planes[p].y * y[i] + planes[p].z * z[i] + planes[p].w;
+			in = in && (dist >= -radius[i]);
+		}
+		inside[i] = in;
+	}
+}
+
+//------ spatial index ------
+
+constexpr uint32_t Scene::SpatialIndex::Large;
+constexpr uint32_t Scene::SpatialIndex::Unplaced;
+constexpr uint32_t Scene::SpatialIndex::Tombstone;
+
+static uint32_t hash_cell(glm::ivec3 const &at) {
+	uint32_t h = (uint32_t(at.x) * 0x8da6b343U) ^ (uint32_t(at.y) * 0xd8163841U) ^ (uint32_t(at.z) * 0xcb1ab31fU);
+	return h ^ (h >> 16);
+}
+
+uint32_t Scene::SpatialIndex::add(Scene::Object *object) {
+	uint32_t e;
+	if (free_entry != -1U) {
+		e = free_entry;
+		free_entry = entries[e].next;
+		entries[e] = Entry();
+	} else {
+		e = uint32_t(entries.size());
+		entries.emplace_back();
+	}
+	entries[e].object = object;
+	return e;
 }
 
-void Scene::delete_camera(Scene::Camera *object) {
-	list_delete< Scene::Camera >(object);
+void Scene::SpatialIndex::remove(uint32_t e) {
+	assert(e < entries.size() && entries[e].object && "Removing a spatial index entry that isn't in use.");
+	if (entries[e].cell != Unplaced) unlink(e);
+	entries[e] = Entry();
+	entries[e].next = free_entry;
+	free_entry = e;
+}
+
+void Scene::SpatialIndex::link(uint32_t e, uint32_t cell) {
+	Entry &entry = entries[e];
+	entry.cell = cell;
+	Cell &to = cell_of(e);
+	if (entry.unbaked) {
+		++to.unbaked;
+		++unbaked;
+	}
+	entry.prev = -1U;
+	entry.next = to.first;
+	if (to.first != -1U) entries[to.first].prev = e;
+	to.first = e;
+}
+
+void Scene::SpatialIndex::unlink(uint32_t e) {
+	Entry &entry = entries[e];
+	Cell &from = cell_of(e);
+	if (entry.unbaked) {
+		--from.unbaked;
+		--unbaked;
+	}
+	if (entry.prev != -1U) entries[entry.prev].next = entry.next;
+	else from.first = entry.next;
+	if (entry.next != -1U) entries[entry.next].prev = entry.prev;
+	entry.prev = entry.next = -1U;
+	if (entry.cell != Large && from.first == -1U) release_cell(entry.cell);
+	entry.cell = Unplaced;
+}
+
+void Scene::SpatialIndex::place(uint32_t e, glm::vec3 const &center, float radius) {
+	Entry &entry = entries[e];
+	entry.center = center;
+	entry.radius = radius;
+	//(spheres too far out for integer cell coordinates go on the large list too)
+	uint32_t cell = Large;
+	float const far = 1e9f * cell_size;
+	if (radius <= cell_size && std::abs(center.x) < far && std::abs(center.y) < far && std::abs(center.z) < far) {
+		glm::ivec3 at = cell_at(center);
+		if (entry.cell < cells.size() && cells[entry.cell].at == at) return; //(still in the same cell)
+		cell = find_cell(at);
+		if (cell == -1U) cell = make_cell(at);
+	}
+	if (cell == entry.cell) return;
+	if (entry.cell != Unplaced) unlink(e);
+	link(e, cell);
+}
+
+uint32_t Scene::SpatialIndex::find_cell(glm::ivec3 const &at) const {
+	if (table.empty()) return -1U;
+	uint32_t mask = uint32_t(table.size()) - 1;
+	for (uint32_t i = hash_cell(at) & mask; table[i] != -1U; i = (i + 1) & mask) {
+		if (table[i] != Tombstone && cells[table[i]].at == at) return table[i];
+	}
+	return -1U;
+}
+
+uint32_t Scene::SpatialIndex::make_cell(glm::ivec3 const &at) {
+	assert(find_cell(at) == -1U);
+	if ((table_used + 1) * 2 > table.size()) {
+		//rebuild (keeping the table at most half full, and growing it if live cells would fill more than a quarter),
+		// which clears tombstones and re-tightens the bounds:
+		size_t size = std::max< size_t >(64, table.size());
+		while ((cell_count + 1) * 4 > size) size *= 2;
+		table.assign(size, -1U);
+		table_used = 0;
+		min_cell = glm::ivec3(1);
+		max_cell = glm::ivec3(0);
+		uint32_t mask = uint32_t(table.size()) - 1;
+		for (uint32_t c = 0; c < cells.size(); ++c) {
+			if (cells[c].first == -1U) continue; //(free)
+			uint32_t i = hash_cell(cells[c].at) & mask;
+			while (table[i] != -1U) i = (i + 1) & mask;
+			table[i] = c;
+			if (table_used++ == 0) {
+				min_cell = max_cell = cells[c].at;
+			} else {
+				min_cell = glm::min(min_cell, cells[c].at);
+				max_cell = glm::max(max_cell, cells[c].at);
+			}
+		}
+	}
+	//(new cells go in the first tombstone or empty slot along the probe sequence)
+	uint32_t mask = uint32_t(table.size()) - 1;
+	uint32_t i = hash_cell(at) & mask;
+	while (table[i] != -1U && table[i] != Tombstone) i = (i + 1) & mask;
+	if (table[i] == -1U) ++table_used;
+
+	uint32_t c;
+	if (free_cell != -1U) {
+		c = free_cell;
+		free_cell = cells[c].unbaked;
+		cells[c] = Cell();
+	} else {
+		c = uint32_t(cells.size());
+		cells.emplace_back();
+	}
+	cells[c].at = at;
+	table[i] = c;
+	if (cell_count == 0) {
+		min_cell = max_cell = at;
+	} else {
+		min_cell = glm::min(min_cell, at);
+		max_cell = glm::max(max_cell, at);
+	}
+	++cell_count;
+	return c;
+}
+
+void Scene::SpatialIndex::release_cell(uint32_t c) {
+	assert(c < cells.size() && cells[c].first == -1U && cells[c].unbaked == 0 && "Releasing a cell that isn't empty.");
+	uint32_t mask = uint32_t(table.size()) - 1;
+	uint32_t i = hash_cell(cells[c].at) & mask;
+	while (table[i] != c) i = (i + 1) & mask;
+	//(a tombstone keeps probe sequences through this slot intact; it is reused by make_cell or cleared when the table is rebuilt)
+	table[i] = Tombstone;
+	cells[c].unbaked = free_cell;
+	free_cell = c;
+	--cell_count;
+}
+
+void Scene::SpatialIndex::nearest(glm::vec3 const &at, uint32_t k, std::vector< Scene::Object * > *out, float max_distance) {
+	assert(out);
+	out->clear();
+	if (k == 0) return;
+
+	//the k nearest so far, as a max-heap (farthest on top):
+	nearest_heap.clear();
+	float limit2 = max_distance * max_distance;
+	auto consider = [&](uint32_t e) {
+		glm::vec3 to = entries[e].center - at;
+		std::pair< float, uint32_t > item(glm::dot(to, to), e);
+		if (!(item.first <= limit2)) return;
+		if (nearest_heap.size() < k) {
+			nearest_heap.emplace_back(item);
+			std::push_heap(nearest_heap.begin(), nearest_heap.end());
+		} else if (item < nearest_heap.front()) {
+			std::pop_heap(nearest_heap.begin(), nearest_heap.end());
+			nearest_heap.back() = item;
+			std::push_heap(nearest_heap.begin(), nearest_heap.end());
+		}
+	};
+	for (uint32_t e = large.first; e != -1U; e = entries[e].next) consider(e);
+
+	//then shells of cells at increasing (chessboard) distance d around the cell holding 'at':
+	// anything in a cell past shell d is at least d * cell_size away
+	glm::ivec3 c = cell_at(glm::clamp(at, glm::vec3(-1e9f * cell_size), glm::vec3(1e9f * cell_size)));
+	//(shells closer than the nearest cell are empty, so start there)
+	glm::ivec3 gap = glm::max(glm::max(min_cell - c, c - max_cell), glm::ivec3(0));
+	for (int32_t d = std::max(gap.x, std::max(gap.y, gap.z)); cell_count != 0; ++d) {
+		glm::ivec3 lo = glm::max(c - glm::ivec3(d), min_cell);
+		glm::ivec3 hi = glm::min(c + glm::ivec3(d), max_cell);
+		for (int32_t z = lo.z; z <= hi.z; ++z) {
+			for (int32_t y = lo.y; y <= hi.y; ++y) {
+				bool edge = (std::abs(z - c.z) == d || std::abs(y - c.y) == d);
+				for (int32_t x = lo.x; x <= hi.x; ++x) {
+					if (!edge && std::abs(x - c.x) != d) {
+						x = std::max(x, c.x + d - 1); //(skip the inside of the shell, which was searched already)
+						continue;
+					}
+					uint32_t cell = find_cell(glm::ivec3(x, y, z));
+					if (cell == -1U) continue;
+					for (uint32_t e = cells[cell].first; e != -1U; e = entries[e].next) consider(e);
+				}
+			}
+		}
+		float beyond = d * cell_size;
+		if (beyond * beyond > limit2) break;
+		if (nearest_heap.size() == k && nearest_heap.front().first <= beyond * beyond) break;
+		if (c.x - d <= min_cell.x && c.y - d <= min_cell.y && c.z - d <= min_cell.z
+		 && c.x + d >= max_cell.x && c.y + d >= max_cell.y && c.z + d >= max_cell.z) break; //(every cell searched)
+	}
+
+	std::sort_heap(nearest_heap.begin(), nearest_heap.end());
+	out->reserve(k);
+	for (auto const &item : nearest_heap) {
+		out->emplace_back(entries[item.second].object);
+	}
+}
+
+void Scene::update_spatial_index() {
+	update_world_matrices();
+
+	for (uint32_t e = 0; e < spatial_index.entries.size(); ++e) {
+		Scene::SpatialIndex::Entry &entry = spatial_index.entries[e];
+		Scene::Object const *object = entry.object;
+		if (!object || entry.fixed) continue;
+		glm::mat4 const &local_to_world = object->transform->make_local_to_world();
+		glm::vec3 center = glm::vec3(local_to_world * glm::vec4(object->bounds_center, 1.0f));
+		float radius = std::numeric_limits< float >::infinity();
+		if (object->bounds_radius >= 0.0f) {
+			//(scaled by the largest axis scale, so the sphere still covers the object)
+			float scale2 = std::max(glm::dot(glm::vec3(local_to_world[0]), glm::vec3(local_to_world[0])),
+			               std::max(glm::dot(glm::vec3(local_to_world[1]), glm::vec3(local_to_world[1])),
+			                        glm::dot(glm::vec3(local_to_world[2]), glm::vec3(local_to_world[2]))));
+			radius = object->bounds_radius * std::sqrt(scale2);
+		}
+		spatial_index.place(e, center, radius);
+		if (entry.unbaked != !object->baked) {
+			entry.unbaked = !object->baked;
+			if (entry.unbaked) {
+				++spatial_index.cell_of(e).unbaked;
+				++spatial_index.unbaked;
+			} else {
+				--spatial_index.cell_of(e).unbaked;
+				--spatial_index.unbaked;
+			}
+		}
+		entry.fixed = object->is_static;
+	}
+}
+
+void Scene::cull(Scene::Camera const *camera) {
+	assert(camera && "Must have a camera to cull scene against.");
+
+	update_spatial_index();
+
+	//frustum planes, from the rows of the world-to-clip matrix:
+	// (camera projections have no far plane, so only five)
+	glm::mat4 world_to_clip = camera->make_projection() * camera->transform->make_world_to_local();
+	glm::vec4 rows[4];
+	for (uint32_t r = 0; r < 4; ++r) {
+		rows[r] = glm::vec4(world_to_clip[0][r], world_to_clip[1][r], world_to_clip[2][r], world_to_clip[3][r]);
+	}
+	glm::vec4 planes[5] = {
+		rows[3] + rows[0], //left
+		rows[3] - rows[0], //right
+		rows[3] + rows[1], //bottom
+		rows[3] - rows[1], //top
+		rows[3] + rows[2], //near
+	};
+	for (auto &plane : planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	//bounding spheres in world space, from the spatial index:
+	// (skipping whole cells whose loose bounds are outside a plane)
+	cull_objects.clear();
+	cull_x.clear();
+	cull_y.clear();
+	cull_z.clear();
+	cull_radius.clear();
+	auto gather = [this](Scene::SpatialIndex::Cell const &cell) {
+		for (uint32_t e = cell.first; e != -1U; e = spatial_index.entries[e].next) {
+			Scene::SpatialIndex::Entry const &entry = spatial_index.entries[e];
+			if (entry.object->baked) continue;
+			cull_objects.emplace_back(entry.object);
+			cull_x.emplace_back(entry.center.x);
+			cull_y.emplace_back(entry.center.y);
+			cull_z.emplace_back(entry.center.z);
+			cull_radius.emplace_back(culling ? entry.radius : std::numeric_limits< float >::infinity());
+		}
+	};
+	gather(spatial_index.large);
+
+	//range of cells that might hold spheres touching the frustum:
+	// (the frustum lies within the cone from the eye along its four edges, so each edge heading toward -/+ an axis leaves that side of the range open)
+	glm::ivec3 cells_lo = spatial_index.min_cell, cells_hi = spatial_index.max_cell;
+	if (culling) {
+		glm::mat4 local_to_world = camera->transform->make_local_to_world();
+		float const far = 1e9f * spatial_index.cell_size;
+		glm::vec3 eye = glm::clamp(glm::vec3(local_to_world[3]), glm::vec3(-far), glm::vec3(far));
+		glm::ivec3 eye_cell = spatial_index.cell_at(eye);
+		bool open_lo[3] = {false, false, false}, open_hi[3] = {false, false, false};
+		float y = std::tan(0.5f * camera->fovy);
+		float x = camera->aspect * y;
+		for (uint32_t c = 0; c < 4; ++c) {
+			glm::vec3 edge = glm::vec3(local_to_world * glm::vec4((c & 1 ? x : -x), (c & 2 ? y : -y), -1.0f, 0.0f));
+			for (uint32_t a = 0; a < 3; ++a) {
+				if (edge[a] < 0.0f) open_lo[a] = true;
+				if (edge[a] > 0.0f) open_hi[a] = true;
+			}
+		}
+		//(spheres in a cell reach at most one cell_size past it)
+		for (uint32_t a = 0; a < 3; ++a) {
+			if (!open_lo[a]) cells_lo[a] = std::max(cells_lo[a], eye_cell[a] - 1);
+			if (!open_hi[a]) cells_hi[a] = std::min(cells_hi[a], eye_cell[a] + 1);
+		}
+	}
+
+	spatial_index.for_each_cell(cells_lo, cells_hi, [&](Scene::SpatialIndex::Cell const &cell) {
+		if (!cell.unbaked) return;
+		if (culling) {
+			//(spheres in a cell reach at most one cell_size past it)
+			glm::vec3 lo = glm::vec3(cell.at - glm::ivec3(1)) * spatial_index.cell_size;
+			glm::vec3 hi = glm::vec3(cell.at + glm::ivec3(2)) * spatial_index.cell_size;
+			bool outside = false;
+			for (auto const &plane : planes) {
+				glm::vec3 corner = glm::vec3(plane.x > 0.0f ? hi.x : lo.x, plane.y > 0.0f ? hi.y : lo.y, plane.z > 0.0f ? hi.z : lo.z);
+				if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+					outside = true;
+					break;
+				}
+			}
+			if (outside) return;
+		}
+		gather(cell);
+	});
+
+	cull_inside.resize(cull_objects.size());
+	spheres_inside_planes(planes, 5, cull_x.data(), cull_y.data(), cull_z.data(), cull_radius.data(),
+		uint32_t(cull_objects.size()), cull_inside.data());
+
+	//potentially-visible set for the camera's cell (if any):
+	uint32_t from = -1U;
+	if (culling && cell_visibility) {
+		from = cell_visibility->cell_at(glm::vec3(camera->transform->make_local_to_world()[3]));
+	}
+
+	visible.clear();
+	cull_visible.clear();
+	draw_stats.hidden = 0;
+	uint32_t inside = 0;
+	for (uint32_t i = 0; i < cull_objects.size(); ++i) {
+		if (!cull_inside[i]) continue;
+		++inside;
+		float r = cull_radius[i];
+		if (from != -1U && r != std::numeric_limits< float >::infinity()
+		 && !cell_visibility->any_visible(from, glm::vec2(cull_x[i] - r, cull_y[i] - r), glm::vec2(cull_x[i] + r, cull_y[i] + r))) {
+			++draw_stats.hidden;
+			continue;
+		}
+		visible.emplace_back(cull_objects[i]);
+		cull_visible.emplace_back(i);
+	}
+	//(objects in cells that were skipped count as culled too)
+	draw_stats.culled = spatial_index.unbaked - inside;
+
+	draw_stats.occluded = draw_stats.occluders = draw_stats.occluder_triangles = 0;
+	if (culling && occlusion_culling) {
+		//occluders are the static objects that look biggest from the camera:
+		glm::vec3 eye = glm::vec3(camera->transform->make_local_to_world()[3]);
+		cull_occluders.clear();
+		for (uint32_t v = 0; v < visible.size(); ++v) {
+			Scene::Object const *object = visible[v];
+			uint32_t i = cull_visible[v];
+			if (!object->is_static || !object->mesh_buffer || object->mesh_buffer->vertex_data.empty()) continue;
+			if (cull_radius[i] == std::numeric_limits< float >::infinity()) continue;
+			float distance = glm::length(glm::vec3(cull_x[i], cull_y[i], cull_z[i]) - eye);
+			float size = (distance > cull_radius[i] ? cull_radius[i] / distance : std::numeric_limits< float >::infinity());
+			cull_occluders.emplace_back(size, v);
+		}
+		uint32_t count = std::min(occluder_limit, uint32_t(cull_occluders.size()));
+		std::partial_sort(cull_occluders.begin(), cull_occluders.begin() + count, cull_occluders.end(),
+			[](std::pair< float, uint32_t > const &a, std::pair< float, uint32_t > const &b) {
+				return a.first > b.first || (a.first == b.first && a.second < b.second);
+			});
+
+		occlusion_buffer.clear(world_to_clip, camera->near);
+		for (uint32_t o = 0; o < count; ++o) {
+			Scene::Object const *object = visible[cull_occluders[o].second];
+			if (o > 0 && draw_stats.occluder_triangles + object->count / 3 > occluder_triangle_limit) break;
+			glm::mat4 object_to_clip = world_to_clip * object->transform->make_local_to_world();
+			MeshBuffer const &buffer = *object->mesh_buffer;
+			for (GLuint v = object->start; v + 2 < object->start + object->count; v += 3) {
+				occlusion_buffer.add_triangle(
+					object_to_clip * glm::vec4(buffer.position(v+0), 1.0f),
+					object_to_clip * glm::vec4(buffer.position(v+1), 1.0f),
+					object_to_clip * glm::vec4(buffer.position(v+2), 1.0f)
+				);
+			}
+			++draw_stats.occluders;
+			draw_stats.occluder_triangles += object->count / 3;
+		}
+
+		if (draw_stats.occluders) {
+			occlusion_buffer.rasterize(update_workers.get());
+			uint32_t kept = 0;
+			for (uint32_t v = 0; v < visible.size(); ++v) {
+				uint32_t i = cull_visible[v];
+				if (cull_radius[i] != std::numeric_limits< float >::infinity()
+				 && occlusion_buffer.occluded(glm::vec3(cull_x[i], cull_y[i], cull_z[i]), cull_radius[i])) {
+					continue;
+				}
+				visible[kept] = visible[v];
+				cull_visible[kept] = i;
+				++kept;
+			}
+			draw_stats.occluded = uint32_t(visible.size()) - kept;
+			visible.resize(kept);
+			cull_visible.resize(kept);
+		}
+	}
+
+	draw_stats.drawn = uint32_t(visible.size());
+}
+
+constexpr uint32_t Scene::InstanceTexels;
+constexpr GLuint Scene::LightingBinding;
+
+void Scene::queue(Scene::Camera const *camera) {
+	cull(camera);
+
+	commands.clear();
+	commands.reserve(visible.size());
+	instance_transforms.clear();
+	draw_stats.programs = draw_stats.vertex_arrays = draw_stats.materials = 0;
+	draw_stats.draw_calls = draw_stats.gl_calls = 0;
+
+	auto add_command = [this](Scene::Object *object, uint32_t instances, uint32_t instance_offset, uint8_t changes) {
+		commands.emplace_back();
+		commands.back().object = object;
+		commands.back().instances = instances;
+		commands.back().instance_offset = instance_offset;
+		commands.back().changes = changes;
+		if (changes & DrawCommand::UseProgram) ++draw_stats.programs;
+		if (changes & DrawCommand::BindVertexArray) ++draw_stats.vertex_arrays;
+		if (changes & DrawCommand::SetMaterial) ++draw_stats.materials;
+		++draw_stats.draw_calls;
+		draw_stats.gl_calls += ((changes & DrawCommand::UseProgram) ? 1 : 0)
+			+ ((changes & DrawCommand::BindVertexArray) ? 1 : 0)
+			+ ((changes & DrawCommand::SetMaterial) ? 1 : 0)
+			+ 1; //glDrawArrays[Instanced]
+		if (instances) {
+			draw_stats.gl_calls += (object->instanced.world_to_clip_mat4 != -1U ? 1 : 0)
+				+ (object->instanced.instance_offset_int != -1U ? 1 : 0);
+		} else {
+			draw_stats.gl_calls += (object->program_mvp_mat4 != -1U ? 1 : 0)
+				+ (object->program_mv_mat4x3 != -1U ? 1 : 0)
+				+ (object->program_itmv_mat3 != -1U ? 1 : 0);
+		}
+	};
+
+	if (!sort_draws) {
+		for (Scene::Object *object : visible) {
+			add_command(object, 0, 0, DrawCommand::UseProgram | DrawCommand::BindVertexArray
+				| (object->program_tint_vec4 != -1U ? DrawCommand::SetMaterial : 0));
+		}
+		return;
+	}
+
+	auto instanceable = [this](Scene::Object const *object) {
+		return instancing && object->instanced.program != 0;
+	};
+
+	//sort by state, then front-to-back:
+	// (instanceable objects sort by mesh instead of depth, so that copies of a mesh end up next to each other)
+	glm::mat4 const &world_to_camera = camera->transform->make_world_to_local();
+	//(cameras look along -z, so depth is minus the camera-space z)
+	glm::vec4 depth_row = -glm::vec4(world_to_camera[0][2], world_to_camera[1][2], world_to_camera[2][2], world_to_camera[3][2]);
+	render_queue.clear();
+	for (uint32_t i = 0; i < visible.size(); ++i) {
+		Scene::Object const *object = visible[i];
+		if (instanceable(object)) {
+			render_queue.push(RenderQueue::make_key(object->instanced.program, object->instanced.vao, object->material, 0.0f)
+				| (object->start & ((uint64_t(1) << RenderQueue::DepthBits) - 1)), i);
+		} else {
+			glm::vec4 center = object->transform->make_local_to_world() * glm::vec4(object->bounds_center, 1.0f);
+			render_queue.push(RenderQueue::make_key(object->program, object->vao, object->material, glm::dot(depth_row, center)), i);
+		}
+	}
+	render_queue.sort();
+
+	//gather runs of copies into instanced draws, noting only the state that differs from the previous command:
+	GLuint current_program = 0, current_vao = 0;
+	bool first = true;
+	uint32_t uniforms_material = -1U; //material whose uniforms the current program holds (-1U if unknown)
+	uint32_t instance_count = 0;
+	for (uint32_t i = 0; i < render_queue.items.size(); ) {
+		Scene::Object *object = visible[render_queue.items[i]];
+
+		uint32_t run = 0;
+		if (instanceable(object)) {
+			run = 1;
+			while (i + run < render_queue.items.size() && instance_count + run < instance_limit) {
+				Scene::Object const *other = visible[render_queue.items[i + run]];
+				if (!(instanceable(other)
+				 && other->instanced.program == object->instanced.program
+				 && other->instanced.vao == object->instanced.vao
+				 && other->start == object->start
+				 && other->count == object->count
+				 && other->material == object->material)) break;
+				++run;
+			}
+			if (instance_count + run > instance_limit) run = 0; //(out of room in the instance buffer)
+		}
+
+		GLuint program = (run ? object->instanced.program : object->program);
+		GLuint vao = (run ? object->instanced.vao : object->vao);
+		uint8_t changes = 0;
+		if (first || program != current_program) {
+			changes |= DrawCommand::UseProgram;
+			uniforms_material = -1U; //(uniforms belong to programs)
+		}
+		if (first || vao != current_vao) {
+			changes |= DrawCommand::BindVertexArray;
+		}
+		assert(object->material < materials.size() && "Objects' materials should be in Scene::materials.");
+		GLuint tint = (run ? object->instanced.tint_vec4 : object->program_tint_vec4);
+		if (tint != -1U && object->material != uniforms_material) {
+			changes |= DrawCommand::SetMaterial;
+			uniforms_material = object->material;
+		}
+		current_program = program;
+		current_vao = vao;
+		first = false;
+
+		if (run) {
+			add_command(object, run, instance_count, changes);
+			for (uint32_t r = 0; r < run; ++r) {
+				Scene::Transform const *transform = visible[render_queue.items[i + r]]->transform;
+				glm::mat4 const &local_to_world = transform->make_local_to_world();
+				glm::mat3 normal_to_world = transform->make_normal_to_world();
+				for (uint32_t row = 0; row < 3; ++row) {
+					instance_transforms.emplace_back(local_to_world[0][row], local_to_world[1][row], local_to_world[2][row], local_to_world[3][row]);
+				}
+				for (uint32_t row = 0; row < 3; ++row) {
+					instance_transforms.emplace_back(normal_to_world[0][row], normal_to_world[1][row], normal_to_world[2][row], 0.0f);
+				}
+			}
+			instance_count += run;
+			i += run;
+		} else {
+			add_command(object, 0, 0, changes);
+			i += 1;
+		}
+	}
+	if (instance_count) {
+		draw_stats.gl_calls += 4; //(instance buffer upload and texture binding)
+	}
 }
 
 void Scene::draw(Scene::Camera const *camera) {
 	assert(camera && "Must have a camera to draw scene from.");
 
+	if (instance_texture == 0) {
+		glGenBuffers(1, &instance_buffer);
+		glGenTextures(1, &instance_texture);
+		glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+		glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		GLint max_texels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+		instance_limit = uint32_t(max_texels) / InstanceTexels;
+	}
+
+	queue(camera);
+
+	//shared lighting:
+	if (lighting_buffer == 0) {
+		glGenBuffers(1, &lighting_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, lighting_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Lighting), &lighting, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		uploaded_lighting = lighting;
+	} else if (std::memcmp(&lighting, &uploaded_lighting, sizeof(Lighting)) != 0) {
+		glBindBuffer(GL_UNIFORM_BUFFER, lighting_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Lighting), &lighting);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		uploaded_lighting = lighting;
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, LightingBinding, lighting_buffer);
+
 	glm::mat4 world_to_camera = camera->transform->make_world_to_local();
 	glm::mat4 world_to_clip = camera->make_projection() * world_to_camera;
 
-	for (Scene::Object *object = first_object; object != nullptr; object = object->alloc_next) {
-		glm::mat4 local_to_world = object->transform->make_local_to_world();
+	if (!instance_transforms.empty()) {
+		//(fresh storage every frame, so the driver needn't wait for last frame's draws)
+		glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, instance_transforms.size() * sizeof(glm::vec4), instance_transforms.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+	}
+
+	for (DrawCommand const &command : commands) {
+		Scene::Object *object = command.object;
+
+		if (command.instances) {
+			if (command.changes & DrawCommand::UseProgram) {
+				glUseProgram(object->instanced.program);
+			}
+			if (object->instanced.world_to_clip_mat4 != -1U) {
+				glUniformMatrix4fv(object->instanced.world_to_clip_mat4, 1, GL_FALSE, glm::value_ptr(world_to_clip));
+			}
+			if (object->instanced.instance_offset_int != -1U) {
+				glUniform1i(object->instanced.instance_offset_int, GLint(command.instance_offset));
+			}
+			if (command.changes & DrawCommand::SetMaterial) {
+				Scene::Material const &material = materials[object->material];
+				glUniform4fv(object->instanced.tint_vec4, 1, glm::value_ptr(material.tint));
+			}
+			if (command.changes & DrawCommand::BindVertexArray) {
+				glBindVertexArray(object->instanced.vao);
+			}
+			glDrawArraysInstanced(GL_TRIANGLES, object->start, object->count, command.instances);
+			continue;
+		}
+
+		glm::mat4 const &local_to_world = object->transform->make_local_to_world();
 
 		//compute modelview+projection (object space to clip space) matrix for this object:
 		glm::mat4 mvp = world_to_clip * local_to_world;
@@ -174,11 +1658,13 @@ void Scene::draw(Scene::Camera const *camera) {
 		//compute modelview (object space to camera local space) matrix for this object:
 		glm::mat4 mv = local_to_world;
 
-		//NOTE: inverse cancels out transpose unless there is scale involved
-		glm::mat3 itmv = glm::inverse(glm::transpose(glm::mat3(mv)));
+		//(inverse transpose of mv's upper 3x3; cheap unless there is non-uniform scale involved)
+		glm::mat3 itmv = object->transform->make_normal_to_world();
 
 		//set up program uniforms:
-		glUseProgram(object->program);
+		if (command.changes & DrawCommand::UseProgram) {
+			glUseProgram(object->program);
+		}
 		if (object->program_mvp_mat4 != -1U) {
 			glUniformMatrix4fv(object->program_mvp_mat4, 1, GL_FALSE, glm::value_ptr(mvp));
 		}
@@ -189,24 +1675,46 @@ void Scene::draw(Scene::Camera const *camera) {
 			glUniformMatrix3fv(object->program_itmv_mat3, 1, GL_FALSE, glm::value_ptr(itmv));
 		}
 
-		if (object->set_uniforms) object->set_uniforms();
+		if (command.changes & DrawCommand::SetMaterial) {
+			Scene::Material const &material = materials[object->material];
+			glUniform4fv(object->program_tint_vec4, 1, glm::value_ptr(material.tint));
+		}
 
-		glBindVertexArray(object->vao);
+		if (command.changes & DrawCommand::BindVertexArray) {
+			glBindVertexArray(object->vao);
+		}
 
 		//draw the object:
 		glDrawArrays(GL_TRIANGLES, object->start, object->count);
 	}
-}
 
+	if (!instance_transforms.empty()) {
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+}
 
 Scene::~Scene() {
-	while (first_camera) {
-		delete_camera(first_camera);
+	//everything goes at once, so skip unlinking transforms from each other one at a time:
+	transforms.for_each([](Scene::Transform *transform){
+		transform->parent = transform->last_child = transform->prev_sibling = transform->next_sibling = nullptr;
+		transform->flat = nullptr;
+	});
+	cameras.clear();
+	lamps.clear();
+	objects.clear();
+	transforms.clear();
+
+	if (instance_texture != 0) {
+		glDeleteTextures(1, &instance_texture);
+		glDeleteBuffers(1, &instance_buffer);
+	}
+	if (lighting_buffer != 0) {
+		glDeleteBuffers(1, &lighting_buffer);
 	}
-	while (first_object) {
-		delete_object(first_object);
+	for (auto const &buffer : baked_buffers) {
+		if (buffer->vbo != 0) glDeleteBuffers(1, &buffer->vbo);
 	}
-	while (first_transform) {
-		delete_transform(first_transform);
+	for (GLuint vao : baked_vaos) {
+		glDeleteVertexArrays(1, &vao);
 	}
 }
@@ -1,23 +1,99 @@
 #pragma once
 
 #include "GL.hpp"
+#include "WorkerPool.hpp"
+#include "Pool.hpp"
+#include "RenderQueue.hpp"
+#include "MeshBuffer.hpp"
+#include "OcclusionBuffer.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 #include <vector>
 #include <list>
+#include <string>
 #include <functional>
+#include <memory>
+#include <limits>
+#include <cstdint>
+
+struct CellVisibility;
 
 //"Scene" manages a hierarchy of transformations with, potentially, attached information.
 struct Scene {
 
+	struct Transform;
+
+	//"FlatTransforms" is an alternative storage mode for the transform hierarchy (see Scene::set_flat_transforms):
+	// local specifications and world matrices are kept in arrays in parent-before-child order,
+	// so updating every world matrix is a single linear sweep instead of a pointer chase.
+	//Transform pointers remain valid as handles: each Transform knows its current slot in the arrays.
+	struct FlatTransforms {
+		//slot i holds transform handles[i] (nullptr for "tombstones" -- slots of deleted or relocated transforms -- until the next sort):
+		std::vector< Transform * > handles;
+		std::vector< uint32_t > parents; //slot of parent, or -1U for roots; parents[i] < i (once sorted)
+		std::vector< glm::vec3 > positions;
+		std::vector< glm::quat > rotations;
+		std::vector< glm::vec3 > scales;
+		std::vector< glm::mat4 > local_to_world;
+		std::vector< uint8_t > uniform_scale; //world matrix only rotates, translates, and scales the same along every axis
+		std::vector< glm::mat3 > normal_to_world; //(only computed for slots without uniform_scale)
+		std::vector< glm::mat4 > world_to_local; //(computed on demand)
+		std::vector< uint8_t > world_to_local_dirty;
+		std::vector< uint8_t > dirty; //local specification changed since last update()
+		std::vector< uint32_t > dirty_slots; //slots flagged in 'dirty' (a flagged slot that isn't listed has a listed ancestor)
+		std::vector< Transform * > subtree; //(scratch space for update())
+
+		bool order_dirty = false; //slots need re-sorting (or compacting) in next update()
+		uint32_t tombstones = 0; //(compacted away by a sort once they are half of all slots)
+
+		//update() splits the sweep across 'workers' (if set) in chunks of slots [chunks[c], chunks[c+1]):
+		// slots less than 'split_depth' deep in the hierarchy (listed in 'shallow') are swept first, and a chunk boundary
+		// never separates a deeper transform from its parent, so the chunks can then be swept independently
+		// (split_depth is usually 0, but scenes with everything under one root -- like generated mazes -- are split below it;
+		//  either way the results are the same no matter how many threads do the work)
+		WorkerPool *workers = nullptr;
+		std::vector< uint32_t > chunks;
+		uint32_t split_depth = 0;
+		std::vector< uint32_t > shallow;
+		std::vector< uint32_t > depth; //depth of each slot (as of the last split())
+		bool chunks_dirty = true; //hierarchy changed since chunks were computed
+		void split();
+		std::vector< uint32_t > min_parent_after; //(scratch space for split())
+
+		//bring every world matrix up to date (re-sorting first if needed):
+		// (when only a few slots are dirty, just their subtrees are recomputed; otherwise slots are swept from the first dirty one)
+		void update();
+		//rebuild the arrays in parent-before-child order, dropping tombstones:
+		// (keeps the current order where it already puts parents first, and keeps computed matrices)
+		void sort();
+		//move a transform and its descendants to new slots at the end (so they come after everything else):
+		void relocate(Transform *transform);
+
+		void add(Transform *transform);
+		void remove(Transform *transform);
+		void reserve(size_t count); //make room to add 'count' more transforms
+		//copy a transform's specification into its slot (and flag it dirty):
+		void sync(Transform const *transform);
+		//note that a transform's parent changed:
+		void reparent(Transform const *transform);
+	};
+
 	struct Transform {
 		//simple specification:
+		// (read these freely, but change them with the set_* functions -- or call mark_dirty() after changing them directly --
+		//  so that cached world matrices are recomputed)
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
 		glm::quat rotation = glm::quat(0.0f, 0.0f, 0.0f, 1.0f);
 		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
 
+		void set_position(glm::vec3 const &position_) { position = position_; mark_dirty(); }
+		void set_rotation(glm::quat const &rotation_) { rotation = rotation_; mark_dirty(); }
+		void set_scale(glm::vec3 const &scale_) { scale = scale_; mark_dirty(); }
+
+		bool has_uniform_scale() const { return scale.x == scale.y && scale.y == scale.z; }
+
 		//hierarchy information:
 		Transform *parent = nullptr;
 		Transform *last_child = nullptr;
@@ -34,8 +110,36 @@ struct Scene {
 		//computed from the above:
 		glm::mat4 make_local_to_parent() const;
 		glm::mat4 make_parent_to_local() const;
-		glm::mat4 make_local_to_world() const;
-		glm::mat4 make_world_to_local() const;
+		//(world matrices are cached, and only recomputed after this transform or an ancestor changes)
+		// NOTE: with flat transforms, the returned reference is only valid until transforms are next added to the scene
+		glm::mat4 const &make_local_to_world() const;
+		glm::mat4 const &make_world_to_local() const;
+		//inverse transpose of the upper 3x3 of the world matrix (for transforming normals):
+		// (when this transform and its ancestors all have uniform scale this is just the rotation divided by the scale;
+		//  otherwise the inverse is cached along with the world matrix)
+		glm::mat3 make_normal_to_world() const;
+
+		//flag the cached world matrices of this transform and its descendants as out of date:
+		// (called by set_position/rotation/scale and set_parent)
+		void mark_dirty();
+
+		//with flat transforms, storage and slot that holds this transform:
+		FlatTransforms *flat = nullptr;
+		uint32_t flat_index = -1U;
+
+		//slot in Scene::name_slots, if this transform was named by Scene::load:
+		uint32_t name_slot = -1U;
+
+		//cached world matrices:
+		// invariant: if a transform's cache is dirty, so are those of all of its descendants
+		// (so mark_dirty() can stop at transforms that are already dirty)
+		// NOTE: the caches are filled in by the const make_* functions, so these are not safe to call from multiple threads
+		mutable glm::mat4 local_to_world_cache;
+		mutable glm::mat4 world_to_local_cache;
+		mutable glm::mat3 normal_to_world_cache; //(only computed if !uniform_scale_cache)
+		mutable bool uniform_scale_cache = true; //this transform and its ancestors all have uniform scale
+		mutable bool local_to_world_dirty = true;
+		mutable bool world_to_local_dirty = true;
 
 		//constructor/destructor:
 		Transform() = default;
@@ -48,10 +152,6 @@ struct Scene {
 				set_parent(nullptr);
 			}
 		}
-
-		//used by Scene to manage allocation:
-		Transform **alloc_prev_next = nullptr;
-		Transform *alloc_next = nullptr;
 	};
 
 	//"Object"s contain information needed to render meshes:
@@ -67,17 +167,39 @@ struct Scene {
 		GLuint program_mv_mat4x3 = -1U; //uniform index for model-to-lighting-space matrix (mat4x3)
 		GLuint program_itmv_mat3 = -1U; //uniform index for normal-to-lighting-space matrix (mat3)
 
+		GLuint program_tint_vec4 = -1U; //uniform index for the material's tint (vec4)
+
+		//instanced program info (optional):
+		// visible objects with the same mesh, instanced program, and material are drawn together by one glDrawArraysInstanced,
+		// with their transforms read from Scene's per-frame instance buffer (see vertex_color_program_instanced)
+		struct Instanced {
+			GLuint program = 0; //zero means never drawn instanced
+			GLuint vao = 0; //vertex array object for 'program'
+			GLuint world_to_clip_mat4 = -1U; //uniform index for world-to-clip matrix (mat4)
+			GLuint instance_offset_int = -1U; //uniform index for where this draw's instances start in the instance buffer (int)
+			GLuint tint_vec4 = -1U; //uniform index for the material's tint (vec4)
+		} instanced;
+
 		//material info:
-		std::function< void() > set_uniforms; //will be called before rendering object, use to set material parameters (e.g. glossiness)
+		uint32_t material = 0; //index in Scene::materials
 
 		//attribute info:
 		GLuint vao = 0;
 		GLuint start = 0;
 		GLuint count = 0;
 
-		//used by Scene to manage allocation:
-		Object **alloc_prev_next = nullptr;
-		Object *alloc_next = nullptr;
+		//bounds (in object space, e.g. from MeshBuffer::Mesh), for culling:
+		// (objects with negative bounds_radius are never culled)
+		glm::vec3 bounds_min = glm::vec3(0.0f), bounds_max = glm::vec3(0.0f);
+		glm::vec3 bounds_center = glm::vec3(0.0f);
+		float bounds_radius = -1.0f;
+
+		//static geometry (see Scene::bake_static):
+		bool is_static = false; //won't move after loading, so may be baked
+		MeshBuffer const *mesh_buffer = nullptr; //where 'start' and 'count' refer to (needed for baking, and to be an occluder)
+		bool baked = false; //(set by bake_static; drawn as part of a baked batch instead, so cull() skips it)
+
+		uint32_t spatial_entry = -1U; //entry in Scene::spatial_index
 	};
 
 	//"Camera"s contain information needed to view a scene:
@@ -101,10 +223,41 @@ struct Scene {
 		float near = 0.01f; //near plane
 		//computed from the above:
 		glm::mat4 make_projection() const;
+	};
 
-		//used by Scene to manage allocation:
-		Camera **alloc_prev_next = nullptr;
-		Camera *alloc_next = nullptr;
+	//"Material"s are plain uniform values, kept in Scene::materials and shared by index:
+	// draw() uploads an object's material only if the previous draw with the same program used a different one
+	struct Material {
+		glm::vec4 tint = glm::vec4(1.0f); //multiplies the lit color (see vertex_color_program)
+	};
+
+	//Lighting shared by every program, uploaded as a uniform buffer (std140 layout; w components are unused):
+	struct Lighting {
+		glm::vec4 sun_direction = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f); //(toward the sun)
+		glm::vec4 sun_color = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+		glm::vec4 sky_direction = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f); //(toward the sky)
+		glm::vec4 sky_color = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	};
+	static_assert(sizeof(Lighting) == 4 * 16, "Lighting matches its std140 uniform block.");
+
+	//"Lamp"s hold light parameters (as exported from blender):
+	struct Lamp {
+		Transform *transform; //lamps must be attached to transforms.
+		Lamp(Transform *transform_) : transform(transform_) {
+			assert(transform);
+		}
+
+		//NOTE: spot and directional lamps shine along their -z axis
+		enum Type : char {
+			Point = 'p',
+			Hemisphere = 'h',
+			Spot = 's',
+			Directional = 'd',
+		} type = Point;
+		glm::u8vec3 color = glm::u8vec3(0xff);
+		float energy = 1.0f;
+		float distance = 0.0f; //falloff distance
+		float spot_fov = 0.0f; //(spot lamps) cone angle, in radians
 	};
 
 	//------ functions to create / destroy scene things -----
@@ -125,18 +278,333 @@ struct Scene {
 	//Delete a camera:
 	void delete_camera(Camera *);
 
-	//used to manage allocated objects:
-	Transform *first_transform = nullptr;
-	Object *first_object = nullptr;
-	Camera *first_camera = nullptr;
-	//(you shouldn't be manipulating these pointers directly
+	//Create a new lamp attached to a transform:
+	Lamp *new_lamp(Transform *transform);
+	//Delete a lamp:
+	void delete_lamp(Lamp *);
+
+	//Add a material, returning its index in 'materials':
+	uint32_t new_material(Material const &material);
+
+	//storage for transforms, objects, cameras, and lamps:
+	// (allocated from contiguous slabs; iterate with, e.g., objects.for_each([](Object *object){ ... }))
+	Pool< Transform > transforms;
+	Pool< Object > objects;
+	Pool< Camera > cameras;
+	Pool< Lamp > lamps;
+	//(you shouldn't be creating or destroying through these directly)
+
+	//materials, referred to by Object::material:
+	// (materials[0] is the default; change entries freely -- draw() reads them every frame)
+	std::vector< Material > materials = std::vector< Material >(1);
+
+	//lighting for every program that has a "Lighting" uniform block bound to LightingBinding (see vertex_color_program):
+	// (draw() re-uploads it only when it changes)
+	Lighting lighting;
+	static constexpr GLuint LightingBinding = 0; //uniform buffer binding point
+	GLuint lighting_buffer = 0;
+	Lighting uploaded_lighting; //(what lighting_buffer holds)
+
+	//------ loading ------
+
+	//Add the contents of a file in the layout written by meshes/export-scene.py (and Maze):
+	// - a transform per "xfh0" entry, with its parent (parents must come first), named after the blender object it came from;
+	// - an object per "msh0" entry, with start, count, bounds, and mesh_buffer set from 'meshes' (each mesh name is looked up once),
+	//   then passed to 'on_object' (if given), which fills in the rest (program, vao, ...) or returns false to remove it again;
+	// - a camera per "cam0" entry (orthographic cameras aren't supported, so they are skipped with a warning);
+	// - a lamp per "lmp0" entry.
+	//Storage for everything is reserved up front, so loading makes a handful of allocations rather than a few per entry.
+	// note: will throw if the file fails to read, or refers to a missing transform or mesh
+	void load(std::string const &filename, MeshBuffer const &meshes,
+		std::function< bool(Object *object, std::string const &mesh_name) > const &on_object = nullptr);
+
+	//Look up a transform by the name load() gave it, in constant time (nullptr if there isn't one):
+	// (if several transforms share a name, one of them is returned)
+	Transform *find_transform(std::string const &name) const;
+	//The name load() gave a transform ("" if none):
+	std::string transform_name(Transform const *transform) const;
+
+	//names are ranges of 'name_strings', in an open-addressed hash table:
+	struct NameSlot {
+		uint32_t begin = 0, end = 0;
+		uint32_t hash = 0;
+		bool used = false; //(unused slots end a search)
+		Transform *transform = nullptr; //(nullptr for used slots whose transform was deleted)
+	};
+	std::vector< char > name_strings;
+	std::vector< NameSlot > name_slots; //(size is zero or a power of two, and at most half used)
+	uint32_t name_slots_used = 0;
+	void reserve_names(uint32_t count); //make room for 'count' more names
+	void add_name(Transform *transform, uint32_t begin, uint32_t end); //(name is name_strings[begin,end))
+
+	//------ prefabs ------
+
+	//"Prefab" is a template made from a transform subtree and the objects attached to it, for spawning many copies at once:
+	struct Prefab {
+		struct Node {
+			uint32_t parent; //index of parent node, or -1U for the root (node 0)
+			glm::vec3 position;
+			glm::quat rotation;
+			glm::vec3 scale;
+		};
+		std::vector< Node > nodes; //(parents before children, siblings in order)
+		//copies of the attached objects (their 'transform' members are meaningless), and the nodes they were attached to:
+		std::vector< Object > objects;
+		std::vector< uint32_t > object_nodes;
+	};
+
+	//Capture 'root', its descendants, and the objects attached to them:
+	// (objects are copied as they are, except that they are never 'baked'; names, cameras, and lamps aren't captured)
+	Prefab make_prefab(Transform const *root);
+
+	//Add 'count' copies of 'prefab', with each copy's root a child of 'parent' (if given), and append the roots to '*roots' (if given):
+	// (parent links are filled in directly, and flat transform storage is grown once for all the copies; the copies are unnamed)
+	void instantiate(Prefab const &prefab, uint32_t count, Transform *parent = nullptr, std::vector< Transform * > *roots = nullptr);
+
+	//switch transform storage to (or back from) flat arrays:
+	// (existing Transform pointers remain valid either way)
+	void set_flat_transforms(bool flat);
+	bool flat = false;
+	FlatTransforms flat_transforms; //(only used if 'flat')
+
+	//bring every world matrix up to date (with flat transforms; otherwise matrices are computed on demand):
+	// (draw() calls this)
+	void update_world_matrices();
+
+	//split update_world_matrices() across this many threads (0 means one per hardware thread):
+	// (only applies to flat transforms; results are the same for any number of threads)
+	void set_update_threads(uint32_t threads);
+	std::unique_ptr< WorkerPool > update_workers;
+
+	//------ static geometry ------
+
+	//Merge static objects into world-space batches, so they draw with a few calls instead of one each:
+	// - static objects (with a mesh_buffer) that share mesh buffer, program, and material are grouped,
+	//   and split by which 'cell_size'-sized cube of the world their bounds' centers are in (so batches can still be culled);
+	// - each group's vertices are transformed to world space and copied into a new MeshBuffer, with a mesh per cell
+	//   (so the objects' mesh buffers must have kept their vertex_data; see MeshBuffer);
+	// - each cell becomes a new Object on 'baked_transform', and the objects that went into it are marked 'baked'.
+	//Moving a baked object afterward won't move what is drawn. Baking again replaces the previous batches.
+	// (with upload == false, makes no OpenGL calls -- leaving batches without a vbo or vao -- for headless benchmarks)
+	void bake_static(float cell_size, bool upload = true);
+	Transform *baked_transform = nullptr;
+	std::vector< std::unique_ptr< MeshBuffer > > baked_buffers;
+	std::vector< GLuint > baked_vaos;
+	std::vector< Object * > baked_objects;
+
+	//------ spatial queries ------
+
+	//"SpatialIndex" is a loose hashed grid over objects' world-space bounding spheres:
+	// - each sphere is filed under the 'cell_size' cube that holds its center, so it reaches at most one cell_size past that cube;
+	// - spheres bigger than a cell (and objects without bounds, whose radius is infinite) go on a separate 'large' list instead;
+	// - cells are found through an open-addressed hash of their coordinates, so only occupied cells take space.
+	//Scene keeps an entry per object; update_spatial_index() refreshes the spheres and only relinks entries that changed cells.
+	// (static objects are placed once and then skipped, since they don't move -- see Object::is_static)
+	//Queries visit objects through a callback (or fill a caller's vector), so they make no allocations.
+	struct SpatialIndex {
+		float cell_size = 4.0f; //(change only while empty)
+
+		//call f(object) for each object whose bounding sphere touches the sphere at 'center' with 'radius':
+		template< typename F >
+		void for_each_within(glm::vec3 const &center, float radius, F const &f) const;
+
+		//call f(object) for each object whose bounding sphere touches the box [min,max]:
+		template< typename F >
+		void for_each_overlapping(glm::vec3 const &min, glm::vec3 const &max, F const &f) const;
+
+		//set '*out' to the (up to) 'k' objects whose bounding sphere centers are nearest 'at' and within 'max_distance', nearest first:
+		// (cells are searched outward from 'at' until nothing closer can be left; ties go to the lower entry)
+		void nearest(glm::vec3 const &at, uint32_t k, std::vector< Object * > *out, float max_distance = std::numeric_limits< float >::infinity());
+
+		//------ internals ------
+
+		struct Entry {
+			glm::vec3 center = glm::vec3(0.0f);
+			float radius = 0.0f;
+			Object *object = nullptr; //(nullptr for free entries)
+			uint32_t cell = Unplaced; //index in 'cells', Large, or Unplaced (not yet seen by update_spatial_index, so not in any list)
+			uint32_t prev = -1U, next = -1U; //neighbors in the cell's list (for free entries, 'next' is the next free entry)
+			bool fixed = false; //(static object, already placed; update_spatial_index skips it)
+			bool unbaked = false; //(counted in its cell's 'unbaked')
+		};
+		static constexpr uint32_t Large = -2U;
+		static constexpr uint32_t Unplaced = -1U;
+		std::vector< Entry > entries;
+		uint32_t free_entry = -1U;
+
+		struct Cell {
+			glm::ivec3 at = glm::ivec3(0);
+			uint32_t first = -1U; //list of entries, through Entry::next
+			uint32_t unbaked = 0; //entries whose objects aren't baked (so cull() can skip cells of baked objects without visiting them)
+			//(cells are freed when their last entry leaves, so only free cells have first == -1U; for free cells, 'unbaked' is the next free cell)
+		};
+		static constexpr uint32_t Tombstone = -2U;
+		std::vector< Cell > cells;
+		uint32_t free_cell = -1U;
+		uint32_t cell_count = 0; //(cells in use)
+		Cell large;
+		uint32_t unbaked = 0; //(entries whose objects aren't baked, in 'large' and every cell)
+		std::vector< uint32_t > table; //index in 'cells', -1U, or Tombstone (a freed cell) by hash of coordinates; size is zero or a power of two, at most half used
+		uint32_t table_used = 0; //(slots holding cells or tombstones)
+		glm::ivec3 min_cell = glm::ivec3(1), max_cell = glm::ivec3(0); //(bounds of all cells, loose until the table is next rebuilt; empty if min > max)
+
+		uint32_t add(Object *object);
+		void remove(uint32_t entry);
+		//move an entry to the list for its new sphere (if that changed):
+		void place(uint32_t entry, glm::vec3 const &center, float radius);
+		void link(uint32_t entry, uint32_t cell);
+		void unlink(uint32_t entry);
+		Cell &cell_of(uint32_t entry) { return entries[entry].cell == Large ? large : cells[entries[entry].cell]; }
+
+		glm::ivec3 cell_at(glm::vec3 const &at) const { return glm::ivec3(glm::floor(at / cell_size)); }
+		uint32_t find_cell(glm::ivec3 const &at) const; //(-1U if there isn't one)
+		uint32_t make_cell(glm::ivec3 const &at);
+		void release_cell(uint32_t cell); //(removes an empty cell from the table and puts it on the free list)
+
+		//call f(cell) for every cell in [lo,hi], looking each one up or -- if the range is large -- scanning 'cells':
+		template< typename F >
+		void for_each_cell(glm::ivec3 lo, glm::ivec3 hi, F const &f) const;
+
+		std::vector< std::pair< float, uint32_t > > nearest_heap; //(scratch space for nearest(): squared distance, entry)
+	};
+	SpatialIndex spatial_index;
+
+	//bring world matrices and every entry in 'spatial_index' up to date (cull() calls this; call it before queries after moving things):
+	void update_spatial_index();
 
 	//------ functions to traverse the scene ------
 
-	//Draw the scene from a given camera by computing appropriate matrices and sending all objects to OpenGL:
+	//Draw the scene from a given camera by computing appropriate matrices and sending all visible objects to OpenGL:
 	//"camera" must be non-null!
 	void draw(Camera const *camera);
 
+	//Find the objects whose bounding spheres touch the camera's view frustum (queue() calls this):
+	// (fills 'visible' and updates 'draw_stats'; spheres come from 'spatial_index', and cells outside the frustum are skipped whole)
+	void cull(Camera const *camera);
+	bool culling = true; //if false, cull() lets everything through
+	std::vector< Object * > visible;
+
+	//if set, cull() also hides objects whose bounds (in xy) only cover cells that can't be seen from the camera's cell:
+	// (objects without bounds, and cameras outside the grid, aren't affected)
+	CellVisibility const *cell_visibility = nullptr;
+
+	//if set, cull() also draws the biggest (on screen) static objects that are left into 'occlusion_buffer' on the CPU,
+	// then hides objects whose bounds are entirely behind them:
+	// (only objects with a mesh_buffer that kept its vertex_data can be occluders, since their triangles are read from it;
+	//  batches from bake_static keep theirs only if occlusion_culling was set when they were baked)
+	bool occlusion_culling = true;
+	uint32_t occluder_limit = 128; //most occluders per frame
+	uint32_t occluder_triangle_limit = 16384; //most occluder triangles per frame (the biggest occluder is always drawn)
+	OcclusionBuffer occlusion_buffer; //(rasterized across 'update_workers', if set)
 
-	~Scene(); //destructor deallocates transforms, objects, cameras
+	//Cull, then order visible objects into 'commands' (draw() calls this; it makes no OpenGL calls):
+	// objects are sorted by program, vertex array, material, and depth, and each command notes only the state that changes
+	void queue(Camera const *camera);
+	bool sort_draws = true; //if false, commands are in the order cull() found objects and set every piece of state (as draw() used to)
+
+	bool instancing = true; //if false, objects are never drawn instanced
+
+	struct DrawCommand {
+		Object *object; //(for instanced draws, the first instance)
+		uint32_t instances; //zero for a plain draw of 'object'; otherwise a draw of this many instances of object->instanced.program
+		uint32_t instance_offset; //(for instanced draws) first instance's slot in 'instance_transforms'
+		enum : uint8_t {
+			UseProgram = 1,
+			BindVertexArray = 2,
+			SetMaterial = 4, //upload the object's material
+		};
+		uint8_t changes;
+	};
+	std::vector< DrawCommand > commands;
+	RenderQueue render_queue; //(scratch space for queue())
+
+	//per-instance data for this frame's instanced draws, 'InstanceTexels' texels per instance:
+	// the three rows of object_to_light (mat4x3), then the three rows of normal_to_light (mat3, w unused)
+	static constexpr uint32_t InstanceTexels = 6;
+	std::vector< glm::vec4 > instance_transforms;
+	uint32_t instance_limit = -1U; //most instances per frame (draw() sets this from GL_MAX_TEXTURE_BUFFER_SIZE); the rest are drawn plainly
+
+	//draw() uploads 'instance_transforms' to this buffer, and binds it as a buffer texture on texture unit zero:
+	GLuint instance_buffer = 0;
+	GLuint instance_texture = 0;
+
+	struct DrawStats {
+		uint32_t drawn = 0;
+		uint32_t culled = 0; //(outside the view frustum)
+		uint32_t hidden = 0; //(in the view frustum, but not in cell_visibility's set for the camera's cell)
+		uint32_t occluded = 0; //(behind occluders in occlusion_buffer)
+		uint32_t occluders = 0;
+		uint32_t occluder_triangles = 0;
+		//state changes in 'commands':
+		uint32_t programs = 0;
+		uint32_t vertex_arrays = 0;
+		uint32_t materials = 0;
+		uint32_t draw_calls = 0;
+		uint32_t gl_calls = 0;
+	} draw_stats; //(for the most recent cull() / queue())
+
+	//scratch space for cull(), as arrays of bounding spheres in world space:
+	std::vector< Object * > cull_objects;
+	std::vector< float > cull_x, cull_y, cull_z, cull_radius;
+	std::vector< uint8_t > cull_inside;
+	std::vector< uint32_t > cull_visible; //(index of each of 'visible' in the arrays above)
+	std::vector< std::pair< float, uint32_t > > cull_occluders; //(on-screen size, index into 'visible')
+
+
+	~Scene(); //destructor deallocates transforms, objects, cameras, lamps (all at once), baked batches, and the instance and lighting buffers
 };
+
+//------ spatial query templates ------
+
+template< typename F >
+void Scene::SpatialIndex::for_each_cell(glm::ivec3 lo, glm::ivec3 hi, F const &f) const {
+	lo = glm::max(lo, min_cell);
+	hi = glm::min(hi, max_cell);
+	if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) return;
+	uint64_t volume = uint64_t(hi.x - lo.x + 1) * uint64_t(hi.y - lo.y + 1) * uint64_t(hi.z - lo.z + 1);
+	if (volume > cells.size()) {
+		for (Cell const &cell : cells) {
+			if (cell.first == -1U) continue; //(free)
+			if (cell.at.x >= lo.x && cell.at.x <= hi.x && cell.at.y >= lo.y && cell.at.y <= hi.y && cell.at.z >= lo.z && cell.at.z <= hi.z) f(cell);
+		}
+	} else {
+		for (int32_t z = lo.z; z <= hi.z; ++z) {
+			for (int32_t y = lo.y; y <= hi.y; ++y) {
+				for (int32_t x = lo.x; x <= hi.x; ++x) {
+					uint32_t c = find_cell(glm::ivec3(x, y, z));
+					if (c != -1U) f(cells[c]);
+				}
+			}
+		}
+	}
+}
+
+template< typename F >
+void Scene::SpatialIndex::for_each_within(glm::vec3 const &center, float radius, F const &f) const {
+	auto visit = [&](Cell const &cell) {
+		for (uint32_t e = cell.first; e != -1U; e = entries[e].next) {
+			Entry const &entry = entries[e];
+			glm::vec3 to = entry.center - center;
+			float reach = radius + entry.radius;
+			if (glm::dot(to, to) <= reach * reach) f(entry.object);
+		}
+	};
+	visit(large);
+	//(spheres in the grid reach at most one cell_size past their cells)
+	glm::vec3 pad = glm::vec3(radius + cell_size);
+	for_each_cell(cell_at(center - pad), cell_at(center + pad), visit);
+}
+
+template< typename F >
+void Scene::SpatialIndex::for_each_overlapping(glm::vec3 const &min, glm::vec3 const &max, F const &f) const {
+	auto visit = [&](Cell const &cell) {
+		for (uint32_t e = cell.first; e != -1U; e = entries[e].next) {
+			Entry const &entry = entries[e];
+			glm::vec3 to = glm::clamp(entry.center, min, max) - entry.center;
+			if (glm::dot(to, to) <= entry.radius * entry.radius) f(entry.object);
+		}
+	};
+	visit(large);
+	glm::vec3 pad = glm::vec3(cell_size);
+	for_each_cell(cell_at(min - pad), cell_at(max + pad), visit);
+}
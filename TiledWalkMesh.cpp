@@ -0,0 +1,409 @@
+#include "TiledWalkMesh.hpp"
+#include "read_chunk.hpp"
+#include "write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+	std::string tile_path(std::string const &base, uint32_t x, uint32_t y) {
+		return base + "." + std::to_string(x) + "." + std::to_string(y) + ".walkmesh";
+	}
+
+	std::string index_base(std::string const &filename) {
+		std::string const suffix = ".tiles";
+		if (filename.size() >= suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0) {
+			return filename.substr(0, filename.size() - suffix.size());
+		}
+		return filename;
+	}
+}
+
+//------ cooking ------
+
+void TiledWalkMesh::cook(WalkMesh const &mesh, float tile_size, std::string const &filename) {
+	if (!(tile_size > 0.0f)) {
+		throw std::runtime_error("Tile size must be positive.");
+	}
+	if (mesh.triangles.empty()) {
+		throw std::runtime_error("Can't tile a walkmesh with no triangles.");
+	}
+
+	Grid grid;
+	glm::vec2 min = glm::vec2(mesh.bvh_nodes[0].min);
+	glm::vec2 max = glm::vec2(mesh.bvh_nodes[0].max);
+	grid.origin = min;
+	grid.tile_size = tile_size;
+	grid.tiles_x = std::max(1U, uint32_t(std::ceil((max.x - min.x) / tile_size)));
+	grid.tiles_y = std::max(1U, uint32_t(std::ceil((max.y - min.y) / tile_size)));
+
+	//assign triangles to tiles by centroid:
+	std::vector< uint32_t > tile_of(mesh.triangles.size());
+	std::vector< uint32_t > local_index(mesh.triangles.size());
+	std::vector< std::vector< uint32_t > > tile_triangles(grid.tiles_x * grid.tiles_y);
+	for (uint32_t t = 0; t < mesh.triangles.size(); ++t) {
+		glm::uvec3 const &tri = mesh.triangles[t];
+		glm::vec2 centroid = glm::vec2(mesh.vertices[tri[0]] + mesh.vertices[tri[1]] + mesh.vertices[tri[2]]) / 3.0f;
+		glm::vec2 at = (centroid - grid.origin) / tile_size;
+		uint32_t x = std::min(grid.tiles_x - 1, uint32_t(std::max(0.0f, at.x)));
+		uint32_t y = std::min(grid.tiles_y - 1, uint32_t(std::max(0.0f, at.y)));
+		tile_of[t] = y * grid.tiles_x + x;
+		local_index[t] = uint32_t(tile_triangles[tile_of[t]].size());
+		tile_triangles[tile_of[t]].emplace_back(t);
+	}
+
+	std::string base = index_base(filename);
+	std::vector< TileInfo > infos(tile_triangles.size());
+	std::vector< Link > links;
+	std::vector< uint32_t > remap(mesh.vertices.size(), -1U);
+	for (uint32_t tile = 0; tile < tile_triangles.size(); ++tile) {
+		TileInfo &info = infos[tile];
+		info.first_link = uint32_t(links.size());
+		if (tile_triangles[tile].empty()) continue;
+
+		//tile mesh has just the vertices its triangles use (triangle order and orientation are kept, so corners match the full mesh):
+		std::vector< glm::vec3 > vertices;
+		std::vector< glm::uvec3 > triangles;
+		for (uint32_t t : tile_triangles[tile]) {
+			glm::uvec3 tri = mesh.triangles[t];
+			for (uint32_t k = 0; k < 3; ++k) {
+				if (remap[tri[k]] == -1U) {
+					remap[tri[k]] = uint32_t(vertices.size());
+					vertices.emplace_back(mesh.vertices[tri[k]]);
+				}
+				tri[k] = remap[tri[k]];
+			}
+			triangles.emplace_back(tri);
+		}
+		for (uint32_t t : tile_triangles[tile]) {
+			glm::uvec3 const &tri = mesh.triangles[t];
+			remap[tri[0]] = remap[tri[1]] = remap[tri[2]] = -1U;
+		}
+
+		WalkMesh tile_mesh(vertices, triangles);
+		tile_mesh.save_cooked(tile_path(base, tile % grid.tiles_x, tile / grid.tiles_x));
+		info.min = tile_mesh.bvh_nodes[0].min;
+		info.max = tile_mesh.bvh_nodes[0].max;
+		info.triangle_count = uint32_t(triangles.size());
+
+		//edges that lead into other tiles (generated in order of 'edge'):
+		for (uint32_t local = 0; local < tile_triangles[tile].size(); ++local) {
+			uint32_t t = tile_triangles[tile][local];
+			for (uint32_t corner = 0; corner < 3; ++corner) {
+				uint32_t across = mesh.neighbors[t][corner];
+				if (across == -1U || tile_of[across] == tile) continue;
+				Link link;
+				link.edge = local * 3 + corner;
+				link.tile = tile_of[across];
+				link.triangle = local_index[across];
+				glm::uvec3 const &back = mesh.neighbors[across];
+				link.corner = (back[0] == t ? 0 : (back[1] == t ? 1 : 2));
+				links.emplace_back(link);
+			}
+		}
+		info.link_count = uint32_t(links.size()) - info.first_link;
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	write_chunk(file, "tgr0", std::vector< Grid >(1, grid));
+	write_chunk(file, "tin0", infos);
+	write_chunk(file, "lnk0", links);
+	if (!file) {
+		throw std::runtime_error("Failed to write tile index '" + filename + "'.");
+	}
+}
+
+//------ loading ------
+
+TiledWalkMesh::TiledWalkMesh(std::string const &filename) : base(index_base(filename)) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open tile index '" + filename + "'.");
+	}
+
+	std::vector< Grid > grids;
+	read_chunk(file, "tgr0", &grids);
+	read_chunk(file, "tin0", &infos);
+	read_chunk(file, "lnk0", &links);
+	if (grids.size() != 1) {
+		throw std::runtime_error("Tile index '" + filename + "' should have exactly one grid.");
+	}
+	grid = grids[0];
+	if (infos.size() != size_t(grid.tiles_x) * grid.tiles_y) {
+		throw std::runtime_error("Tile index '" + filename + "' has the wrong number of tiles for its grid.");
+	}
+	for (auto const &info : infos) {
+		if (uint64_t(info.first_link) + info.link_count > links.size()) {
+			throw std::runtime_error("Tile index '" + filename + "' has links out of range.");
+		}
+		for (uint32_t l = info.first_link; l < info.first_link + info.link_count; ++l) {
+			Link const &link = links[l];
+			if (link.edge / 3 >= info.triangle_count || link.tile >= infos.size()
+			 || link.triangle >= infos[link.tile].triangle_count || link.corner >= 3) {
+				throw std::runtime_error("Tile index '" + filename + "' has a link to a triangle that doesn't exist.");
+			}
+		}
+	}
+
+	tiles.resize(infos.size());
+	loader = std::thread(&TiledWalkMesh::loader_main, this);
+}
+
+TiledWalkMesh::~TiledWalkMesh() {
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		loader_quit = true;
+	}
+	loader_cv.notify_all();
+	loader.join();
+}
+
+std::string TiledWalkMesh::tile_filename(uint32_t tile) const {
+	return tile_path(base, tile % grid.tiles_x, tile / grid.tiles_x);
+}
+
+TiledWalkMesh::Link const *TiledWalkMesh::find_link(uint32_t tile, uint32_t triangle, uint32_t corner) const {
+	TileInfo const &info = infos[tile];
+	Link const *begin = links.data() + info.first_link;
+	Link const *end = begin + info.link_count;
+	uint32_t edge = triangle * 3 + corner;
+	Link const *found = std::lower_bound(begin, end, edge, [](Link const &link, uint32_t e){ return link.edge < e; });
+	return (found != end && found->edge == edge ? found : nullptr);
+}
+
+void TiledWalkMesh::loader_main() {
+	std::unique_lock< std::mutex > lock(loader_mutex);
+	while (true) {
+		loader_cv.wait(lock, [this](){ return loader_quit || !requests.empty(); });
+		if (loader_quit) return;
+		uint32_t tile = requests.front();
+		requests.pop_front();
+		lock.unlock();
+
+		std::unique_ptr< WalkMesh > mesh;
+		std::exception_ptr error;
+		try {
+			mesh.reset(new WalkMesh(tile_filename(tile)));
+			//touch every page of the mapping, so the page faults happen here instead of on the first walk:
+			unsigned char const *bytes = reinterpret_cast< unsigned char const * >(mesh->mapping.data);
+			uint32_t sum = 0;
+			for (size_t i = 0; i < mesh->mapping.size; i += 4096) sum += bytes[i];
+			volatile uint32_t sink = sum;
+			(void)sink;
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		lock.lock();
+		if (error) {
+			if (!loader_error) loader_error = error;
+		} else {
+			loaded.emplace_back(tile, std::move(mesh));
+		}
+	}
+}
+
+//------ residency ------
+
+void TiledWalkMesh::install(uint32_t tile, std::unique_ptr< WalkMesh > &&mesh) {
+	Tile &t = tiles[tile];
+	assert(t.state != Tile::Resident);
+	if (t.state == Tile::Queued) --metrics.pending_tiles;
+	t.state = Tile::Resident;
+	t.mesh = std::move(mesh);
+	metrics.resident_tiles += 1;
+	metrics.resident_bytes += t.mesh->mapping.size;
+	metrics.loads += 1;
+}
+
+void TiledWalkMesh::evict(uint32_t tile) {
+	Tile &t = tiles[tile];
+	assert(t.state == Tile::Resident);
+	metrics.resident_tiles -= 1;
+	metrics.resident_bytes -= t.mesh->mapping.size;
+	metrics.evictions += 1;
+	t.mesh.reset();
+	t.state = Tile::Absent;
+}
+
+void TiledWalkMesh::request(uint32_t tile) {
+	Tile &t = tiles[tile];
+	if (t.state != Tile::Absent || infos[tile].triangle_count == 0) return;
+	t.state = Tile::Queued;
+	metrics.pending_tiles += 1;
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		requests.emplace_back(tile);
+	}
+	loader_cv.notify_one();
+}
+
+WalkMesh const &TiledWalkMesh::tile_mesh(uint32_t tile) {
+	assert(tile < tiles.size());
+	Tile &t = tiles[tile];
+	t.wanted_frame = frame;
+	if (t.state == Tile::Resident) return *t.mesh;
+
+	//needed before the loader delivered it, so load it here:
+	if (t.state == Tile::Queued) {
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		auto found = std::find(requests.begin(), requests.end(), tile);
+		if (found != requests.end()) requests.erase(found);
+		//(if the loader is already partway through it, that copy will be dropped by update())
+	}
+	std::unique_ptr< WalkMesh > mesh(new WalkMesh(tile_filename(tile)));
+	metrics.stalls += 1;
+	install(tile, std::move(mesh));
+	return *t.mesh;
+}
+
+void TiledWalkMesh::update(WalkPoint const *points, size_t count) {
+	++frame;
+
+	//install tiles that finished loading:
+	std::vector< std::pair< uint32_t, std::unique_ptr< WalkMesh > > > done;
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		if (loader_error) {
+			std::exception_ptr error = loader_error;
+			loader_error = nullptr;
+			std::rethrow_exception(error);
+		}
+		done.swap(loaded);
+	}
+	for (auto &tile_mesh : done) {
+		//(tiles that were cancelled or loaded by a stall in the meantime are dropped)
+		if (tiles[tile_mesh.first].state == Tile::Queued) install(tile_mesh.first, std::move(tile_mesh.second));
+	}
+
+	//want tiles around every point:
+	int32_t radius = int32_t(prefetch_radius);
+	for (size_t i = 0; i < count; ++i) {
+		assert(points[i].tile < tiles.size());
+		int32_t x = int32_t(points[i].tile % grid.tiles_x);
+		int32_t y = int32_t(points[i].tile / grid.tiles_x);
+		tiles[points[i].tile].wanted_frame = frame;
+		request(points[i].tile);
+		for (int32_t ty = std::max(0, y - radius); ty <= std::min(int32_t(grid.tiles_y) - 1, y + radius); ++ty) {
+			for (int32_t tx = std::max(0, x - radius); tx <= std::min(int32_t(grid.tiles_x) - 1, x + radius); ++tx) {
+				uint32_t tile = uint32_t(ty) * grid.tiles_x + uint32_t(tx);
+				tiles[tile].wanted_frame = frame;
+				request(tile);
+			}
+		}
+	}
+
+	//cancel requests for tiles no longer wanted:
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		auto keep = std::remove_if(requests.begin(), requests.end(), [this](uint32_t tile){
+			if (tiles[tile].wanted_frame == frame) return false;
+			tiles[tile].state = Tile::Absent;
+			metrics.pending_tiles -= 1;
+			return true;
+		});
+		requests.erase(keep, requests.end());
+	}
+
+	//evict least-recently-wanted tiles while over budget:
+	if (metrics.resident_bytes > memory_budget) {
+		std::vector< uint32_t > unwanted;
+		for (uint32_t tile = 0; tile < tiles.size(); ++tile) {
+			if (tiles[tile].state == Tile::Resident && tiles[tile].wanted_frame != frame) unwanted.emplace_back(tile);
+		}
+		std::sort(unwanted.begin(), unwanted.end(), [this](uint32_t a, uint32_t b){
+			return tiles[a].wanted_frame < tiles[b].wanted_frame;
+		});
+		for (uint32_t tile : unwanted) {
+			if (metrics.resident_bytes <= memory_budget) break;
+			evict(tile);
+		}
+	}
+}
+
+//------ walking ------
+
+TiledWalkMesh::WalkPoint TiledWalkMesh::start(glm::vec3 const &world_point) {
+	//visit tiles in order of distance from their bounds, stopping once no tile can be closer than the closest point found:
+	std::vector< std::pair< float, uint32_t > > candidates;
+	for (uint32_t tile = 0; tile < infos.size(); ++tile) {
+		if (infos[tile].triangle_count == 0) continue;
+		glm::vec3 d = glm::max(glm::max(infos[tile].min - world_point, world_point - infos[tile].max), glm::vec3(0.0f));
+		candidates.emplace_back(glm::dot(d, d), tile);
+	}
+	if (candidates.empty()) {
+		throw std::runtime_error("Failed to find a closest point on TiledWalkMesh.");
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	WalkPoint closest;
+	float min_dist2 = std::numeric_limits< float >::infinity();
+	for (auto const &candidate : candidates) {
+		if (candidate.first >= min_dist2) break;
+		WalkMesh const &mesh = tile_mesh(candidate.second);
+		WalkMesh::WalkPoint wp = mesh.start(world_point);
+		glm::vec3 d = mesh.world_point(wp) - world_point;
+		if (glm::dot(d, d) < min_dist2) {
+			min_dist2 = glm::dot(d, d);
+			closest.tile = candidate.second;
+			closest.point = wp;
+		}
+	}
+	return closest;
+}
+
+void TiledWalkMesh::walk(WalkPoint &wp, glm::vec3 const &step) {
+	assert(wp.tile < tiles.size());
+
+	//(as WalkMesh::walk, but boundary edges of a tile are checked for links into other tiles)
+	glm::vec3 remaining = step;
+	uint32_t sliding = -1U;
+	for (uint32_t iter = 0; iter < 16; ++iter) {
+		WalkMesh const &mesh = tile_mesh(wp.tile);
+		glm::vec3 delta = mesh.triangle_frames[wp.point.triangle] * remaining;
+		if (sliding != -1U) {
+			float drift = delta[sliding];
+			delta[sliding] = 0.0f;
+			delta[(sliding + 1) % 3] += 0.5f * drift;
+			delta[(sliding + 2) % 3] += 0.5f * drift;
+		}
+		glm::vec3 target_weights = wp.point.weights + delta;
+
+		if (!(target_weights.x < 0.0f || target_weights.y < 0.0f || target_weights.z < 0.0f)) {
+			wp.point.weights = target_weights;
+			break;
+		}
+
+		float t;
+		uint32_t corner = WalkMesh::move_to_edge(wp.point, delta, target_weights, &t);
+		remaining *= (1.0f - t);
+
+		uint32_t next = mesh.neighbors[wp.point.triangle][corner];
+		if (next != -1U) {
+			glm::uvec3 const &back = mesh.neighbors[next];
+			uint32_t next_corner = (back[0] == wp.point.triangle ? 0 : (back[1] == wp.point.triangle ? 1 : 2));
+			mesh.cross_edge(wp.point, corner, mesh, next, next_corner, remaining);
+			sliding = -1U;
+			continue;
+		}
+
+		Link const *link = find_link(wp.tile, wp.point.triangle, corner);
+		if (link) {
+			//over the tile border:
+			WalkMesh const &next_mesh = tile_mesh(link->tile);
+			mesh.cross_edge(wp.point, corner, next_mesh, link->triangle, link->corner, remaining);
+			wp.tile = link->tile;
+			sliding = -1U;
+			continue;
+		}
+
+		if (sliding == corner) break;
+		remaining = mesh.slide_along_edge(wp.point, corner, remaining);
+		sliding = corner;
+	}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+//"TiledWalkMesh" is a WalkMesh too large to keep resident, split into a grid of tiles:
+// - each tile is a cooked (".walkmesh") WalkMesh in its own file, memory-mapped when needed;
+// - an index (".tiles") file -- always resident -- holds the grid layout, per-tile bounds, and
+//   "links" that stitch tile boundary edges to the triangles across them in other tiles;
+// - update() pages in tiles near the walk points it is given on a background thread, and
+//   evicts far-away tiles once the resident tiles exceed 'memory_budget';
+// - walk() crosses tile borders seamlessly (if the tile over the border hasn't arrived yet it is loaded on the spot -- a "stall").
+//
+//Tiles are laid out on the xy plane (floors exported from blender are +z up).
+//Like WalkMesh, a TiledWalkMesh is meant to be used from one thread (the loader thread is internal).
+
+struct TiledWalkMesh {
+	//Load the index written by cook():
+	// note: will throw if the index fails to read (tiles are read later, as needed)
+	TiledWalkMesh(std::string const &filename);
+	~TiledWalkMesh();
+
+	TiledWalkMesh(TiledWalkMesh const &) = delete;
+	TiledWalkMesh &operator=(TiledWalkMesh const &) = delete;
+
+	//Split 'mesh' into tiles of 'tile_size' x 'tile_size' (by triangle centroid) and write an index to 'filename' and tiles next to it:
+	// (tile (x,y) of "level.tiles" is written to "level.x.y.walkmesh")
+	static void cook(WalkMesh const &mesh, float tile_size, std::string const &filename);
+
+	struct WalkPoint {
+		uint32_t tile = -1U; //index of tile
+		WalkMesh::WalkPoint point; //walk point within the tile's mesh
+	};
+
+	//find the closest point on the mesh (loads any tiles that might hold it):
+	// note: will throw if the mesh has no triangles
+	WalkPoint start(glm::vec3 const &world_point);
+
+	//walk across the mesh (as WalkMesh::walk), crossing into neighboring tiles as needed:
+	void walk(WalkPoint &wp, glm::vec3 const &step);
+
+	glm::vec3 world_point(WalkPoint const &wp) { return tile_mesh(wp.tile).world_point(wp.point); }
+	glm::vec3 world_normal(WalkPoint const &wp) { return tile_mesh(wp.tile).world_normal(wp.point); }
+
+	//call once per frame with the walk points in use:
+	// installs tiles that finished loading, requests tiles within 'prefetch_radius' tiles of each point,
+	// and evicts the least-recently-wanted other tiles while over 'memory_budget'.
+	// (tiles wanted this frame are never evicted, so the budget can be exceeded if the points are spread out)
+	// note: rethrows any error from the loader thread
+	void update(WalkPoint const *points, size_t count);
+
+	uint32_t prefetch_radius = 1; //in tiles; 1 keeps the 3x3 tiles around each point resident
+	size_t memory_budget = 64 * 1024 * 1024; //bytes of resident tiles
+
+	struct Metrics {
+		uint32_t resident_tiles = 0;
+		size_t resident_bytes = 0;
+		uint32_t pending_tiles = 0; //requested but not yet installed
+		uint32_t loads = 0; //tiles loaded so far (by the loader or by stalls)
+		uint32_t stalls = 0; //tiles that had to be loaded on the calling thread because they were needed before they arrived
+		uint32_t evictions = 0;
+	} metrics;
+
+	//------ index ------
+
+	struct Grid {
+		glm::vec2 origin = glm::vec2(0.0f); //min corner of tile (0,0)
+		float tile_size = 1.0f;
+		uint32_t tiles_x = 0, tiles_y = 0;
+	};
+	Grid grid;
+
+	struct TileInfo {
+		glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f); //bounds of the tile's triangles
+		uint32_t triangle_count = 0; //(tiles with no triangles have no file)
+		uint32_t first_link = 0; //links for this tile are links[first_link, first_link + link_count)
+		uint32_t link_count = 0;
+	};
+	std::vector< TileInfo > infos; //tile (x,y) is infos[y * grid.tiles_x + x]
+
+	//a tile boundary edge that continues into another tile:
+	struct Link {
+		uint32_t edge = 0; //triangle * 3 + corner, for the triangle (and corner opposite the edge) in this tile; links are sorted by this
+		uint32_t tile = -1U; //tile across the edge
+		uint32_t triangle = -1U; //triangle across the edge
+		uint32_t corner = -1U; //corner of 'triangle' opposite the edge
+	};
+	std::vector< Link > links;
+
+	//link for the edge opposite 'corner' of 'triangle' in 'tile' (or nullptr if the edge is a real boundary):
+	Link const *find_link(uint32_t tile, uint32_t triangle, uint32_t corner) const;
+
+	std::string base; //index filename without ".tiles"
+	std::string tile_filename(uint32_t tile) const;
+
+	//------ residency ------
+
+	struct Tile {
+		enum State : uint32_t {
+			Absent,
+			Queued, //requested from the loader
+			Resident
+		} state = Absent;
+		std::unique_ptr< WalkMesh > mesh; //when resident
+		uint32_t wanted_frame = 0; //last frame in which update() (or walk) wanted this tile
+	};
+	std::vector< Tile > tiles;
+	uint32_t frame = 0;
+
+	//tile's mesh, loaded on this thread if not resident:
+	WalkMesh const &tile_mesh(uint32_t tile);
+
+	void install(uint32_t tile, std::unique_ptr< WalkMesh > &&mesh);
+	void evict(uint32_t tile);
+	void request(uint32_t tile);
+
+	//------ loader thread ------
+	// (the members below are shared with the loader, and only touched while holding 'loader_mutex';
+	//  the loader also reads 'grid' and 'base', which don't change after construction)
+
+	std::mutex loader_mutex;
+	std::condition_variable loader_cv;
+	std::deque< uint32_t > requests;
+	std::vector< std::pair< uint32_t, std::unique_ptr< WalkMesh > > > loaded;
+	std::exception_ptr loader_error;
+	bool loader_quit = false;
+	std::thread loader;
+	void loader_main();
+};
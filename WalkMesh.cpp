@@ -3,7 +3,9 @@
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <set>
@@ -11,20 +13,20 @@
 #include <string>
 #include <vector>
 
-glm::vec3 barycentric(glm::vec3 const &a, glm::vec3 const &b,
-                      glm::vec3 const &c, glm::vec3 const &p) {
-    glm::vec3 v0 = b - a, v1 = c - a, v2 = p - a;
-    float d00 = glm::dot(v0, v0);
-    float d01 = glm::dot(v0, v1);
-    float d11 = glm::dot(v1, v1);
-    float d20 = glm::dot(v2, v0);
-    float d21 = glm::dot(v2, v1);
-    float invDenom = 1.0 / (d00 * d11 - d01 * d01);
-    float v = (d11 * d20 - d01 * d21) * invDenom;
-    float w = (d00 * d21 - d01 * d20) * invDenom;
-    float u = 1.0f - v - w;
-    return glm::vec3(u, v, w);
-}
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define WALKMESH_SSE 1
+#include <emmintrin.h>
+#endif
 
 bool inTriangle(glm::vec3 const &weights) {
     return !(weights[0] < 0.0f || weights[1] < 0.0f || weights[2] < 0.0f);
@@ -41,89 +43,771 @@ void printTriangle(std::vector< glm::vec3 > tri) {
     std::cout << std::endl;
 }
 
+// closest point on triangle abc to p, returned as barycentric weights
+// (see Ericson, "Real-Time Collision Detection", section 5.1.5)
+static glm::vec3 closest_weights(glm::vec3 const &a, glm::vec3 const &b,
+                                 glm::vec3 const &c, glm::vec3 const &p) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return glm::vec3(1.0f, 0.0f, 0.0f);
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return glm::vec3(0.0f, 1.0f, 0.0f);
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        float v = d1 / (d1 - d3);
+        return glm::vec3(1.0f - v, v, 0.0f);
+    }
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return glm::vec3(0.0f, 0.0f, 1.0f);
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        float w = d2 / (d2 - d6);
+        return glm::vec3(1.0f - w, 0.0f, w);
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        return glm::vec3(0.0f, 1.0f - w, w);
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    float v = vb * denom;
+    float w = vc * denom;
+    return glm::vec3(1.0f - v - w, v, w);
+}
+
+// squared distance from p to an axis-aligned box (zero if p is inside)
+static float box_distance2(glm::vec3 const &min, glm::vec3 const &max,
+                           glm::vec3 const &p) {
+    glm::vec3 d = glm::max(glm::max(min - p, p - max), glm::vec3(0.0f));
+    return glm::dot(d, d);
+}
+
+// leaves of the bvh hold at most this many triangles:
+static const uint32_t BVHLeafSize = 4;
+
+// builds the bvh node covering bvh_triangles[begin,end), returns its index:
+static uint32_t build_bvh_node(WalkMesh &mesh,
+                               std::vector< glm::vec3 > const &centroids,
+                               uint32_t begin, uint32_t end) {
+    uint32_t index = uint32_t(mesh.storage.bvh_nodes.size());
+    mesh.storage.bvh_nodes.emplace_back();
+
+    WalkMesh::BVHNode node;
+    glm::vec3 centroid_min = glm::vec3(std::numeric_limits<float>::infinity());
+    glm::vec3 centroid_max = -centroid_min;
+    for (uint32_t i = begin; i < end; ++i) {
+        glm::uvec3 const &tri = mesh.storage.triangles[mesh.storage.bvh_triangles[i]];
+        for (uint32_t j = 0; j < 3; ++j) {
+            node.min = glm::min(node.min, mesh.storage.vertices[tri[j]]);
+            node.max = glm::max(node.max, mesh.storage.vertices[tri[j]]);
+        }
+        centroid_min = glm::min(centroid_min, centroids[mesh.storage.bvh_triangles[i]]);
+        centroid_max = glm::max(centroid_max, centroids[mesh.storage.bvh_triangles[i]]);
+    }
+
+    if (end - begin <= BVHLeafSize) {
+        node.first = begin;
+        node.count = end - begin;
+    } else {
+        // split at the median centroid along the longest axis
+        // (always halving keeps the tree balanced, so query stacks stay shallow)
+        glm::vec3 extent = centroid_max - centroid_min;
+        uint32_t axis = 0;
+        if (extent.y > extent[axis]) axis = 1;
+        if (extent.z > extent[axis]) axis = 2;
+        uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(mesh.storage.bvh_triangles.begin() + begin,
+                         mesh.storage.bvh_triangles.begin() + mid,
+                         mesh.storage.bvh_triangles.begin() + end,
+                         [&](uint32_t a, uint32_t b) {
+                             return centroids[a][axis] < centroids[b][axis];
+                         });
+        build_bvh_node(mesh, centroids, begin, mid);
+        node.first = build_bvh_node(mesh, centroids, mid, end);
+        node.count = 0;
+    }
+
+    mesh.storage.bvh_nodes[index] = node;
+    return index;
+}
+
+// (cooked sections, in file order)
+#define COOKED_SECTIONS(X)                       \
+    X("vtx0", glm::vec3, vertices)               \
+    X("lpi0", glm::uvec3, triangles)             \
+    X("tnm0", glm::vec3, triangle_normals)       \
+    X("frm0", glm::mat3, triangle_frames)        \
+    X("nbr0", glm::uvec3, neighbors)             \
+    X("bvn0", WalkMesh::BVHNode, bvh_nodes)      \
+    X("bvt0", uint32_t, bvh_triangles)
+
 // from MeshBuffer
 WalkMesh::WalkMesh(std::string filename) {
+    if (filename.size() >= 9 && filename.substr(filename.size() - 9) == ".walkmesh") {
+        mapping = Mapping(filename);
+        char const *base = reinterpret_cast< char const * >(mapping.data);
+
+        CookedHeader header;
+        if (mapping.size < sizeof(header)) {
+            throw std::runtime_error("WalkMesh '" + filename + "' is too small to be a cooked walkmesh.");
+        }
+        std::memcpy(&header, base, sizeof(header));
+        if (std::string(header.magic, 4) != std::string(CookedHeader().magic, 4)) {
+            throw std::runtime_error("WalkMesh '" + filename + "' has the wrong magic number.");
+        }
+        if (header.byte_order != CookedHeader().byte_order) {
+            throw std::runtime_error("WalkMesh '" + filename + "' was cooked with a different byte order.");
+        }
+        if (header.version != CookedHeader().version) {
+            throw std::runtime_error("WalkMesh '" + filename + "' is version " + std::to_string(header.version)
+                + " but version " + std::to_string(CookedHeader().version) + " is expected; re-cook it.");
+        }
+        if (mapping.size < sizeof(header) + uint64_t(header.section_count) * sizeof(CookedSection)) {
+            throw std::runtime_error("WalkMesh '" + filename + "' is truncated.");
+        }
+
+        // find each section and point the matching array into the mapping:
+        // (the data itself is trusted -- it was validated when it was built)
+        auto section = [&](char const *magic, uint32_t element_size, size_t *count) -> void const * {
+            for (uint32_t i = 0; i < header.section_count; ++i) {
+                CookedSection entry;
+                std::memcpy(&entry, base + sizeof(header) + i * sizeof(CookedSection), sizeof(entry));
+                if (std::string(entry.magic, 4) != magic) continue;
+                if (entry.element_size != element_size) {
+                    throw std::runtime_error("WalkMesh '" + filename + "' section '" + magic + "' has unexpected element size.");
+                }
+                if (entry.offset % CookedAlignment != 0 || entry.offset > mapping.size
+                 || entry.count > (mapping.size - entry.offset) / element_size) {
+                    throw std::runtime_error("WalkMesh '" + filename + "' section '" + magic + "' is out of range.");
+                }
+                *count = size_t(entry.count);
+                return base + entry.offset;
+            }
+            throw std::runtime_error("WalkMesh '" + filename + "' is missing section '" + magic + "'.");
+        };
+        #define LOAD_SECTION(MAGIC, TYPE, NAME) { \
+            size_t count = 0; \
+            TYPE const *ptr = reinterpret_cast< TYPE const * >(section(MAGIC, sizeof(TYPE), &count)); \
+            NAME = Array< TYPE >(ptr, count); \
+        }
+        COOKED_SECTIONS(LOAD_SECTION)
+        #undef LOAD_SECTION
+
+        if (triangle_normals.size() != triangles.size()
+         || triangle_frames.size() != triangles.size()
+         || neighbors.size() != triangles.size()
+         || bvh_triangles.size() != triangles.size()
+         || (bvh_nodes.empty() != triangles.empty())) {
+            throw std::runtime_error("WalkMesh '" + filename + "' has inconsistent section sizes.");
+        }
+        return;
+    }
+
+    if (!(filename.size() >= 5 && filename.substr(filename.size() - 5) == ".blob")) {
+        throw std::runtime_error("Unknown walkmesh file type '" + filename + "'");
+    }
+
     std::ifstream file(filename, std::ios::binary);
-    read_chunk(file, "vtx0", &vertices);
+    read_chunk(file, "vtx0", &storage.vertices);
+    std::vector< glm::vec3 > vertex_normals;  // (unused: walking uses triangle_normals)
     read_chunk(file, "nom0", &vertex_normals);
-    read_chunk(file, "lpi0", &triangles);
+    read_chunk(file, "lpi0", &storage.triangles);
+
+    build();
+}
+
+WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_,
+                   std::vector< glm::uvec3 > const &triangles_) {
+    storage.vertices = vertices_;
+    storage.triangles = triangles_;
+    build();
+}
+
+void WalkMesh::build() {
+    for (auto const &tri : storage.triangles) {
+        if (tri[0] >= storage.vertices.size() || tri[1] >= storage.vertices.size() ||
+            tri[2] >= storage.vertices.size()) {
+            throw std::runtime_error("WalkMesh triangle references out-of-range vertex.");
+        }
+    }
+
+    // normals and barycentric frames:
+    storage.triangle_normals.resize(storage.triangles.size());
+    storage.triangle_frames.resize(storage.triangles.size());
+    for (uint32_t t = 0; t < storage.triangles.size(); ++t) {
+        glm::vec3 const &a = storage.vertices[storage.triangles[t][0]];
+        glm::vec3 e0 = storage.vertices[storage.triangles[t][1]] - a;
+        glm::vec3 e1 = storage.vertices[storage.triangles[t][2]] - a;
+
+        glm::vec3 normal = glm::cross(e0, e1);
+        float length = glm::length(normal);
+        storage.triangle_normals[t] = (length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f));
+
+        // a step d changes weights (v,w) of b and c by solving
+        //  d = dv * e0 + dw * e1 (in the least-squares sense), so
+        //  dv = dot(to_v, d), dw = dot(to_w, d), and du = -dv - dw:
+        float d00 = glm::dot(e0, e0);
+        float d01 = glm::dot(e0, e1);
+        float d11 = glm::dot(e1, e1);
+        float denom = d00 * d11 - d01 * d01;
+        glm::vec3 to_v(0.0f), to_w(0.0f);
+        if (denom != 0.0f) {  // (degenerate triangles don't let you move)
+            to_v = (d11 * e0 - d01 * e1) / denom;
+            to_w = (d00 * e1 - d01 * e0) / denom;
+        }
+        // glm matrices are column-major, so the rows of the frame are columns of its transpose:
+        storage.triangle_frames[t] = glm::transpose(glm::mat3(-to_v - to_w, to_v, to_w));
+    }
+
+    // match up half-edges by sorting them by (unordered) vertex pair --
+    // a twin is the other half-edge with the same pair and opposite direction:
+    struct HalfEdge {
+        uint32_t lo, hi;  // vertex pair, sorted
+        uint32_t triangle;
+        uint32_t corner;  // the edge is opposite triangles[triangle][corner]
+    };
+    std::vector< HalfEdge > half_edges;
+    half_edges.reserve(3 * storage.triangles.size());
+    for (uint32_t t = 0; t < storage.triangles.size(); ++t) {
+        for (uint32_t corner = 0; corner < 3; ++corner) {
+            uint32_t a = storage.triangles[t][(corner + 1) % 3];
+            uint32_t b = storage.triangles[t][(corner + 2) % 3];
+            half_edges.push_back(HalfEdge{std::min(a, b), std::max(a, b), t, corner});
+        }
+    }
+    std::sort(half_edges.begin(), half_edges.end(),
+              [](HalfEdge const &x, HalfEdge const &y) {
+                  return x.lo != y.lo ? x.lo < y.lo : x.hi < y.hi;
+              });
+
+    storage.neighbors.assign(storage.triangles.size(), glm::uvec3(-1U));
+    for (uint32_t begin = 0; begin < half_edges.size();) {
+        uint32_t end = begin + 1;
+        while (end < half_edges.size() && half_edges[end].lo == half_edges[begin].lo &&
+               half_edges[end].hi == half_edges[begin].hi) {
+            ++end;
+        }
+        if (end - begin == 2) {
+            HalfEdge const &x = half_edges[begin];
+            HalfEdge const &y = half_edges[begin + 1];
+            // consistently oriented neighbors traverse the shared edge in opposite directions:
+            if (storage.triangles[x.triangle][(x.corner + 1) % 3] != storage.triangles[y.triangle][(y.corner + 1) % 3]) {
+                storage.neighbors[x.triangle][x.corner] = y.triangle;
+                storage.neighbors[y.triangle][y.corner] = x.triangle;
+            }
+        }
+        begin = end;
+    }
+
+    // bvh over triangle centroids:
+    storage.bvh_nodes.clear();
+    storage.bvh_triangles.resize(storage.triangles.size());
+    if (!storage.triangles.empty()) {
+        std::vector< glm::vec3 > centroids;
+        centroids.reserve(storage.triangles.size());
+        for (uint32_t i = 0; i < storage.triangles.size(); ++i) {
+            glm::uvec3 const &tri = storage.triangles[i];
+            centroids.emplace_back((storage.vertices[tri[0]] + storage.vertices[tri[1]] +
+                                    storage.vertices[tri[2]]) / 3.0f);
+            storage.bvh_triangles[i] = i;
+        }
+        storage.bvh_nodes.reserve(2 * (storage.triangles.size() / BVHLeafSize + 1));
+        build_bvh_node(*this, centroids, 0, uint32_t(storage.triangles.size()));
+    }
+
+    // point the arrays at the freshly-built storage:
+    mapping = Mapping();
+    vertices = storage.vertices;
+    triangles = storage.triangles;
+    triangle_normals = storage.triangle_normals;
+    triangle_frames = storage.triangle_frames;
+    neighbors = storage.neighbors;
+    bvh_nodes = storage.bvh_nodes;
+    bvh_triangles = storage.bvh_triangles;
+}
+
+void WalkMesh::save_cooked(std::string const &filename) const {
+    CookedHeader header;
+    std::vector< CookedSection > sections;
+    uint64_t offset = sizeof(CookedHeader);
+    #define COUNT_SECTION(MAGIC, TYPE, NAME) ++header.section_count;
+    COOKED_SECTIONS(COUNT_SECTION)
+    #undef COUNT_SECTION
+    offset += header.section_count * sizeof(CookedSection);
+
+    #define PLAN_SECTION(MAGIC, TYPE, NAME) { \
+        CookedSection section; \
+        std::memcpy(section.magic, MAGIC, 4); \
+        section.element_size = sizeof(TYPE); \
+        section.offset = (offset + CookedAlignment - 1) / CookedAlignment * CookedAlignment; \
+        section.count = NAME.size(); \
+        offset = section.offset + section.count * section.element_size; \
+        sections.emplace_back(section); \
+    }
+    COOKED_SECTIONS(PLAN_SECTION)
+    #undef PLAN_SECTION
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast< char const * >(&header), sizeof(header));
+    file.write(reinterpret_cast< char const * >(sections.data()), sections.size() * sizeof(CookedSection));
+    uint32_t index = 0;
+    #define WRITE_SECTION(MAGIC, TYPE, NAME) { \
+        CookedSection const &section = sections[index++]; \
+        static char const padding[CookedAlignment] = {0}; \
+        file.write(padding, std::streamsize(section.offset - uint64_t(file.tellp()))); \
+        file.write(reinterpret_cast< char const * >(NAME.data()), std::streamsize(section.count * section.element_size)); \
+    }
+    COOKED_SECTIONS(WRITE_SECTION)
+    #undef WRITE_SECTION
+
+    if (!file) {
+        throw std::runtime_error("Failed to write cooked walkmesh '" + filename + "'.");
+    }
+}
+
+//------ memory mapping ------
+
+WalkMesh::Mapping::Mapping(std::string const &filename) {
+#if defined(_WIN32)
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        throw std::runtime_error("Failed to open '" + filename + "'.");
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    size = size_t(file_size.QuadPart);
+    if (size == 0) return;
+    map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map) data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        if (map) CloseHandle(map);
+        CloseHandle(file);
+        map = file = nullptr;
+        throw std::runtime_error("Failed to map '" + filename + "'.");
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open '" + filename + "'.");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat '" + filename + "'.");
+    }
+    size = size_t(info.st_size);
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // (the mapping keeps the file open)
+    if (ptr == MAP_FAILED) {
+        size = 0;
+        throw std::runtime_error("Failed to map '" + filename + "'.");
+    }
+    data = ptr;
+#endif
+}
+
+WalkMesh::Mapping::Mapping(Mapping &&other) {
+    *this = std::move(other);
+}
 
-    // insert (a,b)->c, (b,c)->a, (c,a)->b
-    for (auto &tri : triangles) {
-        auto a = tri[0], b = tri[1], c = tri[2];
-        next_vertex[glm::uvec2(a, b)] = c;
-        next_vertex[glm::uvec2(b, c)] = a;
-        next_vertex[glm::uvec2(c, a)] = b;
+WalkMesh::Mapping &WalkMesh::Mapping::operator=(Mapping &&other) {
+    if (this != &other) {
+        unmap();
+        data = other.data;
+        size = other.size;
+        other.data = nullptr;
+        other.size = 0;
+#if defined(_WIN32)
+        file = other.file;
+        map = other.map;
+        other.file = other.map = nullptr;
+#endif
     }
+    return *this;
 }
 
-// WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector<
-// glm::uvec3 > const &triangles_) : vertices(vertices_), triangles(triangles_) {
-////TODO: construct next_vertex map
-//}
+WalkMesh::Mapping::~Mapping() {
+    unmap();
+}
+
+void WalkMesh::Mapping::unmap() {
+#if defined(_WIN32)
+    if (data) UnmapViewOfFile(data);
+    if (map) CloseHandle(map);
+    if (file) CloseHandle(file);
+    file = map = nullptr;
+#else
+    if (data) munmap(const_cast< void * >(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
 
 WalkMesh::WalkPoint WalkMesh::start(glm::vec3 const &world_point) const {
+    if (bvh_nodes.empty()) {
+        throw std::runtime_error("Cannot start walking on a WalkMesh with no triangles.");
+    }
+
     WalkPoint closest;
+    float min_dist2 = std::numeric_limits<float>::infinity();
 
-    // optimized algorithm based on my game
-    // assumption: I can find at least one triangle where the projection of
-    // world_point lies
-    // TODO: iterate through triangles
-    // TODO: find the projection P of world_point onto the triangle plane
-    // TODO: find the barycentric coordinate
-    // TODO: if P is in the triangle and the distance between world_point and P
-    // is shorter, update closest
-    // TODO: report error if world_point cannot be projected onto any of the
-    // triangles
-    float min_dist = std::numeric_limits<float>::max();
-
-    for (auto &tri : triangles) {
-        glm::vec3 vertex1 = vertices[tri[0]];
-        glm::vec3 vertex2 = vertices[tri[1]];
-        glm::vec3 vertex3 = vertices[tri[2]];
-        glm::vec3 normal =
-            glm::normalize(glm::cross(vertex2 - vertex1, vertex3 - vertex1));
-        auto t =
-            glm::dot(vertex1 - world_point, normal) / glm::dot(normal, normal);
-        glm::vec3 projection = world_point + t * normal;
-        glm::vec3 weights = barycentric(vertex1, vertex2, vertex3, projection);
-
-        // check whether this weight is in the triangle
-        if (!inTriangle(weights)) {
+    // depth-first, nearer child first, skipping any node whose box is
+    // farther away than the best triangle found so far:
+    // (the bvh is balanced, so its depth is at most ~log2(triangles))
+    uint32_t stack[64];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size) {
+        BVHNode const &node = bvh_nodes[stack[--stack_size]];
+        if (box_distance2(node.min, node.max, world_point) >= min_dist2) {
             continue;
         }
 
-        // if the distance is shorter whan min_dist, update closest
-        auto dist = glm::distance(world_point, projection);
-        if (dist < min_dist) {
-            closest.triangle = tri;
-            closest.weights = weights;
-            min_dist = dist;
+        if (node.count) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+                glm::vec3 const &a = vertices[tri[0]];
+                glm::vec3 const &b = vertices[tri[1]];
+                glm::vec3 const &c = vertices[tri[2]];
+                glm::vec3 weights = closest_weights(a, b, c, world_point);
+                glm::vec3 at = weights.x * a + weights.y * b + weights.z * c;
+                float dist2 = glm::dot(at - world_point, at - world_point);
+                if (dist2 < min_dist2) {
+                    closest.triangle = bvh_triangles[i];
+                    closest.weights = weights;
+                    min_dist2 = dist2;
+                }
+            }
+        } else {
+            uint32_t near_child = uint32_t(&node - &bvh_nodes[0]) + 1;
+            uint32_t far_child = node.first;
+            if (box_distance2(bvh_nodes[near_child].min, bvh_nodes[near_child].max, world_point)
+              > box_distance2(bvh_nodes[far_child].min, bvh_nodes[far_child].max, world_point)) {
+                std::swap(near_child, far_child);
+            }
+            assert(stack_size + 2 <= sizeof(stack) / sizeof(stack[0]));
+            stack[stack_size++] = far_child;
+            stack[stack_size++] = near_child;
         }
     }
 
-    assert(min_dist < std::numeric_limits<float>::max());
+    // (only possible if every triangle is degenerate in a way that yields NaN weights)
+    if (min_dist2 == std::numeric_limits<float>::infinity()) {
+        throw std::runtime_error("Failed to find a closest point on WalkMesh.");
+    }
     return closest;
 }
 
+uint32_t WalkMesh::move_to_edge(WalkPoint &wp, glm::vec3 const &delta,
+                                glm::vec3 const &target_weights, float *t) {
+    *t = 1.0f;
+    uint32_t corner = -1U;
+    for (uint32_t k = 0; k < 3; ++k) {
+        if (target_weights[k] < 0.0f && delta[k] < 0.0f) {
+            float tk = std::max(0.0f, -wp.weights[k] / delta[k]);
+            if (tk <= *t) {
+                *t = tk;
+                corner = k;
+            }
+        }
+    }
+    assert(corner != -1U);
+
+    wp.weights += *t * delta;
+    wp.weights[corner] = 0.0f;
+    wp.weights = glm::max(wp.weights, glm::vec3(0.0f));
+    wp.weights /= wp.weights[0] + wp.weights[1] + wp.weights[2];
+    return corner;
+}
+
+void WalkMesh::cross_edge(WalkPoint &wp, uint32_t corner,
+                          WalkMesh const &next_mesh, uint32_t next,
+                          uint32_t next_corner, glm::vec3 &step) const {
+    glm::uvec3 const &tri = triangles[wp.triangle];
+    glm::vec3 along = glm::normalize(vertices[tri[(corner + 2) % 3]] - vertices[tri[(corner + 1) % 3]]);
+
+    // wp.triangle gets updated to adjacent triangle (which traverses the edge in the opposite direction):
+    glm::vec3 next_weights(0.0f);
+    next_weights[(next_corner + 1) % 3] = wp.weights[(corner + 2) % 3];
+    next_weights[(next_corner + 2) % 3] = wp.weights[(corner + 1) % 3];
+
+    // step gets rotated over the edge (about the shared edge, from the old plane into the new one):
+    glm::vec3 const &normal = triangle_normals[wp.triangle];
+    glm::vec3 const &next_normal = next_mesh.triangle_normals[next];
+    step = glm::dot(step, along) * along +
+           glm::dot(step, glm::cross(normal, along)) *
+               glm::cross(next_normal, along);
+
+    wp.triangle = next;
+    wp.weights = next_weights;
+}
+
+glm::vec3 WalkMesh::slide_along_edge(WalkPoint const &wp, uint32_t corner,
+                                     glm::vec3 const &step) const {
+    glm::uvec3 const &tri = triangles[wp.triangle];
+    glm::vec3 along = glm::normalize(vertices[tri[(corner + 2) % 3]] - vertices[tri[(corner + 1) % 3]]);
+    return glm::dot(step, along) * along;
+}
+
+// which corner of triangle 'next' is opposite its edge shared with 'from':
+static uint32_t shared_corner(WalkMesh const &mesh, uint32_t next, uint32_t from) {
+    glm::uvec3 const &across = mesh.neighbors[next];
+    return (across[0] == from ? 0 : (across[1] == from ? 1 : 2));
+}
+
 void WalkMesh::walk(WalkPoint &wp, glm::vec3 const &step) const {
-    // TODO: project step to barycentric coordinates to get weights_step
-    // glm::vec3 weights_step;
-    glm::vec3 target_weights =
-        barycentric(vertices[wp.triangle[0]], vertices[wp.triangle[1]],
-                    vertices[wp.triangle[2]], world_point(wp) + step);
-    //glm::vec3 weights_step = target_weights - wp.weights;
-
-
-    if (inTriangle(target_weights)) {  // if a triangle edge is not crossed
-        wp.weights = target_weights;
-    } else {  // if a triangle edge is crossed
-              // TODO: wp.weights gets moved to triangle edge, and step gets
-              // reduced if there is another triangle over the edge:
-              // TODO: wp.triangle gets updated to adjacent triangle
-              // TODO: step gets rotated over the edge
-              // else if there is no other triangle over the edge:
-              // TODO: wp.triangle stays the same.
-              // TODO: step gets updated to slide along the edge
+    assert(wp.triangle < triangles.size());
+
+    glm::vec3 remaining = step;
+    // corner whose opposite (boundary) edge the step is sliding along, if any:
+    uint32_t sliding = -1U;
+
+    // each iteration either finishes the step or moves to an edge; the cap
+    // guards against ping-ponging forever in degenerate corners:
+    for (uint32_t iter = 0; iter < 16; ++iter) {
+        // (the frame ignores the out-of-plane part of the step)
+        glm::vec3 delta = triangle_frames[wp.triangle] * remaining;
+        if (sliding != -1U) {
+            // sliding exactly along the edge; don't let rounding pull it off
+            // (but keep the weights summing to one):
+            float drift = delta[sliding];
+            delta[sliding] = 0.0f;
+            delta[(sliding + 1) % 3] += 0.5f * drift;
+            delta[(sliding + 2) % 3] += 0.5f * drift;
+        }
+        glm::vec3 target_weights = wp.weights + delta;
+
+        if (inTriangle(target_weights)) {  // if a triangle edge is not crossed
+            wp.weights = target_weights;
+            break;
+        }
+
+        // a triangle edge is crossed: wp.weights gets moved to triangle edge, and step gets reduced:
+        float t;
+        uint32_t corner = move_to_edge(wp, delta, target_weights, &t);
+        remaining *= (1.0f - t);
+
+        uint32_t next = neighbors[wp.triangle][corner];
+        if (next == -1U) {
+            // no other triangle over the edge: wp.triangle stays the same,
+            // step gets updated to slide along the edge
+            if (sliding == corner) break;  // already sliding here; nothing left to do
+            remaining = slide_along_edge(wp, corner, remaining);
+            sliding = corner;
+            continue;
+        }
+
+        cross_edge(wp, corner, *this, next, shared_corner(*this, next, wp.triangle), remaining);
+        sliding = -1U;
+    }
+}
+
+void WalkMesh::walk(WalkPoints &points, float const *step_x,
+                    float const *step_y, float const *step_z) const {
+    size_t i = 0;
+
+#ifdef WALKMESH_SSE
+    // four lanes at a time: step within the current triangle, and keep any
+    // lane that would leave its triangle for the scalar walk below:
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= points.size(); i += 4) {
+        glm::mat3 const &f0 = triangle_frames[points.triangle[i + 0]];
+        glm::mat3 const &f1 = triangle_frames[points.triangle[i + 1]];
+        glm::mat3 const &f2 = triangle_frames[points.triangle[i + 2]];
+        glm::mat3 const &f3 = triangle_frames[points.triangle[i + 3]];
+
+        __m128 sx = _mm_loadu_ps(step_x + i);
+        __m128 sy = _mm_loadu_ps(step_y + i);
+        __m128 sz = _mm_loadu_ps(step_z + i);
+
+        // target[r] = weight[r] + frame[0][r] * sx + frame[1][r] * sy + frame[2][r] * sz
+        // (glm matrices are indexed [column][row])
+        #define TARGET(R, WEIGHT) \
+            _mm_add_ps(_mm_loadu_ps(WEIGHT + i), _mm_add_ps(_mm_add_ps( \
+                _mm_mul_ps(_mm_setr_ps(f0[0][R], f1[0][R], f2[0][R], f3[0][R]), sx), \
+                _mm_mul_ps(_mm_setr_ps(f0[1][R], f1[1][R], f2[1][R], f3[1][R]), sy)), \
+                _mm_mul_ps(_mm_setr_ps(f0[2][R], f1[2][R], f2[2][R], f3[2][R]), sz)))
+        __m128 tx = TARGET(0, points.weight_x.data());
+        __m128 ty = TARGET(1, points.weight_y.data());
+        __m128 tz = TARGET(2, points.weight_z.data());
+        #undef TARGET
+
+        // lanes whose target is inside the triangle (same test as inTriangle):
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(tx, zero),
+                                   _mm_and_ps(_mm_cmpge_ps(ty, zero), _mm_cmpge_ps(tz, zero)));
+        int mask = _mm_movemask_ps(inside);
+
+        if (mask == 0xf) {
+            _mm_storeu_ps(points.weight_x.data() + i, tx);
+            _mm_storeu_ps(points.weight_y.data() + i, ty);
+            _mm_storeu_ps(points.weight_z.data() + i, tz);
+            continue;
+        }
+
+        float target_x[4], target_y[4], target_z[4];
+        _mm_storeu_ps(target_x, tx);
+        _mm_storeu_ps(target_y, ty);
+        _mm_storeu_ps(target_z, tz);
+        for (uint32_t lane = 0; lane < 4; ++lane) {
+            if (mask & (1 << lane)) {
+                points.weight_x[i + lane] = target_x[lane];
+                points.weight_y[i + lane] = target_y[lane];
+                points.weight_z[i + lane] = target_z[lane];
+            } else {
+                WalkPoint wp = points.get(i + lane);
+                walk(wp, glm::vec3(step_x[i + lane], step_y[i + lane], step_z[i + lane]));
+                points.set(i + lane, wp);
+            }
+        }
+    }
+#endif
+
+    // remaining points (or all of them, without SSE):
+    for (; i < points.size(); ++i) {
+        WalkPoint wp = points.get(i);
+        walk(wp, glm::vec3(step_x[i], step_y[i], step_z[i]));
+        points.set(i, wp);
+    }
+}
+
+WalkMesh::Cast WalkMesh::cast(WalkPoint const &from, glm::vec3 const &step) const {
+    assert(from.triangle < triangles.size());
+
+    Cast result;
+    WalkPoint &wp = result.at;
+    wp = from;
+
+    // only the in-plane part of the step is traced (as in walk):
+    glm::vec3 const &normal = triangle_normals[wp.triangle];
+    glm::vec3 remaining = step - glm::dot(step, normal) * normal;
+    float length = glm::length(remaining);
+    // fraction of the step not yet traced:
+    float left = 1.0f;
+
+    // a straight ray can't enter a triangle of a flat mesh twice, so this
+    // only cuts off rays that circle around bent (or degenerate) meshes:
+    for (size_t iter = 0; iter <= triangles.size(); ++iter) {
+        glm::vec3 delta = triangle_frames[wp.triangle] * remaining;
+        glm::vec3 target_weights = wp.weights + delta;
+
+        if (inTriangle(target_weights)) {  // the rest of the ray is in this triangle
+            wp.weights = target_weights;
+            left = 0.0f;
+            break;
+        }
+
+        float t;
+        uint32_t corner = move_to_edge(wp, delta, target_weights, &t);
+        remaining *= (1.0f - t);
+        left *= (1.0f - t);
+
+        uint32_t next = neighbors[wp.triangle][corner];
+        if (next == -1U) break;  // boundary edge: the ray is blocked here
+
+        cross_edge(wp, corner, *this, next, shared_corner(*this, next, wp.triangle), remaining);
+    }
+
+    result.hit = (left > 0.0f);
+    result.distance = (1.0f - left) * length;
+    result.point = world_point(wp);
+    return result;
+}
+
+bool WalkMesh::line_of_sight(WalkPoint const &from, WalkPoint const &to) const {
+    glm::vec3 goal = world_point(to);
+    glm::vec3 step = goal - world_point(from);
+    Cast result = cast(from, step);
+    // (the cast may end just across an edge from 'to', so compare positions rather than triangles)
+    return !result.hit && glm::distance(result.point, goal) <= 1e-3f * (1.0f + glm::length(step));
+}
+
+void WalkMesh::cast(WalkPoints const &from, float const *step_x,
+                    float const *step_y, float const *step_z, Cast *casts) const {
+    size_t i = 0;
+
+#ifdef WALKMESH_SSE
+    // four lanes at a time: finish rays that end inside their starting
+    // triangle, and leave the rest for the scalar cast below:
+    __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= from.size(); i += 4) {
+        uint32_t t0 = from.triangle[i + 0], t1 = from.triangle[i + 1];
+        uint32_t t2 = from.triangle[i + 2], t3 = from.triangle[i + 3];
+        glm::mat3 const &f0 = triangle_frames[t0];
+        glm::mat3 const &f1 = triangle_frames[t1];
+        glm::mat3 const &f2 = triangle_frames[t2];
+        glm::mat3 const &f3 = triangle_frames[t3];
+        glm::vec3 const &n0 = triangle_normals[t0];
+        glm::vec3 const &n1 = triangle_normals[t1];
+        glm::vec3 const &n2 = triangle_normals[t2];
+        glm::vec3 const &n3 = triangle_normals[t3];
+
+        __m128 sx = _mm_loadu_ps(step_x + i);
+        __m128 sy = _mm_loadu_ps(step_y + i);
+        __m128 sz = _mm_loadu_ps(step_z + i);
+
+        // (same as in walk(WalkPoints &, ...))
+        #define TARGET(R, WEIGHT) \
+            _mm_add_ps(_mm_loadu_ps(WEIGHT + i), _mm_add_ps(_mm_add_ps( \
+                _mm_mul_ps(_mm_setr_ps(f0[0][R], f1[0][R], f2[0][R], f3[0][R]), sx), \
+                _mm_mul_ps(_mm_setr_ps(f0[1][R], f1[1][R], f2[1][R], f3[1][R]), sy)), \
+                _mm_mul_ps(_mm_setr_ps(f0[2][R], f1[2][R], f2[2][R], f3[2][R]), sz)))
+        __m128 tx = TARGET(0, from.weight_x.data());
+        __m128 ty = TARGET(1, from.weight_y.data());
+        __m128 tz = TARGET(2, from.weight_z.data());
+        #undef TARGET
+
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(tx, zero),
+                                   _mm_and_ps(_mm_cmpge_ps(ty, zero), _mm_cmpge_ps(tz, zero)));
+        int mask = _mm_movemask_ps(inside);
+
+        // in-plane length of each step, sqrt(|step|^2 - (normal . step)^2):
+        __m128 along_normal = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_setr_ps(n0.x, n1.x, n2.x, n3.x), sx),
+            _mm_mul_ps(_mm_setr_ps(n0.y, n1.y, n2.y, n3.y), sy)),
+            _mm_mul_ps(_mm_setr_ps(n0.z, n1.z, n2.z, n3.z), sz));
+        __m128 length2 = _mm_sub_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy)), _mm_mul_ps(sz, sz)),
+            _mm_mul_ps(along_normal, along_normal));
+        __m128 length = _mm_sqrt_ps(_mm_max_ps(length2, zero));
+
+        float target_x[4], target_y[4], target_z[4], lengths[4];
+        _mm_storeu_ps(target_x, tx);
+        _mm_storeu_ps(target_y, ty);
+        _mm_storeu_ps(target_z, tz);
+        _mm_storeu_ps(lengths, length);
+        for (uint32_t lane = 0; lane < 4; ++lane) {
+            Cast &result = casts[i + lane];
+            if (mask & (1 << lane)) {
+                result.hit = false;
+                result.distance = lengths[lane];
+                result.at.triangle = from.triangle[i + lane];
+                result.at.weights = glm::vec3(target_x[lane], target_y[lane], target_z[lane]);
+                result.point = world_point(result.at);
+            } else {
+                result = cast(from.get(i + lane), glm::vec3(step_x[i + lane], step_y[i + lane], step_z[i + lane]));
+            }
+        }
+    }
+#endif
+
+    // remaining rays (or all of them, without SSE):
+    for (; i < from.size(); ++i) {
+        casts[i] = cast(from.get(i), glm::vec3(step_x[i], step_y[i], step_z[i]));
     }
 }
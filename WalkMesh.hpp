@@ -1,52 +1,222 @@
 #pragma once
 
-#include <vector>
-#include <unordered_map>
+#include <glm/glm.hpp>
 
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
 
 struct WalkMesh {
+	//Read-only view of a contiguous array -- points either into this WalkMesh's 'storage' or into a memory-mapped cooked file:
+	template< typename T >
+	struct Array {
+		T const *ptr = nullptr;
+		size_t count = 0;
+
+		Array() = default;
+		Array(T const *ptr_, size_t count_) : ptr(ptr_), count(count_) { }
+		Array(std::vector< T > const &from) : ptr(from.data()), count(from.size()) { }
+
+		T const &operator[](size_t i) const { return ptr[i]; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		T const *data() const { return ptr; }
+		T const *begin() const { return ptr; }
+		T const *end() const { return ptr + count; }
+		T const &back() const { return ptr[count-1]; }
+	};
+
 	//Walk mesh will keep track of triangles, vertices:
-	std::vector< glm::vec3 > vertices;
-	std::vector< glm::uvec3 > triangles; //CCW-oriented
+	Array< glm::vec3 > vertices;
+	Array< glm::uvec3 > triangles; //CCW-oriented
 
-	//TODO: consider also loading vertex normals for interpolated "up" direction:
-    std::vector< glm::vec3 > vertex_normals;
+	//Per-triangle data computed at load time, so walking doesn't redo it every step:
+	Array< glm::vec3 > triangle_normals; //unit-length, CCW-facing
+	//triangle_frames[t] * step gives the change in barycentric weights caused by a (world-space) step;
+	// the step's out-of-plane component is ignored:
+	Array< glm::mat3 > triangle_frames;
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle, and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
+	//For each triangle, the triangle across the edge opposite each of its vertices (or -1U for boundary edges):
+	// i.e., neighbors[t][0] shares edge (triangles[t][1], triangles[t][2]) with t, and so on.
+	// (this is useful for checking what's over an edge from a given point -- it's a single indexed load)
+	Array< glm::uvec3 > neighbors;
 
+	//Bounding volume hierarchy over triangles, used by start() to find the closest triangle without visiting all of them:
+	struct BVHNode {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//for leaves, triangles are bvh_triangles[first,first+count);
+		//for interior nodes, count is zero, the first child is the next node, and 'first' is the index of the second child:
+		uint32_t first = 0;
+		uint32_t count = 0;
+	};
+	Array< BVHNode > bvh_nodes; //bvh_nodes[0] is the root (if there are any triangles)
+	Array< uint32_t > bvh_triangles; //indices into 'triangles', grouped by leaf
 
-	//Construct new WalkMesh and build next_vertex structure:
+	//Construct new WalkMesh:
+	// from a ".blob" (vtx0/nom0/lpi0 chunks, as written by export-walkmesh.py; the vertex normals are skipped) -- builds all the structures above;
+	// from a ".walkmesh" (as written by save_cooked) -- memory-maps the file and uses it in place, with no rebuilding.
+	// note: will throw if file fails to read or has an unknown extension.
     WalkMesh(std::string filename);
     WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::uvec3 > const &triangles_);
 
+	//The arrays above point into storage or mapping, so a WalkMesh can be moved but not copied:
+	WalkMesh(WalkMesh const &) = delete;
+	WalkMesh &operator=(WalkMesh const &) = delete;
+	WalkMesh(WalkMesh &&) = default;
+	WalkMesh &operator=(WalkMesh &&) = default;
+
+	//(re-)build the acceleration structures (normals, frames, neighbors, and bvh) in 'storage' from storage.vertices and storage.triangles:
+	// note: will throw if a triangle references a vertex that doesn't exist
+	// note: edges shared by more than two triangles (or by two triangles with inconsistent orientation) are treated as boundaries
+	void build();
+
+	//write a cooked (".walkmesh") file, which holds all of the above in a versioned, aligned layout that can be mapped and used directly:
+	void save_cooked(std::string const &filename) const;
+
+	//Cooked file layout:
+	// CookedHeader, then 'section_count' CookedSections, then section data (each section starts at a multiple of CookedAlignment)
+	// All values are little-endian (byte_order is written as 0x01020304 to check).
+	struct CookedHeader {
+		char magic[4] = {'w','l','k','m'};
+		uint32_t version = 1;
+		uint32_t byte_order = 0x01020304;
+		uint32_t section_count = 0;
+	};
+	static_assert(sizeof(CookedHeader) == 16, "CookedHeader is packed");
+	struct CookedSection {
+		char magic[4] = {'\0', '\0', '\0', '\0'}; //e.g. "vtx0"
+		uint32_t element_size = 0; //checked against sizeof() the element type on load
+		uint64_t offset = 0; //from start of file
+		uint64_t count = 0; //number of elements
+	};
+	static_assert(sizeof(CookedSection) == 24, "CookedSection is packed");
+	static constexpr uint32_t CookedAlignment = 64;
+
+	//------ backing memory for the arrays ------
+
+	//built (or loaded from a ".blob") meshes own their data:
+	struct Storage {
+		std::vector< glm::vec3 > vertices;
+		std::vector< glm::uvec3 > triangles;
+		std::vector< glm::vec3 > triangle_normals;
+		std::vector< glm::mat3 > triangle_frames;
+		std::vector< glm::uvec3 > neighbors;
+		std::vector< BVHNode > bvh_nodes;
+		std::vector< uint32_t > bvh_triangles;
+	} storage;
+
+	//cooked meshes reference a read-only memory mapping of the file:
+	struct Mapping {
+		void const *data = nullptr;
+		size_t size = 0;
+		#ifdef _WIN32
+		void *file = nullptr;
+		void *map = nullptr;
+		#endif
+
+		Mapping() = default;
+		Mapping(std::string const &filename); //throws on failure
+		Mapping(Mapping const &) = delete;
+		Mapping &operator=(Mapping const &) = delete;
+		Mapping(Mapping &&other);
+		Mapping &operator=(Mapping &&other);
+		~Mapping();
+		void unmap(); //(leaves an empty mapping)
+	} mapping;
+
 	struct WalkPoint {
-		glm::uvec3 triangle = glm::uvec3(-1U); //indices of current triangle
+		uint32_t triangle = -1U; //index of current triangle in 'triangles'
 		glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN()); //barycentric coordinates for current point
 	};
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (uses the bvh, so is cheap enough to call on every spawn; points need not be above the mesh)
+	// note: will throw if the mesh has no triangles
 	WalkPoint start(glm::vec3 const &world_point) const;
 
 	//used to update walk point:
+	// the step is projected onto the current triangle and carried (rotated) across edges into neighboring triangles;
+	// at boundary edges the remainder of the step slides along the edge.
 	void walk(WalkPoint &wp, glm::vec3 const &step) const;
 
+	//Structure-of-arrays storage for many walk points, advanced all at once by walk(WalkPoints &, ...):
+	struct WalkPoints {
+		std::vector< uint32_t > triangle;
+		std::vector< float > weight_x, weight_y, weight_z;
+
+		size_t size() const { return triangle.size(); }
+		void clear() {
+			triangle.clear();
+			weight_x.clear(); weight_y.clear(); weight_z.clear();
+		}
+		void push_back(WalkPoint const &wp) {
+			triangle.emplace_back(wp.triangle);
+			weight_x.emplace_back(wp.weights.x);
+			weight_y.emplace_back(wp.weights.y);
+			weight_z.emplace_back(wp.weights.z);
+		}
+		WalkPoint get(size_t i) const {
+			WalkPoint wp;
+			wp.triangle = triangle[i];
+			wp.weights = glm::vec3(weight_x[i], weight_y[i], weight_z[i]);
+			return wp;
+		}
+		void set(size_t i, WalkPoint const &wp) {
+			triangle[i] = wp.triangle;
+			weight_x[i] = wp.weights.x;
+			weight_y[i] = wp.weights.y;
+			weight_z[i] = wp.weights.z;
+		}
+	};
+
+	//used to update many walk points at once -- point i takes step (step_x[i], step_y[i], step_z[i]):
+	// (steps that stay inside their triangle are handled four-at-a-time with SSE where available;
+	//  steps that cross an edge fall back to walk(WalkPoint &, ...))
+	void walk(WalkPoints &points, float const *step_x, float const *step_y, float const *step_z) const;
+
+	//used to check what lies along the floor in a straight line from a walk point (for line of sight, hearing, AI):
+	// the ray is traced like a walk -- projected onto the starting triangle and carried across edges --
+	// but stops at the first boundary edge instead of sliding along it.
+	struct Cast {
+		bool hit = false; //did the ray stop at a boundary edge before covering all of 'step'?
+		float distance = 0.0f; //distance traveled along the floor
+		WalkPoint at; //where the ray stopped (at the boundary edge, or at the end of 'step')
+		glm::vec3 point = glm::vec3(0.0f); //world_point(at)
+	};
+	Cast cast(WalkPoint const &from, glm::vec3 const &step) const;
+
+	//true if nothing blocks a cast from 'from' to 'to' (on floors that bend, 'to' must also be where the cast ends up):
+	bool line_of_sight(WalkPoint const &from, WalkPoint const &to) const;
+
+	//used to cast many rays at once -- ray i starts at 'from' point i with step (step_x[i], step_y[i], step_z[i]):
+	// (rays that end inside their starting triangle are handled four-at-a-time with SSE where available)
+	void cast(WalkPoints const &from, float const *step_x, float const *step_y, float const *step_z, Cast *casts) const;
+
+	//------ walking internals (shared with TiledWalkMesh, which walks across several meshes) ------
+
+	//move 'wp' to the first edge it reaches along the change in weights 'delta' (given that wp.weights + delta = 'target_weights' is outside the triangle):
+	// returns the corner opposite that edge, and sets *t to the fraction of 'delta' used
+	static uint32_t move_to_edge(WalkPoint &wp, glm::vec3 const &delta, glm::vec3 const &target_weights, float *t);
+
+	//move 'wp' (on the edge opposite 'corner') over to triangle 'next' of 'next_mesh' -- whose edge opposite 'next_corner' is the same edge -- and rotate 'step' to match:
+	void cross_edge(WalkPoint &wp, uint32_t corner, WalkMesh const &next_mesh, uint32_t next, uint32_t next_corner, glm::vec3 &step) const;
+
+	//the part of 'step' along the edge opposite 'corner' of wp's triangle:
+	glm::vec3 slide_along_edge(WalkPoint const &wp, uint32_t corner, glm::vec3 const &step) const;
+
 	//used to read back results of walking:
 	glm::vec3 world_point(WalkPoint const &wp) const {
-		return wp.weights.x * vertices[wp.triangle.x]
-		     + wp.weights.y * vertices[wp.triangle.y]
-		     + wp.weights.z * vertices[wp.triangle.z];
+		glm::uvec3 const &tri = triangles[wp.triangle];
+		return wp.weights.x * vertices[tri.x]
+		     + wp.weights.y * vertices[tri.y]
+		     + wp.weights.z * vertices[tri.z];
 	}
 
+	//(the normal of the triangle the point is on -- so it changes abruptly at edges between triangles)
 	glm::vec3 world_normal(WalkPoint const &wp) const {
-		//TODO: could interpolate vertex_normals instead of computing the triangle normal:
-        return glm::normalize(vertex_normals[wp.triangle[0]] * wp.weights[0] +
-                              vertex_normals[wp.triangle[1]] * wp.weights[1] +
-                              vertex_normals[wp.triangle[2]] * wp.weights[2]);
-
+		return triangle_normals[wp.triangle];
 	}
 
 };
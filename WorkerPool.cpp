@@ -0,0 +1,67 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t threads_) : threads(threads_), next_index(0) {
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	for (uint32_t i = 1; i < threads; ++i) {
+		workers.emplace_back(&WorkerPool::worker_main, this);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	start_cv.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void WorkerPool::parallel_for(uint32_t count, std::function< void(uint32_t) > const &fn) {
+	//not worth waking anyone:
+	if (workers.empty() || count <= 1) {
+		for (uint32_t i = 0; i < count; ++i) fn(i);
+		return;
+	}
+
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		job = &fn;
+		job_count = count;
+		next_index = 0;
+		busy = uint32_t(workers.size());
+		++job_generation;
+	}
+	start_cv.notify_all();
+
+	run_job();
+
+	std::unique_lock< std::mutex > lock(mutex);
+	done_cv.wait(lock, [this](){ return busy == 0; });
+	job = nullptr;
+}
+
+void WorkerPool::run_job() {
+	for (uint32_t i = next_index++; i < job_count; i = next_index++) {
+		(*job)(i);
+	}
+}
+
+void WorkerPool::worker_main() {
+	uint32_t seen_generation = 0;
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		start_cv.wait(lock, [&](){ return quit || job_generation != seen_generation; });
+		if (quit) break;
+		seen_generation = job_generation;
+
+		lock.unlock();
+		run_job();
+		lock.lock();
+
+		if (--busy == 0) done_cv.notify_one();
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+//"WorkerPool" keeps a set of threads around for splitting per-frame work across cores:
+//
+// WorkerPool pool(4); //the calling thread plus three workers
+// pool.parallel_for(chunk_count, [&](uint32_t chunk){
+//     //...process chunk...
+// });
+//
+//parallel_for() returns once every index has been processed.
+//Which thread processes an index varies from call to call, so work should be split such that the result doesn't depend on it.
+
+struct WorkerPool {
+	//threads == 0 means one per hardware thread:
+	WorkerPool(uint32_t threads);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//threads working on parallel_for() (including the caller):
+	uint32_t threads = 1;
+
+	//call fn(0) ... fn(count-1) across the pool; blocks until all calls return:
+	// note: fn must not throw
+	// note: parallel_for() isn't re-entrant; only call it from one thread at a time
+	void parallel_for(uint32_t count, std::function< void(uint32_t) > const &fn);
+
+	//------ internals ------
+
+	std::mutex mutex;
+	std::condition_variable start_cv; //workers wait here for a new job
+	std::condition_variable done_cv; //parallel_for waits here for workers to finish
+	std::function< void(uint32_t) > const *job = nullptr;
+	uint32_t job_count = 0;
+	uint32_t job_generation = 0; //incremented for each job, so workers can tell a new one has started
+	uint32_t busy = 0; //workers still working on the current job
+	bool quit = false;
+	std::atomic< uint32_t > next_index;
+
+	std::vector< std::thread > workers;
+	void worker_main();
+	void run_job(); //take indices from the current job until there are none left
+};
@@ -0,0 +1,46 @@
+#include "benchmark.hpp"
+
+#include <iostream>
+#include <list>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+	std::list< std::pair< std::string, std::function< void() > > > &get_benchmarks() {
+		static std::list< std::pair< std::string, std::function< void() > > > benchmarks;
+		return benchmarks;
+	}
+}
+
+Benchmark::Benchmark(std::string const &name, std::function< void() > const &fn) {
+	get_benchmarks().emplace_back(name, fn);
+}
+
+int main(int argc, char **argv) {
+	uint32_t ran = 0;
+	for (auto const &benchmark : get_benchmarks()) {
+		bool selected = (argc <= 1);
+		for (int i = 1; i < argc; ++i) {
+			if (benchmark.first.find(argv[i]) != std::string::npos) selected = true;
+		}
+		if (!selected) continue;
+
+		std::cout << "---- " << benchmark.first << " ----" << std::endl;
+		try {
+			benchmark.second();
+		} catch (std::exception &e) {
+			std::cerr << "ERROR: benchmark '" << benchmark.first << "' threw: " << e.what() << std::endl;
+			return 1;
+		}
+		++ran;
+	}
+
+	if (ran == 0) {
+		std::cerr << "No benchmarks matched. Available benchmarks:" << std::endl;
+		for (auto const &benchmark : get_benchmarks()) {
+			std::cerr << "  " << benchmark.first << std::endl;
+		}
+		return 1;
+	}
+	return 0;
+}
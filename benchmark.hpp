@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * A Benchmark registers a named, headless timing function with the 'benchmark' executable.
+ *
+ * Benchmarks are declared at global scope, much like Load< T >:
+ *
+ * Benchmark walkmesh_start("walkmesh-start", [](){
+ *     BenchmarkTimer timer;
+ *     //...do some work...
+ *     std::cout << "took " << timer.elapsed() * 1000.0 << "ms" << std::endl;
+ * });
+ *
+ * Running 'benchmark' with no arguments runs every registered benchmark;
+ * otherwise only those whose names contain one of the arguments are run.
+ *
+ * Build with optimization for meaningful numbers (e.g., 'jam -sOPTIM=-O2 benchmark').
+ */
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+struct Benchmark {
+	Benchmark(std::string const &name, std::function< void() > const &fn);
+};
+
+//BenchmarkTimer measures wall-clock time since its construction (or last reset):
+struct BenchmarkTimer {
+	std::chrono::high_resolution_clock::time_point before = std::chrono::high_resolution_clock::now();
+
+	void reset() { before = std::chrono::high_resolution_clock::now(); }
+
+	//seconds since construction or reset:
+	double elapsed() const {
+		return std::chrono::duration< double >(std::chrono::high_resolution_clock::now() - before).count();
+	}
+};
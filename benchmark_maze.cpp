@@ -0,0 +1,68 @@
+#include "benchmark.hpp"
+#include "Maze.hpp"
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+//Generates a million-cell maze with different numbers of threads:
+// (the results must not depend on the thread count, so each run is checked against the single-threaded one)
+Benchmark maze_generate("maze-generate", [](){
+	uint32_t const side = 1000;
+	std::vector< uint32_t > thread_counts = {1, 2, 4};
+	uint32_t hardware = std::thread::hardware_concurrency();
+	if (hardware > 4) thread_counts.emplace_back(hardware);
+
+	std::vector< uint8_t > reference_cells;
+	std::vector< glm::uvec3 > reference_triangles;
+	size_t reference_walls = 0;
+	double single = 0.0;
+	for (uint32_t threads : thread_counts) {
+		BenchmarkTimer carve_timer;
+		Maze maze(side, side, 0x3a2e, threads);
+		double carve = carve_timer.elapsed();
+
+		std::vector< glm::vec3 > vertices;
+		std::vector< glm::uvec3 > triangles;
+		BenchmarkTimer walkmesh_timer;
+		maze.make_walkmesh(&vertices, &triangles);
+		double walkmesh = walkmesh_timer.elapsed();
+
+		std::vector< char > strings;
+		std::vector< Maze::TransformEntry > transforms;
+		std::vector< Maze::SceneMeshEntry > meshes;
+		BenchmarkTimer scene_timer;
+		maze.make_scene(&strings, &transforms, &meshes);
+		double scene = scene_timer.elapsed();
+
+		double total = carve + walkmesh + scene;
+		if (threads == 1) {
+			single = total;
+			reference_cells = maze.cells;
+			reference_triangles = triangles;
+			reference_walls = meshes.size();
+		} else if (maze.cells != reference_cells || triangles != reference_triangles || meshes.size() != reference_walls) {
+			throw std::runtime_error("Maze generated with " + std::to_string(threads) + " threads differs from single-threaded maze.");
+		}
+
+		std::cout << side << "x" << side << " cells, " << threads << " threads: "
+			<< "carve " << carve * 1e3 << "ms, "
+			<< "walkmesh " << walkmesh * 1e3 << "ms (" << triangles.size() << " triangles), "
+			<< "scene " << scene * 1e3 << "ms (" << transforms.size() << " transforms), "
+			<< "total " << total * 1e3 << "ms (" << single / total << "x)" << std::endl;
+	}
+
+	//(building the walk mesh's acceleration structures is serial, for reference:)
+	Maze maze(side, side, 0x3a2e);
+	std::vector< glm::vec3 > vertices;
+	std::vector< glm::uvec3 > triangles;
+	maze.make_walkmesh(&vertices, &triangles);
+	BenchmarkTimer build_timer;
+	WalkMesh mesh(vertices, triangles);
+	std::cout << "WalkMesh build " << build_timer.elapsed() * 1e3 << "ms ("
+		<< mesh.vertices.size() << " vertices, " << mesh.bvh_nodes.size() << " bvh nodes)" << std::endl;
+});
@@ -0,0 +1,1463 @@
+#include "benchmark.hpp"
+#include "Scene.hpp"
+#include "Maze.hpp"
+#include "CellVisibility.hpp"
+#include "data_path.hpp"
+#include "read_chunk.hpp"
+#include "write_chunk.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Builds 'count' transforms in deep hierarchies (no transform is more than 'max_depth' below its root):
+static std::vector< Scene::Transform * > make_hierarchy(Scene &scene, uint32_t count, uint32_t max_depth) {
+	std::mt19937 mt(0x5ce7e);
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+	std::vector< Scene::Transform * > transforms;
+	std::vector< uint32_t > depths;
+	transforms.reserve(count);
+	depths.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		Scene::Transform *t = scene.new_transform();
+		t->set_position(glm::vec3(unit(mt), unit(mt), unit(mt)));
+		t->set_rotation(glm::normalize(glm::quat(unit(mt), unit(mt), unit(mt), unit(mt))));
+		t->set_scale(glm::vec3(1.0f + 0.1f * unit(mt)));
+		//mostly extend one of the last few transforms, which makes long chains with some branching:
+		uint32_t depth = 0;
+		if (i > 0 && mt() % 64 != 0) {
+			uint32_t p = i - 1 - mt() % std::min(i, 4U);
+			if (depths[p] < max_depth) {
+				t->set_parent(transforms[p]);
+				depth = depths[p] + 1;
+			}
+		}
+		transforms.emplace_back(t);
+		depths.emplace_back(depth);
+	}
+	return transforms;
+}
+
+//What make_local_to_world() did before world matrices were cached:
+static glm::mat4 uncached_local_to_world(Scene::Transform const *t) {
+	if (t->parent) {
+		return uncached_local_to_world(t->parent) * t->make_local_to_parent();
+	} else {
+		return t->make_local_to_parent();
+	}
+}
+
+Benchmark scene_world_matrices("scene-world-matrices", [](){
+	uint32_t const count = 100000;
+	uint32_t const max_depth = 20;
+	Scene scene;
+	std::vector< Scene::Transform * > transforms = make_hierarchy(scene, count, max_depth);
+
+	double average_depth = 0.0;
+	for (auto t : transforms) {
+		for (Scene::Transform const *p = t->parent; p; p = p->parent) average_depth += 1.0;
+	}
+	average_depth /= count;
+
+	std::mt19937 mt(0xd1e7);
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+
+	//every transform's matrix, once per "frame":
+	auto frame = [&transforms]() {
+		float sum = 0.0f;
+		for (auto t : transforms) sum += t->make_local_to_world()[3].x;
+		return sum;
+	};
+
+	uint32_t const frames = 10;
+
+	BenchmarkTimer uncached_timer;
+	float uncached_sum = 0.0f;
+	for (uint32_t f = 0; f < frames; ++f) {
+		for (auto t : transforms) uncached_sum += uncached_local_to_world(t)[3].x;
+	}
+	double uncached = uncached_timer.elapsed() / frames;
+
+	//nothing moves:
+	frame();
+	BenchmarkTimer static_timer;
+	float static_sum = 0.0f;
+	for (uint32_t f = 0; f < frames; ++f) static_sum += frame();
+	double unchanged = static_timer.elapsed() / frames;
+
+	//some transforms move every frame (which dirties their subtrees):
+	auto moving = [&](float fraction) {
+		uint32_t moved = std::max(1U, uint32_t(fraction * count));
+		BenchmarkTimer timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (uint32_t m = 0; m < moved; ++m) {
+				Scene::Transform *t = transforms[mt() % count];
+				t->set_position(t->position + 0.01f * glm::vec3(unit(mt), unit(mt), unit(mt)));
+			}
+			frame();
+		}
+		return timer.elapsed() / frames;
+	};
+	double moving_001 = moving(0.001f);
+	double moving_01 = moving(0.01f);
+	double moving_10 = moving(0.1f);
+
+	//check cached matrices against recomputed ones:
+	float max_error = 0.0f;
+	for (auto t : transforms) {
+		glm::mat4 const &cached = t->make_local_to_world();
+		glm::mat4 expected = uncached_local_to_world(t);
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 4; ++r) {
+				max_error = std::max(max_error, std::abs(cached[c][r] - expected[c][r]));
+			}
+		}
+	}
+
+	std::cout << count << " transforms (average depth " << average_depth << ", max " << max_depth << "), per frame: "
+		<< "uncached " << uncached * 1e3 << "ms, "
+		<< "cached/unchanged " << unchanged * 1e3 << "ms (" << uncached / unchanged << "x), "
+		<< "0.1% moving " << moving_001 * 1e3 << "ms, "
+		<< "1% moving " << moving_01 * 1e3 << "ms, "
+		<< "10% moving " << moving_10 * 1e3 << "ms; "
+		<< "max error " << max_error << " "
+		<< "[checksum " << uncached_sum / frames + static_sum / frames << "]" << std::endl;
+});
+
+//The same hierarchy with transforms stored by pointer and stored flat:
+Benchmark scene_flat_transforms("scene-flat-transforms", [](){
+	uint32_t const count = 100000;
+	uint32_t const max_depth = 20;
+	uint32_t const frames = 10;
+
+	for (bool flat : {false, true}) {
+		Scene scene;
+		std::vector< Scene::Transform * > transforms = make_hierarchy(scene, count, max_depth);
+		std::vector< Scene::Transform * > roots;
+		for (auto t : transforms) {
+			if (!t->parent) roots.emplace_back(t);
+		}
+
+		BenchmarkTimer convert_timer;
+		scene.set_flat_transforms(flat);
+		scene.update_world_matrices();
+		double convert = convert_timer.elapsed();
+
+		std::mt19937 mt(0xf1a7);
+		std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+
+		//every transform's matrix, once per "frame":
+		float sum = 0.0f;
+		auto frame = [&]() {
+			scene.update_world_matrices();
+			for (auto t : transforms) sum += t->make_local_to_world()[3].x;
+		};
+		auto move = [&](Scene::Transform *t) {
+			t->set_position(t->position + 0.01f * glm::vec3(unit(mt), unit(mt), unit(mt)));
+		};
+
+		BenchmarkTimer unchanged_timer;
+		for (uint32_t f = 0; f < frames; ++f) frame();
+		double unchanged = unchanged_timer.elapsed() / frames;
+
+		BenchmarkTimer moving_timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (uint32_t m = 0; m < count / 100; ++m) move(transforms[mt() % count]);
+			frame();
+		}
+		double moving = moving_timer.elapsed() / frames;
+
+		//(moving every root dirties everything)
+		BenchmarkTimer all_timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (auto r : roots) move(r);
+			frame();
+		}
+		double all = all_timer.elapsed() / frames;
+
+		//move some subtrees under other roots:
+		BenchmarkTimer reparent_timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (uint32_t m = 0; m < count / 1000; ++m) {
+				Scene::Transform *t = transforms[mt() % count];
+				Scene::Transform *r = roots[mt() % roots.size()];
+				if (t != r) t->set_parent(r);
+			}
+			frame();
+		}
+		double reparent = reparent_timer.elapsed() / frames;
+
+		//one transform moves and its matrix is read right away (e.g., a camera following the player):
+		uint32_t const singles = 1000;
+		float single_sum = 0.0f;
+		BenchmarkTimer single_timer;
+		for (uint32_t m = 0; m < singles; ++m) {
+			Scene::Transform *t = transforms[mt() % count];
+			move(t);
+			single_sum += t->make_local_to_world()[3].x;
+		}
+		double single = single_timer.elapsed() / singles;
+		sum += single_sum;
+
+		//check against recomputed matrices:
+		float max_error = 0.0f;
+		for (auto t : transforms) {
+			glm::mat4 const &cached = t->make_local_to_world();
+			glm::mat4 expected = uncached_local_to_world(t);
+			for (uint32_t c = 0; c < 4; ++c) {
+				for (uint32_t r = 0; r < 4; ++r) {
+					max_error = std::max(max_error, std::abs(cached[c][r] - expected[c][r]));
+				}
+			}
+		}
+
+		std::cout << count << " transforms, " << (flat ? "flat" : "pointers") << ", per frame: "
+			<< "unchanged " << unchanged * 1e3 << "ms, "
+			<< "1% moving " << moving * 1e3 << "ms, "
+			<< "all moving " << all * 1e3 << "ms, "
+			<< "0.1% reparented " << reparent * 1e3 << "ms; "
+			<< "single move " << single * 1e6 << "us, "
+			<< "conversion " << convert * 1e3 << "ms, "
+			<< "max error " << max_error << " "
+			<< "[checksum " << sum / frames << "]" << std::endl;
+	}
+});
+
+//Flat transform updates split across threads:
+// (every run must produce exactly the same matrices as the single-threaded one)
+Benchmark scene_update_threads("scene-update-threads", [](){
+	uint32_t const count = 1000000;
+	uint32_t const max_depth = 20;
+	uint32_t const frames = 10;
+
+	Scene scene;
+	std::vector< Scene::Transform * > transforms = make_hierarchy(scene, count, max_depth);
+	std::vector< Scene::Transform * > roots;
+	for (auto t : transforms) {
+		if (!t->parent) roots.emplace_back(t);
+	}
+	std::vector< glm::vec3 > start_positions;
+	for (auto t : transforms) start_positions.emplace_back(t->position);
+	scene.set_flat_transforms(true);
+	scene.update_world_matrices();
+
+	std::vector< uint32_t > thread_counts = {1, 2, 4};
+	uint32_t hardware = std::thread::hardware_concurrency();
+	if (hardware > 4) thread_counts.emplace_back(hardware);
+
+	std::vector< glm::mat4 > reference;
+	double single = 0.0;
+	for (uint32_t threads : thread_counts) {
+		scene.set_update_threads(threads);
+
+		//same starting point and motion for every thread count:
+		for (uint32_t i = 0; i < count; ++i) transforms[i]->set_position(start_positions[i]);
+		std::mt19937 mt(0x7a5c);
+		std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+
+		double all = 0.0, some = 0.0;
+		for (uint32_t f = 0; f < frames; ++f) {
+			//(moving every root dirties everything)
+			for (auto r : roots) r->set_position(r->position + 0.01f * glm::vec3(unit(mt), unit(mt), unit(mt)));
+			BenchmarkTimer all_timer;
+			scene.update_world_matrices();
+			all += all_timer.elapsed();
+
+			for (uint32_t m = 0; m < count / 100; ++m) {
+				Scene::Transform *t = transforms[mt() % count];
+				t->set_position(t->position + 0.01f * glm::vec3(unit(mt), unit(mt), unit(mt)));
+			}
+			BenchmarkTimer some_timer;
+			scene.update_world_matrices();
+			some += some_timer.elapsed();
+		}
+		all /= frames;
+		some /= frames;
+
+		uint32_t mismatches = 0;
+		if (threads == 1) {
+			single = all;
+			reference = scene.flat_transforms.local_to_world;
+		} else {
+			for (uint32_t i = 0; i < reference.size(); ++i) {
+				if (std::memcmp(&reference[i], &scene.flat_transforms.local_to_world[i], sizeof(glm::mat4)) != 0) ++mismatches;
+			}
+		}
+
+		std::cout << count << " transforms (" << roots.size() << " roots, "
+			<< std::max< size_t >(scene.flat_transforms.chunks.size(), 2) - 1 << " chunks), " << threads << " threads, per frame: "
+			<< "all moving " << all * 1e3 << "ms (" << single / all << "x), "
+			<< "1% moving " << some * 1e3 << "ms, "
+			<< mismatches << " mismatches" << std::endl;
+		if (mismatches) {
+			throw std::runtime_error("Transform update with " + std::to_string(threads) + " threads doesn't match single-threaded update.");
+		}
+	}
+});
+
+//Per-object matrix preparation (world matrix + normal matrix), as Scene::draw does it,
+// with a few transforms scaled non-uniformly:
+Benchmark scene_normal_matrices("scene-normal-matrices", [](){
+	uint32_t const count = 100000;
+	uint32_t const max_depth = 20;
+	uint32_t const frames = 10;
+
+	for (bool flat : {false, true}) {
+		Scene scene;
+		std::vector< Scene::Transform * > transforms = make_hierarchy(scene, count, max_depth);
+		std::mt19937 mt(0x17a5);
+		std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+		for (uint32_t m = 0; m < count / 1000; ++m) {
+			Scene::Transform *t = transforms[mt() % count];
+			t->set_scale(glm::vec3(1.0f + 0.5f * unit(mt), 1.0f + 0.5f * unit(mt), 1.0f + 0.5f * unit(mt)));
+		}
+		scene.set_flat_transforms(flat);
+		scene.update_world_matrices();
+
+		uint32_t non_uniform = 0;
+		for (auto t : transforms) {
+			for (Scene::Transform const *p = t; p; p = p->parent) {
+				if (!p->has_uniform_scale()) {
+					++non_uniform;
+					break;
+				}
+			}
+		}
+
+		//what Scene::draw used to do -- invert every object's matrix every frame:
+		float sum = 0.0f;
+		auto inverted = [&]() {
+			scene.update_world_matrices();
+			for (auto t : transforms) {
+				glm::mat4 const &local_to_world = t->make_local_to_world();
+				glm::mat3 normal_to_world = glm::inverse(glm::transpose(glm::mat3(local_to_world)));
+				sum += local_to_world[3].x + normal_to_world[0].x;
+			}
+		};
+		auto prepared = [&]() {
+			scene.update_world_matrices();
+			for (auto t : transforms) {
+				glm::mat4 const &local_to_world = t->make_local_to_world();
+				glm::mat3 normal_to_world = t->make_normal_to_world();
+				sum += local_to_world[3].x + normal_to_world[0].x;
+			}
+		};
+		auto move = [&]() {
+			for (uint32_t m = 0; m < count / 100; ++m) {
+				Scene::Transform *t = transforms[mt() % count];
+				t->set_position(t->position + 0.01f * glm::vec3(unit(mt), unit(mt), unit(mt)));
+			}
+		};
+		auto time = [&](std::function< void() > const &frame, bool moving) {
+			double total = 0.0;
+			for (uint32_t f = 0; f < frames; ++f) {
+				if (moving) move();
+				BenchmarkTimer timer;
+				frame();
+				total += timer.elapsed();
+			}
+			return total / frames;
+		};
+
+		double inverted_unchanged = time(inverted, false);
+		double prepared_unchanged = time(prepared, false);
+		double inverted_moving = time(inverted, true);
+		double prepared_moving = time(prepared, true);
+
+		//check against inverting directly:
+		float max_error = 0.0f;
+		for (auto t : transforms) {
+			glm::mat3 expected = glm::inverse(glm::transpose(glm::mat3(t->make_local_to_world())));
+			glm::mat3 normal_to_world = t->make_normal_to_world();
+			for (uint32_t c = 0; c < 3; ++c) {
+				for (uint32_t r = 0; r < 3; ++r) {
+					float scale = std::max(1.0f, std::abs(expected[c][r]));
+					max_error = std::max(max_error, std::abs(normal_to_world[c][r] - expected[c][r]) / scale);
+				}
+			}
+		}
+
+		std::cout << count << " transforms (" << non_uniform << " scaled non-uniformly), " << (flat ? "flat" : "pointers") << ", per frame: "
+			<< "unchanged " << inverted_unchanged * 1e3 << "ms inverting vs. " << prepared_unchanged * 1e3 << "ms ("
+			<< inverted_unchanged / prepared_unchanged << "x), "
+			<< "1% moving " << inverted_moving * 1e3 << "ms vs. " << prepared_moving * 1e3 << "ms ("
+			<< inverted_moving / prepared_moving << "x); "
+			<< "max relative error " << max_error << " "
+			<< "[checksum " << sum / (4 * frames) << "]" << std::endl;
+		if (max_error > 1e-3f) {
+			throw std::runtime_error("Prepared normal matrices don't match inverted ones.");
+		}
+	}
+});
+
+//Building and tearing down a scene with a million transforms (and an object on each):
+Benchmark scene_allocation("scene-allocation", [](){
+	uint32_t const count = 1000000;
+
+	//what Scene used to do -- a separate allocation per transform and object:
+	double separate_build, separate_destroy;
+	{
+		std::vector< Scene::Transform * > transforms;
+		std::vector< Scene::Object * > objects;
+		transforms.reserve(count);
+		objects.reserve(count);
+		BenchmarkTimer build_timer;
+		for (uint32_t i = 0; i < count; ++i) {
+			transforms.emplace_back(new Scene::Transform);
+			if (i > 0 && i % 16 != 0) transforms.back()->set_parent(transforms[i-1]);
+			objects.emplace_back(new Scene::Object(transforms.back()));
+		}
+		separate_build = build_timer.elapsed();
+		BenchmarkTimer destroy_timer;
+		for (auto o : objects) delete o;
+		for (auto t = transforms.rbegin(); t != transforms.rend(); ++t) delete *t;
+		separate_destroy = destroy_timer.elapsed();
+	}
+
+	double build, iterate, churn, destroy;
+	size_t transform_slabs, object_slabs, churn_slabs;
+	{
+		BenchmarkTimer build_timer;
+		std::unique_ptr< Scene > scene(new Scene);
+		std::vector< Scene::Transform * > transforms;
+		transforms.reserve(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			transforms.emplace_back(scene->new_transform());
+			if (i > 0 && i % 16 != 0) transforms.back()->set_parent(transforms[i-1]);
+			scene->new_object(transforms.back());
+		}
+		build = build_timer.elapsed();
+		transform_slabs = scene->transforms.slab_count();
+		object_slabs = scene->objects.slab_count();
+
+		//(the same traversal as draw, minus the OpenGL calls)
+		BenchmarkTimer iterate_timer;
+		uint32_t total = 0;
+		scene->objects.for_each([&](Scene::Object *object){
+			total += object->count + (object->transform->parent ? 1 : 0);
+		});
+		iterate = iterate_timer.elapsed();
+		if (total == 0) std::cout << "(no parents?)" << std::endl;
+
+		//deleted objects' slots are reused:
+		std::vector< Scene::Object * > churned;
+		scene->objects.for_each([&](Scene::Object *object){
+			if (churned.size() < count / 2) churned.emplace_back(object);
+		});
+		BenchmarkTimer churn_timer;
+		for (auto o : churned) scene->delete_object(o);
+		for (uint32_t i = 0; i < count / 2; ++i) scene->new_object(transforms[i]);
+		churn = churn_timer.elapsed();
+		churn_slabs = scene->objects.slab_count();
+
+		BenchmarkTimer destroy_timer;
+		scene.reset();
+		destroy = destroy_timer.elapsed();
+	}
+
+	std::cout << count << " transforms + objects: "
+		<< "separate allocations " << 2 * count << " (build " << separate_build * 1e3 << "ms, destroy " << separate_destroy * 1e3 << "ms); "
+		<< "pooled allocations " << transform_slabs + object_slabs << " slabs "
+		<< "(build " << build * 1e3 << "ms, destroy " << destroy * 1e3 << "ms); "
+		<< "iterate objects " << iterate * 1e3 << "ms; "
+		<< "delete+create half " << churn * 1e3 << "ms (object slabs " << object_slabs << " -> " << churn_slabs << ")" << std::endl;
+});
+
+//Fill 'scene' with a generated 'size' x 'size' maze (one object per wall) and return a camera standing in the middle of it:
+// (objects use made-up program and vertex array names, as if drawn with vertex_color_program / vertex_color_program_instanced;
+//  the floor and walls are marked static, with their vertices in '*mesh_buffer'; occlusion culling starts off)
+static Scene::Camera *make_maze_scene(Scene &scene, uint32_t size, std::unique_ptr< MeshBuffer > *mesh_buffer) {
+	assert(mesh_buffer);
+	Maze maze(size, size, 1);
+
+	{ //meshes, without OpenGL:
+		std::vector< Maze::Vertex > vertices;
+		std::vector< char > mesh_strings;
+		std::vector< Maze::MeshEntry > index;
+		maze.make_meshes(&vertices, &mesh_strings, &index);
+
+		MeshBuffer format;
+		format.Position = MeshBuffer::Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Maze::Vertex), offsetof(Maze::Vertex, Position));
+		format.Normal = MeshBuffer::Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Maze::Vertex), offsetof(Maze::Vertex, Normal));
+		format.Color = MeshBuffer::Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Maze::Vertex), offsetof(Maze::Vertex, Color));
+		std::map< std::string, MeshBuffer::Mesh > meshes;
+		for (auto const &entry : index) {
+			MeshBuffer::Mesh mesh;
+			mesh.start = entry.vertex_begin;
+			mesh.count = entry.vertex_end - entry.vertex_begin;
+			meshes.insert(std::make_pair(std::string(&mesh_strings[0] + entry.name_begin, &mesh_strings[0] + entry.name_end), mesh));
+		}
+		std::vector< uint8_t > data(reinterpret_cast< uint8_t const * >(vertices.data()), reinterpret_cast< uint8_t const * >(vertices.data() + vertices.size()));
+		mesh_buffer->reset(new MeshBuffer(format, std::move(data), meshes));
+	}
+
+	std::vector< char > strings;
+	std::vector< Maze::TransformEntry > transform_entries;
+	std::vector< Maze::SceneMeshEntry > mesh_entries;
+	maze.make_scene(&strings, &transform_entries, &mesh_entries);
+
+	scene.set_flat_transforms(true);
+	scene.occlusion_culling = false; //(so that other benchmarks measure only what they are about; see scene-occlusion)
+
+	std::vector< Scene::Transform * > transforms;
+	transforms.reserve(transform_entries.size());
+	for (auto const &entry : transform_entries) {
+		Scene::Transform *t = scene.new_transform();
+		if (entry.parent_ref >= 0) t->set_parent(transforms.at(entry.parent_ref));
+		t->set_position(entry.position);
+		t->set_rotation(glm::quat(entry.rotation.w, entry.rotation.x, entry.rotation.y, entry.rotation.z));
+		t->set_scale(entry.scale);
+		transforms.emplace_back(t);
+	}
+
+	auto attach = [&](Scene::Transform *t, std::string const &name) {
+		MeshBuffer::Mesh const &mesh = (*mesh_buffer)->lookup(name);
+		Scene::Object *object = scene.new_object(t);
+		object->start = mesh.start;
+		object->count = mesh.count;
+		object->program = 1;
+		object->program_mvp_mat4 = 0;
+		object->program_mv_mat4x3 = 1;
+		object->program_itmv_mat3 = 2;
+		object->vao = 1;
+		object->instanced.program = 2;
+		object->instanced.vao = 2;
+		object->instanced.world_to_clip_mat4 = 0;
+		object->instanced.instance_offset_int = 1;
+		object->bounds_min = mesh.min;
+		object->bounds_max = mesh.max;
+		object->bounds_center = mesh.center;
+		object->bounds_radius = mesh.radius;
+		object->mesh_buffer = mesh_buffer->get();
+		object->is_static = (name != "Monster");
+	};
+	for (auto const &entry : mesh_entries) {
+		attach(transforms.at(entry.transform_ref), std::string(&strings[0] + entry.name_begin, &strings[0] + entry.name_end));
+	}
+
+	//camera at eye height in the middle of the maze, looking along +y:
+	Scene::Transform *eye = scene.new_transform();
+	eye->set_position(glm::vec3(0.5f * maze.width * Maze::CellSize, 0.5f * maze.height * Maze::CellSize, 1.7f));
+	eye->set_rotation(glm::angleAxis(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+	Scene::Camera *camera = scene.new_camera(eye);
+	camera->aspect = 16.0f / 9.0f;
+	return camera;
+}
+
+//Flat transform updates split across threads, on a generated maze:
+// (every wall hangs off the one "Maze" transform, so the work can only be split below it)
+Benchmark scene_maze_update_threads("scene-maze-update-threads", [](){
+	uint32_t const size = 500;
+	uint32_t const frames = 10;
+
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	make_maze_scene(scene, size, &mesh_buffer);
+	scene.update_world_matrices();
+
+	Scene::Transform *root = nullptr;
+	for (auto t : scene.flat_transforms.handles) {
+		if (t && !t->parent && t->last_child) {
+			root = t;
+			break;
+		}
+	}
+	if (!root) throw std::runtime_error("Maze scene has no root with children.");
+	glm::vec3 start = root->position;
+
+	std::vector< uint32_t > thread_counts = {1, 2, 4};
+	uint32_t hardware = std::thread::hardware_concurrency();
+	if (hardware > 4) thread_counts.emplace_back(hardware);
+
+	std::vector< glm::mat4 > reference;
+	double single = 0.0;
+	for (uint32_t threads : thread_counts) {
+		scene.set_update_threads(threads);
+		root->set_position(start);
+		scene.update_world_matrices();
+
+		//(moving the root dirties everything)
+		BenchmarkTimer timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			root->set_position(start + glm::vec3(0.01f * (f + 1), 0.0f, 0.0f));
+			scene.update_world_matrices();
+		}
+		double all = timer.elapsed() / frames;
+
+		uint32_t mismatches = 0;
+		if (threads == 1) {
+			single = all;
+			reference = scene.flat_transforms.local_to_world;
+		} else {
+			for (uint32_t i = 0; i < reference.size(); ++i) {
+				if (std::memcmp(&reference[i], &scene.flat_transforms.local_to_world[i], sizeof(glm::mat4)) != 0) ++mismatches;
+			}
+		}
+
+		std::cout << size << "x" << size << " maze, " << scene.flat_transforms.handles.size() << " transforms ("
+			<< std::max< size_t >(scene.flat_transforms.chunks.size(), 2) - 1 << " chunks below depth " << scene.flat_transforms.split_depth << "), "
+			<< threads << " threads, per frame: "
+			<< "root moving " << all * 1e3 << "ms (" << single / all << "x), "
+			<< mismatches << " mismatches" << std::endl;
+		if (mismatches) {
+			throw std::runtime_error("Maze transform update with " + std::to_string(threads) + " threads doesn't match single-threaded update.");
+		}
+	}
+});
+
+//Frustum culling a generated maze from a camera standing in it:
+Benchmark scene_cull("scene-cull", [](){
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	Scene::Camera *camera = make_maze_scene(scene, 128, &mesh_buffer);
+	Scene::Transform *eye = camera->transform;
+
+	uint32_t const iterations = 20;
+
+	scene.culling = false;
+	scene.cull(camera); //(warm up world matrices)
+	BenchmarkTimer off_timer;
+	for (uint32_t i = 0; i < iterations; ++i) scene.cull(camera);
+	double off = off_timer.elapsed() / iterations;
+	uint32_t total = scene.draw_stats.drawn;
+
+	scene.culling = true;
+	BenchmarkTimer on_timer;
+	for (uint32_t i = 0; i < iterations; ++i) scene.cull(camera);
+	double on = on_timer.elapsed() / iterations;
+
+	//culling must be conservative: anything whose center lands on screen must be kept:
+	glm::mat4 world_to_clip = camera->make_projection() * eye->make_world_to_local();
+	std::vector< bool > kept(scene.objects.size(), false);
+	std::vector< Scene::Object * > all;
+	scene.objects.for_each([&](Scene::Object *object){ all.emplace_back(object); });
+	std::sort(all.begin(), all.end());
+	for (auto object : scene.visible) {
+		kept[std::lower_bound(all.begin(), all.end(), object) - all.begin()] = true;
+	}
+	uint32_t missing = 0;
+	for (uint32_t i = 0; i < all.size(); ++i) {
+		glm::vec4 clip = world_to_clip * (all[i]->transform->make_local_to_world() * glm::vec4(all[i]->bounds_center, 1.0f));
+		if (clip.w > 0.0f && std::abs(clip.x) < clip.w && std::abs(clip.y) < clip.w && !kept[i]) ++missing;
+	}
+
+	std::cout << total << " objects: "
+		<< "culling off " << off * 1e3 << "ms, "
+		<< "culling on " << on * 1e3 << "ms, "
+		<< scene.draw_stats.drawn << " drawn / " << scene.draw_stats.culled << " culled, "
+		<< missing << " wrongly culled" << std::endl;
+	if (missing) {
+		throw std::runtime_error("Frustum culling removed objects that are on screen.");
+	}
+});
+
+//queue() with and without sorting, reporting the OpenGL calls draw() would make:
+// (submission itself needs a GL context, so only the CPU side of it is timed)
+static void benchmark_queue(std::string const &name, Scene &scene, Scene::Camera const *camera) {
+	uint32_t const iterations = 20;
+	struct Result {
+		double seconds;
+		Scene::DrawStats stats;
+	} results[2];
+	for (uint32_t sorted = 0; sorted < 2; ++sorted) {
+		scene.sort_draws = (sorted != 0);
+		scene.queue(camera); //(warm up)
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i < iterations; ++i) scene.queue(camera);
+		results[sorted].seconds = timer.elapsed() / iterations;
+		results[sorted].stats = scene.draw_stats;
+	}
+	for (uint32_t sorted = 0; sorted < 2; ++sorted) {
+		Result const &r = results[sorted];
+		std::cout << name << (sorted ? ", sorted: " : ", unsorted: ")
+			<< r.stats.drawn << " drawn, queue " << r.seconds * 1e3 << "ms, "
+			<< r.stats.gl_calls << " GL calls ("
+			<< r.stats.programs << " programs, "
+			<< r.stats.vertex_arrays << " vertex arrays, "
+			<< r.stats.materials << " materials)" << std::endl;
+	}
+	if (results[0].stats.drawn != results[1].stats.drawn) {
+		throw std::runtime_error("Sorting draws changed what was drawn.");
+	}
+}
+
+Benchmark scene_render_queue("scene-render-queue", [](){
+	//the shipped maze, one program and vertex array for everything (as in CratesMode; skipped if not next to the executable):
+	try {
+		std::ifstream file(data_path("maze.scene"), std::ios::binary);
+		struct TransformEntry {
+			int32_t parent_ref;
+			uint32_t name_begin, name_end;
+			glm::vec3 position;
+			glm::vec4 rotation;
+			glm::vec3 scale;
+		};
+		static_assert(sizeof(TransformEntry) == 4+4*2+4*3+4*4+4*3, "TransformEntry is packed.");
+		struct MeshEntry {
+			int32_t transform_ref;
+			uint32_t name_begin, name_end;
+		};
+		static_assert(sizeof(MeshEntry) == 12, "MeshEntry is packed.");
+		std::vector< char > strings;
+		std::vector< TransformEntry > transform_entries;
+		std::vector< MeshEntry > mesh_entries;
+		read_chunk(file, "str0", &strings);
+		read_chunk(file, "xfh0", &transform_entries);
+		read_chunk(file, "msh0", &mesh_entries);
+
+		Scene scene;
+		Scene::Camera *camera = nullptr;
+		std::vector< Scene::Transform * > transforms;
+		for (auto const &entry : transform_entries) {
+			Scene::Transform *t = scene.new_transform();
+			if (entry.parent_ref >= 0) t->set_parent(transforms.at(entry.parent_ref));
+			t->set_position(entry.position);
+			t->set_rotation(glm::quat(entry.rotation.w, entry.rotation.x, entry.rotation.y, entry.rotation.z));
+			t->set_scale(entry.scale);
+			transforms.emplace_back(t);
+			if (std::string(&strings[0] + entry.name_begin, &strings[0] + entry.name_end) == "Player") {
+				camera = scene.new_camera(t);
+				t->set_rotation(camera->original_rotation);
+			}
+		}
+		if (!camera) throw std::runtime_error("maze.scene has no 'Player'");
+		for (auto const &entry : mesh_entries) {
+			Scene::Object *object = scene.new_object(transforms.at(entry.transform_ref));
+			object->program = 1;
+			object->program_mvp_mat4 = 0;
+			object->program_mv_mat4x3 = 1;
+			object->program_itmv_mat3 = 2;
+			object->vao = 1;
+		}
+		benchmark_queue("maze.scene", scene, camera);
+	} catch (std::exception &e) {
+		std::cout << "maze.scene: skipped (" << e.what() << ")" << std::endl;
+	}
+
+	//50k objects scattered in front of the camera, with a mix of programs, vertex arrays, and materials:
+	{
+		Scene scene;
+		std::mt19937 mt(0x5ce4e);
+		std::uniform_real_distribution< float > spread(-100.0f, 100.0f);
+		for (uint32_t m = 0; m < 32; ++m) {
+			Scene::Material material;
+			material.tint = glm::vec4(1.0f, 1.0f, 1.0f - m / 32.0f, 1.0f);
+			scene.new_material(material);
+		}
+		for (uint32_t i = 0; i < 50000; ++i) {
+			Scene::Transform *t = scene.new_transform();
+			t->set_position(glm::vec3(spread(mt), spread(mt), -100.0f + spread(mt)));
+			Scene::Object *object = scene.new_object(t);
+			object->program = 1 + mt() % 4;
+			object->program_mvp_mat4 = 0;
+			object->program_mv_mat4x3 = 1;
+			object->program_itmv_mat3 = 2;
+			object->program_tint_vec4 = 3;
+			object->vao = 1 + mt() % 16;
+			object->material = 1 + mt() % 32;
+			object->bounds_radius = 1.0f;
+		}
+		Scene::Camera *camera = scene.new_camera(scene.new_transform());
+		camera->fovy = glm::radians(90.0f);
+		benchmark_queue("generated", scene, camera);
+	}
+});
+
+//Drawing the walls of a generated maze with and without instancing:
+// (as with scene-render-queue, only the CPU side -- queue(), including filling the instance buffer -- is timed)
+Benchmark scene_instancing("scene-instancing", [](){
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	Scene::Camera *camera = make_maze_scene(scene, 128, &mesh_buffer);
+
+	uint32_t const iterations = 20;
+	for (uint32_t instanced = 0; instanced < 2; ++instanced) {
+		scene.instancing = (instanced != 0);
+		scene.queue(camera); //(warm up)
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i < iterations; ++i) scene.queue(camera);
+		double seconds = timer.elapsed() / iterations;
+
+		//every visible object should be drawn exactly once, and instances should carry their object's transform:
+		uint32_t drawn = 0;
+		uint32_t mismatches = 0;
+		for (auto const &command : scene.commands) {
+			drawn += (command.instances ? command.instances : 1);
+			if (command.instances) {
+				glm::mat4 const &local_to_world = command.object->transform->make_local_to_world();
+				glm::vec4 const &row0 = scene.instance_transforms[Scene::InstanceTexels * command.instance_offset];
+				if (row0 != glm::vec4(local_to_world[0][0], local_to_world[1][0], local_to_world[2][0], local_to_world[3][0])) ++mismatches;
+			}
+		}
+
+		std::cout << (instanced ? "instanced: " : "plain: ")
+			<< scene.draw_stats.drawn << " drawn, "
+			<< scene.draw_stats.draw_calls << " draw calls, "
+			<< scene.draw_stats.gl_calls << " GL calls, "
+			<< "queue " << seconds * 1e3 << "ms, "
+			<< scene.instance_transforms.size() * sizeof(glm::vec4) / 1024 << "k instance data" << std::endl;
+		if (drawn != scene.draw_stats.drawn || mismatches) {
+			throw std::runtime_error("Instanced draws don't cover the visible objects.");
+		}
+	}
+});
+
+//Baking a generated maze's floor and walls into batches, and what that saves per frame:
+// (as with scene-render-queue, only the CPU side of drawing -- queue() -- is timed)
+Benchmark scene_bake("scene-bake", [](){
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	Scene::Camera *camera = make_maze_scene(scene, 128, &mesh_buffer);
+
+	uint32_t const iterations = 20;
+	auto measure = [&](std::string const &name) {
+		scene.queue(camera); //(warm up)
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i < iterations; ++i) scene.queue(camera);
+		double seconds = timer.elapsed() / iterations;
+		std::cout << name << ": "
+			<< scene.draw_stats.drawn << " drawn / " << scene.draw_stats.culled << " culled, "
+			<< scene.draw_stats.draw_calls << " draw calls, "
+			<< scene.draw_stats.gl_calls << " GL calls, "
+			<< "queue " << seconds * 1e3 << "ms" << std::endl;
+	};
+
+	scene.instancing = false;
+	measure("plain");
+	scene.instancing = true;
+	measure("instanced");
+
+	uint32_t statics = 0;
+	scene.objects.for_each([&](Scene::Object *object){ statics += (object->is_static ? 1 : 0); });
+	BenchmarkTimer bake_timer;
+	scene.bake_static(8.0f * Maze::CellSize, false);
+	double bake = bake_timer.elapsed();
+	size_t bytes = 0;
+	for (auto const &buffer : scene.baked_buffers) bytes += buffer->vertex_data.size();
+	std::cout << "bake: " << statics << " static objects -> " << scene.baked_objects.size() << " batches in "
+		<< bake * 1e3 << "ms (" << bytes / 1024 << "k of vertices)" << std::endl;
+
+	measure("baked");
+
+	//baked vertices should land where the objects put them (checking a few objects):
+	uint32_t checked = 0;
+	uint32_t mismatches = 0;
+	scene.objects.for_each([&](Scene::Object *object){
+		if (!object->baked || checked >= 16) return;
+		++checked;
+		glm::vec3 expected = glm::vec3(object->transform->make_local_to_world() * glm::vec4(mesh_buffer->position(object->start), 1.0f));
+		bool found = false;
+		for (auto const &buffer : scene.baked_buffers) {
+			for (GLuint v = 0; v < buffer->vertex_data.size() / buffer->vertex_stride() && !found; ++v) {
+				found = (glm::length(buffer->position(v) - expected) < 1e-3f);
+			}
+		}
+		if (!found) ++mismatches;
+	});
+	if (mismatches) {
+		throw std::runtime_error("Baked vertices don't match their objects.");
+	}
+});
+
+//Potentially-visible sets for a large generated maze: building them, their size, and how much they hide from a camera standing in it:
+Benchmark scene_pvs("scene-pvs", [](){
+	uint32_t const size = 256;
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	Scene::Camera *camera = make_maze_scene(scene, size, &mesh_buffer);
+	Maze maze(size, size, 1); //(the same maze make_maze_scene built)
+
+	BenchmarkTimer build_timer;
+	CellVisibility visibility(maze.width, maze.height, glm::vec2(0.0f), Maze::CellSize, maze.cells);
+	double build = build_timer.elapsed();
+	size_t bytes = visibility.sets.size() * sizeof(CellVisibility::Set) + visibility.bits.size() * sizeof(uint64_t);
+	uint64_t visible_cells = 0;
+	for (uint32_t from = 0; from < visibility.sets.size(); ++from) {
+		CellVisibility::Set const &set = visibility.sets[from];
+		for (uint32_t y = set.y0; y < set.y0 + set.h; ++y) {
+			for (uint32_t x = set.x0; x < set.x0 + set.w; ++x) {
+				visible_cells += (visibility.visible(from, x, y) ? 1 : 0);
+			}
+		}
+	}
+	std::cout << "build: " << size << "x" << size << " cells in " << build * 1e3 << "ms, "
+		<< bytes / 1024 << "k (" << double(visible_cells) / visibility.sets.size() << " cells visible per cell)" << std::endl;
+
+	//sets must be conservative: any point with a clear line of sight from a point in a cell must be in that cell's set:
+	// (walks the cells along each sight line, which is blocked by the first closed edge it crosses)
+	auto clear = [&](glm::vec2 const &a, glm::vec2 const &b) {
+		int32_t x = int32_t(std::floor(a.x)), y = int32_t(std::floor(a.y));
+		int32_t const end_x = int32_t(std::floor(b.x)), end_y = int32_t(std::floor(b.y));
+		glm::vec2 d = b - a;
+		int32_t step_x = (d.x > 0.0f ? 1 : -1), step_y = (d.y > 0.0f ? 1 : -1);
+		//(distance along a->b, as a fraction, to the next vertical / horizontal edge)
+		float next_x = (d.x != 0.0f ? ((step_x > 0 ? x + 1 : x) - a.x) / d.x : std::numeric_limits< float >::infinity());
+		float next_y = (d.y != 0.0f ? ((step_y > 0 ? y + 1 : y) - a.y) / d.y : std::numeric_limits< float >::infinity());
+		float delta_x = (d.x != 0.0f ? step_x / d.x : std::numeric_limits< float >::infinity());
+		float delta_y = (d.y != 0.0f ? step_y / d.y : std::numeric_limits< float >::infinity());
+		while (x != end_x || y != end_y) {
+			if (next_x < next_y) {
+				if (step_x > 0 ? !maze.open_east(x, y) : (x == 0 || !maze.open_east(x - 1, y))) return false;
+				x += step_x;
+				next_x += delta_x;
+			} else {
+				if (step_y > 0 ? !maze.open_north(x, y) : (y == 0 || !maze.open_north(x, y - 1))) return false;
+				y += step_y;
+				next_y += delta_y;
+			}
+			if ((x - end_x) * step_x > 0 || (y - end_y) * step_y > 0) return false; //(rounding walked past the end)
+		}
+		return true;
+	};
+	std::mt19937 mt(0x9755);
+	std::uniform_real_distribution< float > inside(0.0f, 0.9999f); //(anywhere in a cell, up to the walls -- but not rounding into the next one)
+	uint32_t sight_lines = 0;
+	uint32_t missing = 0;
+	for (uint32_t trial = 0; trial < 1000; ++trial) {
+		uint32_t fx = mt() % size, fy = mt() % size;
+		glm::vec2 eye(fx + inside(mt), fy + inside(mt));
+		for (uint32_t y = (fy < 16 ? 0 : fy - 16); y < std::min(size, fy + 16); ++y) {
+			for (uint32_t x = (fx < 16 ? 0 : fx - 16); x < std::min(size, fx + 16); ++x) {
+				for (uint32_t sample = 0; sample < 4; ++sample) {
+					glm::vec2 target(x + inside(mt), y + inside(mt));
+					if (!clear(eye, target)) continue;
+					++sight_lines;
+					if (!visibility.visible(fy * size + fx, x, y)) ++missing;
+				}
+			}
+		}
+	}
+	std::cout << "check: " << sight_lines << " clear sight lines, " << missing << " to cells not in the set" << std::endl;
+	if (missing) {
+		throw std::runtime_error("Potentially-visible sets are missing visible cells.");
+	}
+
+	uint32_t const iterations = 20;
+	auto measure = [&](std::string const &name) {
+		scene.queue(camera); //(warm up)
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i < iterations; ++i) scene.queue(camera);
+		double seconds = timer.elapsed() / iterations;
+		std::cout << name << ": "
+			<< scene.draw_stats.drawn << " drawn / " << scene.draw_stats.culled << " culled / " << scene.draw_stats.hidden << " hidden, "
+			<< scene.draw_stats.draw_calls << " draw calls, "
+			<< "queue " << seconds * 1e3 << "ms" << std::endl;
+	};
+
+	scene.instancing = false;
+	measure("frustum");
+	scene.cell_visibility = &visibility;
+	measure("frustum + pvs");
+	scene.instancing = true;
+	measure("frustum + pvs, instanced");
+
+	scene.bake_static(8.0f * Maze::CellSize, false);
+	scene.cell_visibility = nullptr;
+	measure("baked, frustum");
+	scene.cell_visibility = &visibility;
+	measure("baked, frustum + pvs");
+
+	//a set saved and loaded again should be the same:
+	std::string path = "benchmark-scene-pvs.pvs";
+	visibility.save(path);
+	CellVisibility loaded(path);
+	std::remove(path.c_str());
+	if (loaded.width != visibility.width || loaded.height != visibility.height || loaded.bits != visibility.bits
+	 || std::memcmp(loaded.sets.data(), visibility.sets.data(), visibility.sets.size() * sizeof(CellVisibility::Set)) != 0) {
+		throw std::runtime_error("Potentially-visible sets changed when saved and loaded.");
+	}
+});
+
+//Occlusion culling a generated maze from a camera standing in it, before and after baking:
+// (results are checked against a full-resolution rasterization of everything in the view frustum)
+Benchmark scene_occlusion("scene-occlusion", [](){
+	Scene scene;
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	Scene::Camera *camera = make_maze_scene(scene, 128, &mesh_buffer);
+	scene.set_update_threads(0);
+
+	uint32_t const iterations = 20;
+	auto measure = [&](std::string const &name) {
+		scene.cull(camera); //(warm up)
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i < iterations; ++i) scene.cull(camera);
+		double seconds = timer.elapsed() / iterations;
+		std::cout << name << ": "
+			<< scene.draw_stats.drawn << " drawn / " << scene.draw_stats.culled << " culled / " << scene.draw_stats.occluded << " occluded ("
+			<< scene.draw_stats.occluders << " occluders, " << scene.draw_stats.occluder_triangles << " triangles), "
+			<< "cull " << seconds * 1e3 << "ms" << std::endl;
+	};
+
+	//objects that draw at least one pixel nearest the camera must not be occluded:
+	auto check = [&]() {
+		scene.occlusion_culling = false;
+		scene.cull(camera);
+		std::vector< Scene::Object * > in_frustum = scene.visible;
+		scene.occlusion_culling = true;
+		scene.cull(camera);
+		std::vector< Scene::Object * > kept = scene.visible;
+		std::sort(kept.begin(), kept.end());
+
+		uint32_t const width = 1024, height = 512;
+		std::vector< float > depth(width * height, 0.0f); //(1/w, as in OcclusionBuffer)
+		std::vector< uint32_t > owner(width * height, -1U);
+		std::vector< bool > seen(in_frustum.size(), false);
+		glm::mat4 world_to_clip = camera->make_projection() * camera->transform->make_world_to_local();
+		for (uint32_t o = 0; o < in_frustum.size(); ++o) {
+			Scene::Object const *object = in_frustum[o];
+			glm::mat4 object_to_clip = world_to_clip * object->transform->make_local_to_world();
+			for (GLuint v = object->start; v + 2 < object->start + object->count; v += 3) {
+				glm::vec3 s[3];
+				bool clipped = false;
+				for (uint32_t k = 0; k < 3; ++k) {
+					glm::vec4 clip = object_to_clip * glm::vec4(object->mesh_buffer->position(v + k), 1.0f);
+					if (!(clip.w > camera->near)) clipped = true;
+					s[k] = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height, 1.0f / clip.w);
+				}
+				if (clipped) { //(crosses the near plane, so certainly visible)
+					seen[o] = true;
+					continue;
+				}
+				float area = (s[1].x - s[0].x) * (s[2].y - s[0].y) - (s[1].y - s[0].y) * (s[2].x - s[0].x);
+				if (area == 0.0f) continue;
+				int32_t x0 = std::max(0, int32_t(std::floor(std::min(s[0].x, std::min(s[1].x, s[2].x)))));
+				int32_t x1 = std::min(int32_t(width) - 1, int32_t(std::floor(std::max(s[0].x, std::max(s[1].x, s[2].x)))));
+				int32_t y0 = std::max(0, int32_t(std::floor(std::min(s[0].y, std::min(s[1].y, s[2].y)))));
+				int32_t y1 = std::min(int32_t(height) - 1, int32_t(std::floor(std::max(s[0].y, std::max(s[1].y, s[2].y)))));
+				for (int32_t y = y0; y <= y1; ++y) {
+					for (int32_t x = x0; x <= x1; ++x) {
+						glm::vec2 p(x + 0.5f, y + 0.5f);
+						float w[3];
+						for (uint32_t k = 0; k < 3; ++k) {
+							glm::vec3 const &a = s[(k + 1) % 3], &b = s[(k + 2) % 3];
+							w[k] = ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)) / area;
+						}
+						if (w[0] < 0.0f || w[1] < 0.0f || w[2] < 0.0f) continue;
+						float z = w[0] * s[0].z + w[1] * s[1].z + w[2] * s[2].z;
+						uint32_t at = y * width + x;
+						if (z > depth[at]) {
+							depth[at] = z;
+							owner[at] = o;
+						}
+					}
+				}
+			}
+		}
+		for (uint32_t id : owner) {
+			if (id != -1U) seen[id] = true;
+		}
+		uint32_t seen_count = 0, wrong = 0;
+		for (uint32_t o = 0; o < in_frustum.size(); ++o) {
+			if (!seen[o]) continue;
+			++seen_count;
+			if (!std::binary_search(kept.begin(), kept.end(), in_frustum[o])) ++wrong;
+		}
+		std::cout << "check: " << seen_count << " of " << in_frustum.size() << " objects in the frustum are visible, "
+			<< wrong << " of them occluded" << std::endl;
+		if (wrong) {
+			throw std::runtime_error("Occlusion culling hid objects that are visible.");
+		}
+	};
+
+	scene.occlusion_culling = false;
+	measure("frustum");
+	scene.occlusion_culling = true;
+	measure("frustum + occlusion");
+	check();
+
+	scene.bake_static(8.0f * Maze::CellSize, false);
+	scene.occlusion_culling = false;
+	measure("baked, frustum");
+	scene.occlusion_culling = true;
+	measure("baked, frustum + occlusion");
+	check();
+});
+
+//Loading generated maze scenes of increasing size with Scene::load, and looking transforms up by name:
+Benchmark scene_load("scene-load", [](){
+	std::string const path = "benchmark-scene-load.scene";
+	for (uint32_t size : {128U, 256U, 512U}) {
+		Maze maze(size, size, 1);
+
+		//meshes (as make_maze_scene does), and the scene file:
+		std::unique_ptr< MeshBuffer > mesh_buffer;
+		{
+			std::vector< Maze::Vertex > vertices;
+			std::vector< char > strings;
+			std::vector< Maze::MeshEntry > index;
+			maze.make_meshes(&vertices, &strings, &index);
+			MeshBuffer format;
+			format.Position = MeshBuffer::Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Maze::Vertex), offsetof(Maze::Vertex, Position));
+			std::map< std::string, MeshBuffer::Mesh > meshes;
+			for (auto const &entry : index) {
+				MeshBuffer::Mesh mesh;
+				mesh.start = entry.vertex_begin;
+				mesh.count = entry.vertex_end - entry.vertex_begin;
+				meshes.insert(std::make_pair(std::string(&strings[0] + entry.name_begin, &strings[0] + entry.name_end), mesh));
+			}
+			std::vector< uint8_t > data(reinterpret_cast< uint8_t const * >(vertices.data()), reinterpret_cast< uint8_t const * >(vertices.data() + vertices.size()));
+			mesh_buffer.reset(new MeshBuffer(format, std::move(data), meshes));
+		}
+		std::vector< char > strings;
+		std::vector< Maze::TransformEntry > transforms;
+		std::vector< Maze::SceneMeshEntry > meshes;
+		maze.make_scene(&strings, &transforms, &meshes);
+		{
+			std::ofstream file(path, std::ios::binary);
+			write_chunk(file, "str0", strings);
+			write_chunk(file, "xfh0", transforms);
+			write_chunk(file, "msh0", meshes);
+			write_chunk(file, "cam0", std::vector< char >());
+			write_chunk(file, "lmp0", std::vector< char >());
+		}
+
+		Scene scene;
+		scene.set_flat_transforms(true);
+		BenchmarkTimer load_timer;
+		scene.load(path, *mesh_buffer);
+		double load = load_timer.elapsed();
+
+		//every name should find its transform (with the right parent):
+		std::vector< std::string > names;
+		names.reserve(transforms.size());
+		for (auto const &entry : transforms) {
+			names.emplace_back(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+		}
+		BenchmarkTimer find_timer;
+		std::vector< Scene::Transform * > found(names.size());
+		for (uint32_t i = 0; i < names.size(); ++i) found[i] = scene.find_transform(names[i]);
+		double find = find_timer.elapsed();
+		uint32_t wrong = 0;
+		for (uint32_t i = 0; i < names.size(); ++i) {
+			Scene::Transform const *parent = (transforms[i].parent_ref >= 0 ? found[transforms[i].parent_ref] : nullptr);
+			if (!found[i] || scene.transform_name(found[i]) != names[i] || found[i]->parent != parent) ++wrong;
+		}
+		if (scene.find_transform("Wall.-1.-1.n") != nullptr) ++wrong;
+
+		std::cout << size << "x" << size << ": " << scene.transforms.size() << " transforms and " << scene.objects.size() << " objects"
+			<< " loaded in " << load * 1e3 << "ms (" << load / scene.transforms.size() * 1e9 << "ns per transform), "
+			<< "found by name in " << find / names.size() * 1e9 << "ns each" << std::endl;
+		if (wrong || scene.transforms.size() != transforms.size() || scene.objects.size() != meshes.size()) {
+			throw std::runtime_error("Scene::load didn't build the scene in the file.");
+		}
+	}
+	std::remove(path.c_str());
+});
+
+//Spawning many copies of a small subtree, one node at a time vs. Scene::instantiate:
+Benchmark scene_prefab("scene-prefab", [](){
+	uint32_t const nodes = 20;
+	uint32_t const copies = 10000;
+
+	//every other node gets an object (each with its own mesh, looked up by name); the others are joints:
+	std::unique_ptr< MeshBuffer > mesh_buffer;
+	{
+		MeshBuffer format;
+		format.Position = MeshBuffer::Attrib(3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+		std::vector< glm::vec3 > vertices;
+		std::map< std::string, MeshBuffer::Mesh > meshes;
+		for (uint32_t i = 0; i < nodes; i += 2) {
+			MeshBuffer::Mesh mesh;
+			mesh.start = GLuint(vertices.size());
+			mesh.count = 3;
+			vertices.emplace_back(0.0f, 0.0f, 0.0f);
+			vertices.emplace_back(1.0f, 0.0f, 0.0f);
+			vertices.emplace_back(0.0f, 1.0f, 0.1f * i);
+			meshes.insert(std::make_pair("Part." + std::to_string(i), mesh));
+		}
+		std::vector< uint8_t > data(reinterpret_cast< uint8_t const * >(vertices.data()), reinterpret_cast< uint8_t const * >(vertices.data() + vertices.size()));
+		mesh_buffer.reset(new MeshBuffer(format, std::move(data), meshes));
+	}
+	std::vector< std::string > mesh_names(nodes);
+	for (uint32_t i = 0; i < nodes; i += 2) mesh_names[i] = "Part." + std::to_string(i);
+
+	std::mt19937 mt(0x9ef4b);
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+	struct Part {
+		uint32_t parent;
+		glm::vec3 position;
+		glm::quat rotation;
+		glm::vec3 scale;
+	};
+	std::vector< Part > parts;
+	for (uint32_t i = 0; i < nodes; ++i) {
+		Part part;
+		part.parent = (i == 0 ? -1U : (i - 1) / 2);
+		part.position = glm::vec3(unit(mt), unit(mt), unit(mt));
+		part.rotation = glm::normalize(glm::quat(unit(mt), unit(mt), unit(mt), unit(mt)));
+		part.scale = glm::vec3(1.0f + 0.1f * unit(mt));
+		parts.emplace_back(part);
+	}
+
+	//what spawning looked like before prefabs:
+	auto spawn = [&](Scene &scene, Scene::Transform *parent) -> Scene::Transform * {
+		std::vector< Scene::Transform * > made;
+		made.reserve(nodes);
+		for (uint32_t i = 0; i < nodes; ++i) {
+			Scene::Transform *t = scene.new_transform();
+			t->set_position(parts[i].position);
+			t->set_rotation(parts[i].rotation);
+			t->set_scale(parts[i].scale);
+			t->set_parent(parts[i].parent == -1U ? parent : made[parts[i].parent]);
+			if (!mesh_names[i].empty()) {
+				MeshBuffer::Mesh const &mesh = mesh_buffer->lookup(mesh_names[i]);
+				Scene::Object *object = scene.new_object(t);
+				object->program = 1;
+				object->vao = 1;
+				object->start = mesh.start;
+				object->count = mesh.count;
+				object->bounds_min = mesh.min;
+				object->bounds_max = mesh.max;
+				object->bounds_center = mesh.center;
+				object->bounds_radius = mesh.radius;
+				object->mesh_buffer = mesh_buffer.get();
+			}
+			made.emplace_back(t);
+		}
+		return made[0];
+	};
+
+	//sorted world-space object centers, for comparing results:
+	auto centers = [](Scene &scene) {
+		std::vector< glm::vec3 > ret;
+		scene.objects.for_each([&](Scene::Object *object){
+			ret.emplace_back(glm::vec3(object->transform->make_local_to_world() * glm::vec4(object->bounds_center, 1.0f)));
+		});
+		std::sort(ret.begin(), ret.end(), [](glm::vec3 const &a, glm::vec3 const &b){
+			if (a.x != b.x) return a.x < b.x;
+			if (a.y != b.y) return a.y < b.y;
+			return a.z < b.z;
+		});
+		return ret;
+	};
+	//copies are spread out along x by moving their roots:
+	auto place = [](std::vector< Scene::Transform * > const &roots) {
+		for (uint32_t i = 0; i < roots.size(); ++i) {
+			roots[i]->set_position(roots[i]->position + glm::vec3(4.0f * i, 0.0f, 0.0f));
+		}
+	};
+
+	//the prefab is captured from a copy made the old way:
+	Scene source;
+	Scene::Prefab prefab = source.make_prefab(spawn(source, nullptr));
+
+	for (bool flat : {false, true}) {
+		//(best of a few runs, one scene at a time, so that both ways get memory the process has already touched)
+		double spawned = std::numeric_limits< double >::infinity();
+		double instantiated = std::numeric_limits< double >::infinity();
+		std::vector< glm::vec3 > expected, got;
+		size_t expected_transforms = 0, got_transforms = 0;
+		for (uint32_t run = 0; run < 3; ++run) {
+			{
+				Scene one_by_one;
+				one_by_one.set_flat_transforms(flat);
+				Scene::Transform *world = one_by_one.new_transform();
+				world->set_rotation(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+				std::vector< Scene::Transform * > roots;
+				roots.reserve(copies);
+				BenchmarkTimer spawn_timer;
+				for (uint32_t i = 0; i < copies; ++i) roots.emplace_back(spawn(one_by_one, world));
+				spawned = std::min(spawned, spawn_timer.elapsed());
+				place(roots);
+				expected = centers(one_by_one);
+				expected_transforms = one_by_one.transforms.size();
+			}
+			{
+				Scene bulk;
+				bulk.set_flat_transforms(flat);
+				Scene::Transform *world = bulk.new_transform();
+				world->set_rotation(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+				std::vector< Scene::Transform * > roots;
+				BenchmarkTimer instantiate_timer;
+				bulk.instantiate(prefab, copies, world, &roots);
+				instantiated = std::min(instantiated, instantiate_timer.elapsed());
+				place(roots);
+				got = centers(bulk);
+				got_transforms = bulk.transforms.size();
+			}
+		}
+
+		uint32_t wrong = 0;
+		if (expected.size() != got.size() || got_transforms != expected_transforms) {
+			wrong = -1U;
+		} else {
+			for (uint32_t i = 0; i < got.size(); ++i) {
+				if (glm::length(got[i] - expected[i]) > 1e-3f) ++wrong;
+			}
+		}
+
+		std::cout << (flat ? "flat" : "pointer") << " transforms, " << copies << " copies of " << prefab.nodes.size() << " nodes + " << prefab.objects.size() << " objects: "
+			<< "one at a time " << spawned * 1e3 << "ms, "
+			<< "instantiate " << instantiated * 1e3 << "ms (" << instantiated / (copies * prefab.nodes.size()) * 1e9 << "ns per node), "
+			<< "speedup " << spawned / instantiated << "x" << std::endl;
+		if (wrong) {
+			throw std::runtime_error("Scene::instantiate didn't build the same scene as spawning node by node.");
+		}
+	}
+});
+
+//Keeping Scene::spatial_index up to date as objects move, and querying it, vs. walking every object:
+Benchmark scene_spatial("scene-spatial", [](){
+	uint32_t const count = 100000;
+	uint32_t const frames = 10;
+	uint32_t const queries = 1000; //(of each kind, per frame)
+	uint32_t const checked = 20; //(queries per frame also answered by walking every object)
+	float const radius = 10.0f;
+	uint32_t const k = 8;
+	glm::vec3 const world_min = glm::vec3(0.0f, 0.0f, 0.0f), world_max = glm::vec3(500.0f, 500.0f, 20.0f);
+
+	std::mt19937 mt(0x5ba7);
+	auto random_in = [&](glm::vec3 const &min, glm::vec3 const &max) {
+		std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+		float x = unit(mt), y = unit(mt), z = unit(mt);
+		return min + glm::vec3(x, y, z) * (max - min);
+	};
+
+	Scene scene;
+	scene.set_flat_transforms(true);
+	std::vector< Scene::Transform * > movers;
+	std::vector< glm::vec3 > velocities;
+	movers.reserve(count);
+	velocities.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		Scene::Transform *t = scene.new_transform();
+		t->set_rotation(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+		t->set_position(random_in(world_min, world_max));
+		Scene::Object *object = scene.new_object(t);
+		object->bounds_radius = 0.5f + 0.5f * (i % 4);
+		movers.emplace_back(t);
+		velocities.emplace_back(random_in(glm::vec3(-2.0f), glm::vec3(2.0f)));
+	}
+	scene.update_spatial_index();
+
+	//the old way, walking every object:
+	auto walk = [&scene](std::function< void(Scene::Object *, glm::vec3 const &, float) > const &f) {
+		scene.objects.for_each([&](Scene::Object *object){
+			glm::mat4 const &local_to_world = object->transform->make_local_to_world();
+			f(object, glm::vec3(local_to_world * glm::vec4(object->bounds_center, 1.0f)), object->bounds_radius);
+		});
+	};
+
+	double move = 0.0, matrices = 0.0, update = 0.0;
+	double within = 0.0, overlapping = 0.0, nearest = 0.0;
+	double walk_within = 0.0, walk_overlapping = 0.0, walk_nearest = 0.0;
+	uint64_t found = 0;
+	uint32_t wrong = 0;
+	std::vector< Scene::Object * > results, expected;
+	std::vector< std::pair< float, Scene::Object * > > by_distance;
+	for (uint32_t frame = 0; frame < frames; ++frame) {
+		BenchmarkTimer move_timer;
+		for (uint32_t i = 0; i < count; ++i) {
+			glm::vec3 at = movers[i]->position + velocities[i] * (1.0f / 60.0f);
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (at[c] < world_min[c] || at[c] > world_max[c]) velocities[i][c] = -velocities[i][c];
+			}
+			movers[i]->set_position(at);
+		}
+		move += move_timer.elapsed();
+
+		BenchmarkTimer matrices_timer;
+		scene.update_world_matrices();
+		matrices += matrices_timer.elapsed();
+		BenchmarkTimer update_timer;
+		scene.update_spatial_index();
+		update += update_timer.elapsed();
+
+		std::vector< glm::vec3 > centers(queries);
+		for (auto &center : centers) center = random_in(world_min, world_max);
+
+		BenchmarkTimer within_timer;
+		for (auto const &center : centers) {
+			scene.spatial_index.for_each_within(center, radius, [&](Scene::Object *){ ++found; });
+		}
+		within += within_timer.elapsed();
+
+		BenchmarkTimer overlapping_timer;
+		for (auto const &center : centers) {
+			scene.spatial_index.for_each_overlapping(center - glm::vec3(radius), center + glm::vec3(radius), [&](Scene::Object *){ ++found; });
+		}
+		overlapping += overlapping_timer.elapsed();
+
+		BenchmarkTimer nearest_timer;
+		for (auto const &center : centers) {
+			scene.spatial_index.nearest(center, k, &results);
+			found += results.size();
+		}
+		nearest += nearest_timer.elapsed();
+
+		//check a few queries of each kind against walking every object:
+		for (uint32_t q = 0; q < checked; ++q) {
+			glm::vec3 const &center = centers[q];
+
+			BenchmarkTimer walk_within_timer;
+			expected.clear();
+			walk([&](Scene::Object *object, glm::vec3 const &at, float r){
+				if (glm::length(at - center) <= radius + r) expected.emplace_back(object);
+			});
+			walk_within += walk_within_timer.elapsed();
+			results.clear();
+			scene.spatial_index.for_each_within(center, radius, [&](Scene::Object *object){ results.emplace_back(object); });
+			std::sort(expected.begin(), expected.end());
+			std::sort(results.begin(), results.end());
+			if (results != expected) ++wrong;
+
+			BenchmarkTimer walk_overlapping_timer;
+			expected.clear();
+			glm::vec3 min = center - glm::vec3(radius), max = center + glm::vec3(radius);
+			walk([&](Scene::Object *object, glm::vec3 const &at, float r){
+				if (glm::length(glm::clamp(at, min, max) - at) <= r) expected.emplace_back(object);
+			});
+			walk_overlapping += walk_overlapping_timer.elapsed();
+			results.clear();
+			scene.spatial_index.for_each_overlapping(min, max, [&](Scene::Object *object){ results.emplace_back(object); });
+			std::sort(expected.begin(), expected.end());
+			std::sort(results.begin(), results.end());
+			if (results != expected) ++wrong;
+
+			BenchmarkTimer walk_nearest_timer;
+			by_distance.clear();
+			walk([&](Scene::Object *object, glm::vec3 const &at, float){
+				by_distance.emplace_back(glm::length(at - center), object);
+			});
+			std::partial_sort(by_distance.begin(), by_distance.begin() + k, by_distance.end());
+			walk_nearest += walk_nearest_timer.elapsed();
+			scene.spatial_index.nearest(center, k, &results);
+			if (results.size() != k) ++wrong;
+			for (uint32_t i = 0; i < results.size(); ++i) {
+				glm::mat4 const &local_to_world = results[i]->transform->make_local_to_world();
+				float distance = glm::length(glm::vec3(local_to_world[3]) - center);
+				if (std::abs(distance - by_distance[i].first) > 1e-4f) ++wrong;
+			}
+		}
+	}
+
+	uint32_t total = frames * queries;
+	uint32_t total_checked = frames * checked;
+	std::cout << count << " moving objects in " << scene.spatial_index.cell_count << " cells, per frame: "
+		<< "move " << move / frames * 1e3 << "ms, "
+		<< "world matrices " << matrices / frames * 1e3 << "ms, "
+		<< "spatial index " << update / frames * 1e3 << "ms" << std::endl;
+	std::cout << "radius " << radius << ": " << within / total * 1e6 << "us (walking every object: " << walk_within / total_checked * 1e6 << "us)" << std::endl;
+	std::cout << "box " << 2.0f * radius << ": " << overlapping / total * 1e6 << "us (walking every object: " << walk_overlapping / total_checked * 1e6 << "us)" << std::endl;
+	std::cout << k << " nearest: " << nearest / total * 1e6 << "us (walking every object: " << walk_nearest / total_checked * 1e6 << "us)" << std::endl;
+	std::cout << "(" << found << " found; " << total_checked * 3 << " queries checked, " << wrong << " wrong)" << std::endl;
+	if (wrong) {
+		throw std::runtime_error("Spatial index queries didn't match walking every object.");
+	}
+});
@@ -0,0 +1,629 @@
+#include "benchmark.hpp"
+#include "WalkMesh.hpp"
+#include "PathFinder.hpp"
+#include "FlowField.hpp"
+#include "TiledWalkMesh.hpp"
+#include "data_path.hpp"
+
+#include <glm/glm.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//Builds a gently rolling grid walk mesh with (about) 'triangle_count' triangles, one unit per grid square:
+// (if 'hole_fraction' is non-zero, about that fraction of grid squares are left out, as obstacles)
+static WalkMesh make_grid_walkmesh(uint32_t triangle_count, float hole_fraction = 0.0f) {
+	std::mt19937 mt(0x0b57ac1e);
+	std::uniform_real_distribution< float > hole(0.0f, 1.0f);
+	uint32_t side = std::max(1U, uint32_t(std::sqrt(triangle_count / 2.0)));
+	std::vector< glm::vec3 > vertices;
+	vertices.reserve((side + 1) * (side + 1));
+	for (uint32_t y = 0; y <= side; ++y) {
+		for (uint32_t x = 0; x <= side; ++x) {
+			vertices.emplace_back(float(x), float(y), 0.5f * std::sin(0.3f * x) * std::cos(0.2f * y));
+		}
+	}
+	std::vector< glm::uvec3 > triangles;
+	triangles.reserve(2 * side * side);
+	for (uint32_t y = 0; y < side; ++y) {
+		for (uint32_t x = 0; x < side; ++x) {
+			uint32_t a = y * (side + 1) + x;
+			uint32_t b = a + 1;
+			uint32_t c = a + (side + 1);
+			uint32_t d = c + 1;
+			if (hole_fraction > 0.0f && hole(mt) < hole_fraction) continue;
+			triangles.emplace_back(a, b, d);
+			triangles.emplace_back(a, d, c);
+		}
+	}
+	return WalkMesh(vertices, triangles);
+}
+
+//Random points above (and a little outside) the grid's footprint:
+static std::vector< glm::vec3 > make_query_points(WalkMesh const &mesh, uint32_t count) {
+	glm::vec3 max = mesh.vertices.back();
+	std::mt19937 mt(0xfeedf00d);
+	std::uniform_real_distribution< float > x(-2.0f, max.x + 2.0f);
+	std::uniform_real_distribution< float > y(-2.0f, max.y + 2.0f);
+	std::uniform_real_distribution< float > z(0.5f, 2.0f);
+	std::vector< glm::vec3 > points;
+	points.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		points.emplace_back(x(mt), y(mt), z(mt));
+	}
+	return points;
+}
+
+//The pre-bvh WalkMesh::start, for comparison: projects onto every triangle's plane and keeps the closest projection that lands inside its triangle.
+static WalkMesh::WalkPoint linear_start(WalkMesh const &mesh, glm::vec3 const &world_point) {
+	WalkMesh::WalkPoint closest;
+	float min_dist = std::numeric_limits< float >::max();
+	for (auto const &tri : mesh.triangles) {
+		glm::vec3 const &a = mesh.vertices[tri[0]];
+		glm::vec3 const &b = mesh.vertices[tri[1]];
+		glm::vec3 const &c = mesh.vertices[tri[2]];
+		glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+		glm::vec3 projection = world_point + glm::dot(a - world_point, normal) * normal;
+
+		glm::vec3 v0 = b - a, v1 = c - a, v2 = projection - a;
+		float d00 = glm::dot(v0, v0), d01 = glm::dot(v0, v1), d11 = glm::dot(v1, v1);
+		float d20 = glm::dot(v2, v0), d21 = glm::dot(v2, v1);
+		float inv_denom = 1.0f / (d00 * d11 - d01 * d01);
+		float v = (d11 * d20 - d01 * d21) * inv_denom;
+		float w = (d00 * d21 - d01 * d20) * inv_denom;
+		glm::vec3 weights(1.0f - v - w, v, w);
+		if (weights.x < 0.0f || weights.y < 0.0f || weights.z < 0.0f) continue;
+
+		float dist = glm::distance(world_point, projection);
+		if (dist < min_dist) {
+			closest.triangle = uint32_t(&tri - &mesh.triangles[0]);
+			closest.weights = weights;
+			min_dist = dist;
+		}
+	}
+	return closest;
+}
+
+Benchmark walkmesh_start("walkmesh-start", [](){
+	for (uint32_t triangle_count : {10000U, 100000U, 1000000U}) {
+		BenchmarkTimer build_timer;
+		WalkMesh mesh = make_grid_walkmesh(triangle_count);
+		double build = build_timer.elapsed();
+
+		std::vector< glm::vec3 > points = make_query_points(mesh, 100000);
+
+		//bvh query on every point:
+		BenchmarkTimer bvh_timer;
+		glm::vec3 bvh_sum = glm::vec3(0.0f);
+		for (auto const &p : points) {
+			bvh_sum += mesh.world_point(mesh.start(p));
+		}
+		double bvh = bvh_timer.elapsed() / points.size();
+
+		//linear scan is slow, so only run it on a subset (of on-mesh points, since it can't handle the others):
+		uint32_t linear_count = std::max(10U, 10000000U / triangle_count);
+		uint32_t mismatches = 0;
+		double linear = 0.0;
+		uint32_t linear_done = 0;
+		for (uint32_t i = 0; i < points.size() && linear_done < linear_count; ++i) {
+			glm::vec3 const &p = points[i];
+			if (p.x < 0.0f || p.y < 0.0f || p.x > mesh.vertices.back().x || p.y > mesh.vertices.back().y) continue;
+			BenchmarkTimer linear_timer;
+			WalkMesh::WalkPoint wp = linear_start(mesh, p);
+			linear += linear_timer.elapsed();
+			++linear_done;
+			//(the linear scan can miss points that project onto edges between triangles)
+			if (wp.triangle == -1U) ++mismatches;
+			else if (glm::distance(mesh.world_point(wp), mesh.world_point(mesh.start(p))) > 1e-3f) ++mismatches;
+		}
+		linear /= linear_done;
+
+		std::cout << mesh.triangles.size() << " triangles: "
+			<< "build " << build * 1e3 << "ms (" << mesh.bvh_nodes.size() << " bvh nodes), "
+			<< "bvh start " << bvh * 1e6 << "us, "
+			<< "linear start " << linear * 1e6 << "us "
+			<< "(" << linear / bvh << "x), "
+			<< mismatches << "/" << linear_done << " mismatches "
+			<< "[checksum " << bvh_sum.x + bvh_sum.y + bvh_sum.z << "]" << std::endl;
+	}
+});
+
+//WalkMesh::walk, but finding what's across each edge the way the old next_vertex hash map did:
+// ('across' maps each directed edge (a,b) of a triangle to 3 * triangle + corner opposite that edge)
+static void hash_walk(WalkMesh const &mesh, std::unordered_map< glm::uvec2, uint32_t > const &across, WalkMesh::WalkPoint &wp, glm::vec3 const &step) {
+	glm::vec3 remaining = step;
+	uint32_t sliding = -1U;
+	for (uint32_t iter = 0; iter < 16; ++iter) {
+		glm::vec3 delta = mesh.triangle_frames[wp.triangle] * remaining;
+		if (sliding != -1U) {
+			float drift = delta[sliding];
+			delta[sliding] = 0.0f;
+			delta[(sliding + 1) % 3] += 0.5f * drift;
+			delta[(sliding + 2) % 3] += 0.5f * drift;
+		}
+		glm::vec3 target_weights = wp.weights + delta;
+		if (!(target_weights[0] < 0.0f || target_weights[1] < 0.0f || target_weights[2] < 0.0f)) {
+			wp.weights = target_weights;
+			break;
+		}
+
+		float t;
+		uint32_t corner = WalkMesh::move_to_edge(wp, delta, target_weights, &t);
+		remaining *= (1.0f - t);
+
+		//(the triangle across the edge traverses it in the opposite direction)
+		glm::uvec3 const &tri = mesh.triangles[wp.triangle];
+		auto f = across.find(glm::uvec2(tri[(corner + 2) % 3], tri[(corner + 1) % 3]));
+		if (f == across.end()) {
+			if (sliding == corner) break;
+			remaining = mesh.slide_along_edge(wp, corner, remaining);
+			sliding = corner;
+			continue;
+		}
+
+		mesh.cross_edge(wp, corner, mesh, f->second / 3, f->second % 3, remaining);
+		sliding = -1U;
+	}
+}
+
+Benchmark walkmesh_walk("walkmesh-walk", [](){
+	WalkMesh mesh = make_grid_walkmesh(100000);
+	glm::vec3 max = mesh.vertices.back();
+
+	//a crowd of walkers wandering in random directions:
+	const uint32_t walker_count = 1000;
+	const uint32_t step_count = 1000;
+	std::mt19937 mt(0xbeefcafe);
+	std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+	std::vector< WalkMesh::WalkPoint > start;
+	std::vector< glm::vec3 > directions;
+	for (auto const &p : make_query_points(mesh, walker_count)) {
+		start.emplace_back(mesh.start(p));
+		float a = angle(mt);
+		directions.emplace_back(0.3f * std::cos(a), 0.3f * std::sin(a), 0.0f);
+	}
+
+	//the same walk, finding the triangle across each crossed edge with the neighbor array (WalkMesh::walk):
+	std::vector< WalkMesh::WalkPoint > walkers = start;
+	BenchmarkTimer array_timer;
+	for (uint32_t s = 0; s < step_count; ++s) {
+		for (uint32_t w = 0; w < walker_count; ++w) {
+			mesh.walk(walkers[w], directions[w]);
+		}
+	}
+	double array = array_timer.elapsed();
+
+	//...and with the old hash map from edges:
+	std::unordered_map< glm::uvec2, uint32_t > across;
+	for (uint32_t t = 0; t < mesh.triangles.size(); ++t) {
+		glm::uvec3 const &tri = mesh.triangles[t];
+		for (uint32_t k = 0; k < 3; ++k) {
+			across[glm::uvec2(tri[(k + 1) % 3], tri[(k + 2) % 3])] = 3 * t + k;
+		}
+	}
+	std::vector< WalkMesh::WalkPoint > hash_walkers = start;
+	BenchmarkTimer hash_timer;
+	for (uint32_t s = 0; s < step_count; ++s) {
+		for (uint32_t w = 0; w < walker_count; ++w) {
+			hash_walk(mesh, across, hash_walkers[w], directions[w]);
+		}
+	}
+	double hash = hash_timer.elapsed();
+
+	uint32_t off_mesh = 0, mismatches = 0;
+	for (uint32_t w = 0; w < walker_count; ++w) {
+		glm::vec3 at = mesh.world_point(walkers[w]);
+		if (!(at.x >= -1e-3f && at.y >= -1e-3f && at.x <= max.x + 1e-3f && at.y <= max.y + 1e-3f)) ++off_mesh;
+		if (walkers[w].triangle != hash_walkers[w].triangle || walkers[w].weights != hash_walkers[w].weights) ++mismatches;
+	}
+
+	double steps = walker_count * double(step_count);
+	std::cout << mesh.triangles.size() << " triangles, " << walker_count << " walkers x " << step_count << " steps: "
+		<< "neighbor array " << steps / array / 1e6 << "M steps/sec, "
+		<< "hash map " << steps / hash / 1e6 << "M steps/sec "
+		<< "(" << hash / array << "x), "
+		<< off_mesh << " walkers off mesh, "
+		<< mismatches << " mismatches" << std::endl;
+	if (mismatches) {
+		throw std::runtime_error("Walking with the hash map and with the neighbor array disagree.");
+	}
+});
+
+Benchmark walkmesh_walk_batch("walkmesh-walk-batch", [](){
+	WalkMesh mesh = make_grid_walkmesh(100000);
+
+	for (uint32_t agent_count : {1000U, 10000U, 100000U}) {
+		//agents wandering with small (per-frame-sized) steps, so most steps stay inside a triangle:
+		std::mt19937 mt(0x5eed5eed);
+		std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+		WalkMesh::WalkPoints batch;
+		std::vector< WalkMesh::WalkPoint > scalar;
+		std::vector< float > step_x, step_y, step_z;
+		for (auto const &p : make_query_points(mesh, agent_count)) {
+			batch.push_back(mesh.start(p));
+			scalar.emplace_back(mesh.start(p));
+			float a = angle(mt);
+			step_x.emplace_back(0.02f * std::cos(a));
+			step_y.emplace_back(0.02f * std::sin(a));
+			step_z.emplace_back(0.0f);
+		}
+
+		const uint32_t frames = 100;
+
+		BenchmarkTimer scalar_timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			for (uint32_t i = 0; i < agent_count; ++i) {
+				mesh.walk(scalar[i], glm::vec3(step_x[i], step_y[i], step_z[i]));
+			}
+		}
+		double scalar_ms = scalar_timer.elapsed() * 1e3;
+
+		BenchmarkTimer batch_timer;
+		for (uint32_t f = 0; f < frames; ++f) {
+			mesh.walk(batch, step_x.data(), step_y.data(), step_z.data());
+		}
+		double batch_ms = batch_timer.elapsed() * 1e3;
+
+		uint32_t mismatches = 0;
+		for (uint32_t i = 0; i < agent_count; ++i) {
+			if (glm::distance(mesh.world_point(scalar[i]), mesh.world_point(batch.get(i))) > 1e-4f) ++mismatches;
+		}
+
+		std::cout << agent_count << " agents x " << frames << " frames: "
+			<< "scalar " << agent_count * double(frames) / scalar_ms << " agents/ms, "
+			<< "batch " << agent_count * double(frames) / batch_ms << " agents/ms "
+			<< "(" << scalar_ms / batch_ms << "x), "
+			<< mismatches << " mismatches" << std::endl;
+	}
+});
+
+Benchmark walkmesh_path("walkmesh-path", [](){
+	for (uint32_t triangle_count : {10000U, 100000U}) {
+		WalkMesh mesh = make_grid_walkmesh(triangle_count, 0.25f);
+		PathFinder path_finder(mesh);
+
+		std::vector< glm::vec3 > points = make_query_points(mesh, 2000);
+		std::vector< WalkMesh::WalkPoint > starts;
+		for (auto const &p : points) {
+			starts.emplace_back(mesh.start(p));
+		}
+
+		//individual queries:
+		std::vector< glm::vec3 > path;
+		uint32_t found = 0;
+		size_t corners = 0;
+		float length = 0.0f;
+		BenchmarkTimer timer;
+		for (uint32_t i = 0; i + 1 < starts.size(); i += 2) {
+			if (path_finder.find_path(starts[i], starts[i+1], &path)) {
+				++found;
+				corners += path.size();
+				for (uint32_t j = 1; j < path.size(); ++j) length += glm::distance(path[j-1], path[j]);
+			}
+		}
+		double per_query = timer.elapsed() / (starts.size() / 2);
+
+		//budgeted queries, as a crowd of agents would issue them:
+		std::vector< PathFinder::Query > queries(starts.size() / 2);
+		for (uint32_t i = 0; i < queries.size(); ++i) {
+			queries[i].from = starts[2*i];
+			queries[i].to = starts[2*i+1];
+			path_finder.enqueue(&queries[i]);
+		}
+		const float budget = 0.001f;
+		uint32_t frames = 0;
+		double worst_frame = 0.0;
+		while (path_finder.pending()) {
+			BenchmarkTimer frame_timer;
+			path_finder.update(budget);
+			worst_frame = std::max(worst_frame, frame_timer.elapsed());
+			++frames;
+		}
+
+		std::cout << mesh.triangles.size() << " triangles: "
+			<< per_query * 1e6 << "us/query, "
+			<< found << "/" << starts.size() / 2 << " found, "
+			<< (found ? float(corners) / found : 0.0f) << " points/path, "
+			<< (found ? length / found : 0.0f) << " units/path; "
+			<< queries.size() << " queries at " << budget * 1e3 << "ms/frame took " << frames << " frames "
+			<< "(worst frame " << worst_frame * 1e3 << "ms)" << std::endl;
+	}
+});
+
+Benchmark walkmesh_flow("walkmesh-flow", [](){
+	//(about 100k triangles once holes are removed)
+	WalkMesh mesh = make_grid_walkmesh(135000, 0.25f);
+	std::vector< glm::vec3 > points = make_query_points(mesh, 20);
+
+	uint32_t hardware = std::max(1U, std::thread::hardware_concurrency());
+	std::vector< uint32_t > thread_counts{1, 2, 4};
+	if (hardware > 4) thread_counts.emplace_back(hardware);
+
+	FlowField reference(mesh);
+	for (uint32_t threads : thread_counts) {
+		FlowField field(mesh);
+		field.set_threads(threads);
+
+		BenchmarkTimer timer;
+		for (auto const &p : points) {
+			field.rebuild(mesh.start(p));
+		}
+		double per_rebuild = timer.elapsed() / points.size();
+
+		//results should match the serial build exactly:
+		reference.rebuild(mesh.start(points.back()));
+		uint32_t mismatches = 0;
+		uint32_t reachable = 0;
+		for (uint32_t t = 0; t < mesh.triangles.size(); ++t) {
+			if (field.distance[t] != reference.distance[t] || field.next_corner[t] != reference.next_corner[t]) ++mismatches;
+			if (field.distance[t] != std::numeric_limits< float >::infinity()) ++reachable;
+		}
+
+		std::cout << mesh.triangles.size() << " triangles (" << reachable << " reachable), "
+			<< threads << " thread" << (threads > 1 ? "s" : "") << ": "
+			<< per_rebuild * 1e3 << "ms/rebuild, "
+			<< mismatches << " mismatches vs. serial" << std::endl;
+	}
+
+	//agents following the field, which only rebuilds when the target changes triangle:
+	FlowField field(mesh);
+	std::vector< WalkMesh::WalkPoint > agents;
+	for (auto const &p : make_query_points(mesh, 10000)) {
+		agents.emplace_back(mesh.start(p));
+	}
+	WalkMesh::WalkPoint target = mesh.start(points[0]);
+	uint32_t rebuilds = 0;
+	const uint32_t frames = 100;
+	BenchmarkTimer timer;
+	for (uint32_t f = 0; f < frames; ++f) {
+		mesh.walk(target, glm::vec3(0.05f, 0.03f, 0.0f));
+		if (field.update(target)) ++rebuilds;
+		for (auto &agent : agents) {
+			mesh.walk(agent, 0.05f * field.direction(agent));
+		}
+	}
+	std::cout << agents.size() << " agents x " << frames << " frames: "
+		<< timer.elapsed() / frames * 1e3 << "ms/frame, "
+		<< rebuilds << " rebuilds" << std::endl;
+});
+
+//Writes a walkmesh in the format written by export-walkmesh.py:
+static void save_blob(WalkMesh const &mesh, std::string const &filename) {
+	std::ofstream file(filename, std::ios::binary);
+	auto write_chunk = [&](char const *magic, void const *data, size_t size) {
+		uint32_t size32 = uint32_t(size);
+		file.write(magic, 4);
+		file.write(reinterpret_cast< char const * >(&size32), 4);
+		file.write(reinterpret_cast< char const * >(data), size);
+	};
+	write_chunk("vtx0", mesh.vertices.data(), mesh.vertices.size() * sizeof(glm::vec3));
+	std::vector< glm::vec3 > normals(mesh.vertices.size(), glm::vec3(0.0f, 0.0f, 1.0f)); //(WalkMesh skips these, but the format has them)
+	write_chunk("nom0", normals.data(), normals.size() * sizeof(glm::vec3));
+	write_chunk("lpi0", mesh.triangles.data(), mesh.triangles.size() * sizeof(glm::uvec3));
+}
+
+Benchmark walkmesh_load("walkmesh-load", [](){
+	std::string blob = "benchmark-walkmesh.blob";
+	std::string cooked = "benchmark-walkmesh.walkmesh";
+	for (uint32_t triangle_count : {100000U, 1000000U}) {
+		{
+			WalkMesh mesh = make_grid_walkmesh(triangle_count);
+			save_blob(mesh, blob);
+			mesh.save_cooked(cooked);
+		}
+		WalkMesh source(blob);
+		std::vector< glm::vec3 > points = make_query_points(source, 1000);
+
+		//loads, plus a few queries (so that touching the mapped pages is counted):
+		auto time_load = [&](std::string const &filename, float *checksum) {
+			BenchmarkTimer timer;
+			WalkMesh mesh(filename);
+			*checksum = 0.0f;
+			for (auto const &p : points) {
+				glm::vec3 at = mesh.world_point(mesh.start(p));
+				*checksum += at.x + at.y + at.z;
+			}
+			return timer.elapsed();
+		};
+		float blob_checksum, cooked_checksum;
+		double blob_time = time_load(blob, &blob_checksum);
+		double cooked_time = time_load(cooked, &cooked_checksum);
+
+		std::cout << source.triangles.size() << " triangles: "
+			<< ".blob load+build " << blob_time * 1e3 << "ms, "
+			<< ".walkmesh map " << cooked_time * 1e3 << "ms "
+			<< "(" << blob_time / cooked_time << "x) "
+			<< "[" << points.size() << " start() queries included; checksums "
+			<< (blob_checksum == cooked_checksum ? "match" : "DIFFER") << "]" << std::endl;
+	}
+	std::remove(blob.c_str());
+	std::remove(cooked.c_str());
+});
+
+//Casts rays in random directions from random points on 'mesh' (scalar and batched), and checks line of sight between pairs of points:
+static void benchmark_casts(std::string const &name, WalkMesh const &mesh) {
+	glm::vec3 min = mesh.bvh_nodes[0].min;
+	glm::vec3 max = mesh.bvh_nodes[0].max;
+	float extent = std::max(max.x - min.x, max.y - min.y);
+
+	const uint32_t ray_count = 100000;
+	std::mt19937 mt(0xca57ca57);
+	std::uniform_real_distribution< float > x(min.x, max.x);
+	std::uniform_real_distribution< float > y(min.y, max.y);
+	std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+	WalkMesh::WalkPoints from;
+	for (uint32_t i = 0; i < ray_count; ++i) {
+		from.push_back(mesh.start(glm::vec3(x(mt), y(mt), max.z)));
+	}
+	std::vector< float > directions;
+	for (uint32_t i = 0; i < ray_count; ++i) {
+		directions.emplace_back(angle(mt));
+	}
+
+	//short rays (e.g., hearing something nearby) and long rays (e.g., seeing across the level):
+	for (float fraction : {0.02f, 0.5f}) {
+		float length = fraction * extent;
+		std::vector< float > step_x, step_y, step_z;
+		for (float a : directions) {
+			step_x.emplace_back(length * std::cos(a));
+			step_y.emplace_back(length * std::sin(a));
+			step_z.emplace_back(0.0f);
+		}
+
+		std::vector< WalkMesh::Cast > scalar(ray_count);
+		BenchmarkTimer scalar_timer;
+		for (uint32_t i = 0; i < ray_count; ++i) {
+			scalar[i] = mesh.cast(from.get(i), glm::vec3(step_x[i], step_y[i], step_z[i]));
+		}
+		double scalar_ns = scalar_timer.elapsed() / ray_count * 1e9;
+
+		std::vector< WalkMesh::Cast > batch(ray_count);
+		BenchmarkTimer batch_timer;
+		mesh.cast(from, step_x.data(), step_y.data(), step_z.data(), batch.data());
+		double batch_ns = batch_timer.elapsed() / ray_count * 1e9;
+
+		uint32_t hits = 0, mismatches = 0;
+		float distance = 0.0f;
+		for (uint32_t i = 0; i < ray_count; ++i) {
+			if (scalar[i].hit) ++hits;
+			distance += scalar[i].distance;
+			if (scalar[i].hit != batch[i].hit || glm::distance(scalar[i].point, batch[i].point) > 1e-4f) ++mismatches;
+		}
+
+		std::cout << name << ", " << mesh.triangles.size() << " triangles, rays of " << length << " units: "
+			<< "scalar " << scalar_ns << "ns/ray, "
+			<< "batch " << batch_ns << "ns/ray, "
+			<< hits * 100.0f / ray_count << "% blocked, "
+			<< distance / ray_count << " units/ray, "
+			<< mismatches << " mismatches" << std::endl;
+	}
+
+	//line of sight between random pairs of points:
+	uint32_t visible = 0;
+	BenchmarkTimer los_timer;
+	for (uint32_t i = 0; i + 1 < ray_count; i += 2) {
+		if (mesh.line_of_sight(from.get(i), from.get(i+1))) ++visible;
+	}
+	double los_ns = los_timer.elapsed() / (ray_count / 2) * 1e9;
+	std::cout << name << ", " << mesh.triangles.size() << " triangles, line of sight: "
+		<< los_ns << "ns/check, "
+		<< visible * 100.0f / (ray_count / 2) << "% visible" << std::endl;
+}
+
+Benchmark walkmesh_cast("walkmesh-cast", [](){
+	//the shipped maze (skipped if not next to the executable):
+	try {
+		WalkMesh maze(data_path("walkmesh.blob"));
+		benchmark_casts("maze", maze);
+	} catch (std::exception &e) {
+		std::cout << "maze: skipped (" << e.what() << ")" << std::endl;
+	}
+
+	//a large synthetic maze:
+	benchmark_casts("grid", make_grid_walkmesh(1000000, 0.25f));
+});
+
+Benchmark walkmesh_tiles("walkmesh-tiles", [](){
+	std::string index = "benchmark-walkmesh.tiles";
+	WalkMesh mesh = make_grid_walkmesh(1000000);
+	const float tile_size = 32.0f;
+	BenchmarkTimer cook_timer;
+	TiledWalkMesh::cook(mesh, tile_size, index);
+	double cook = cook_timer.elapsed();
+
+	//agents striding across the level in straight lines (sliding along its edges):
+	const uint32_t agent_count = 16;
+	const uint32_t frames = 2000;
+	std::mt19937 mt(0x711e5711);
+	std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+	std::vector< glm::vec3 > starts = make_query_points(mesh, agent_count);
+	std::vector< glm::vec3 > steps;
+	for (uint32_t i = 0; i < agent_count; ++i) {
+		float a = angle(mt);
+		steps.emplace_back(0.5f * std::cos(a), 0.5f * std::sin(a), 0.0f);
+	}
+
+	std::vector< WalkMesh::WalkPoint > flat;
+	for (auto const &p : starts) {
+		flat.emplace_back(mesh.start(p));
+	}
+	BenchmarkTimer flat_timer;
+	for (uint32_t f = 0; f < frames; ++f) {
+		for (uint32_t i = 0; i < agent_count; ++i) {
+			mesh.walk(flat[i], steps[i]);
+		}
+	}
+	double flat_us = flat_timer.elapsed() / (frames * agent_count) * 1e6;
+
+	//frames back-to-back (far faster than real time, so the loader falls behind), and with a pause standing in for the rest of each frame:
+	for (uint32_t pause_ms : {0U, 1U}) {
+		TiledWalkMesh tiled(index);
+		size_t total_bytes = 0;
+		for (uint32_t tile = 0; tile < tiled.infos.size(); ++tile) {
+			if (tiled.infos[tile].triangle_count == 0) continue;
+			std::ifstream file(tiled.tile_filename(tile), std::ios::binary | std::ios::ate);
+			total_bytes += size_t(file.tellg());
+		}
+		tiled.memory_budget = total_bytes / 8;
+
+		std::vector< TiledWalkMesh::WalkPoint > tiled_points;
+		for (auto const &p : starts) {
+			tiled_points.emplace_back(tiled.start(p));
+		}
+		tiled.metrics.stalls = 0; //(start() loads tiles on the spot, which isn't interesting here)
+
+		double update_time = 0.0, walk_time = 0.0, worst_frame = 0.0;
+		uint32_t crossings = 0;
+		size_t peak_bytes = 0;
+		for (uint32_t f = 0; f < frames; ++f) {
+			BenchmarkTimer frame_timer;
+			tiled.update(tiled_points.data(), tiled_points.size());
+			update_time += frame_timer.elapsed();
+			BenchmarkTimer walk_timer;
+			for (uint32_t i = 0; i < agent_count; ++i) {
+				uint32_t before = tiled_points[i].tile;
+				tiled.walk(tiled_points[i], steps[i]);
+				if (tiled_points[i].tile != before) ++crossings;
+			}
+			walk_time += walk_timer.elapsed();
+			worst_frame = std::max(worst_frame, frame_timer.elapsed());
+			peak_bytes = std::max(peak_bytes, tiled.metrics.resident_bytes);
+			if (pause_ms) std::this_thread::sleep_for(std::chrono::milliseconds(pause_ms));
+		}
+		double tiled_us = walk_time / (frames * agent_count) * 1e6;
+
+		uint32_t mismatches = 0;
+		for (uint32_t i = 0; i < agent_count; ++i) {
+			if (glm::distance(mesh.world_point(flat[i]), tiled.world_point(tiled_points[i])) > 1e-3f) ++mismatches;
+		}
+
+		std::cout << mesh.triangles.size() << " triangles in " << tiled.grid.tiles_x << "x" << tiled.grid.tiles_y << " tiles "
+			<< "(" << total_bytes / (1024 * 1024) << "MB, cooked in " << cook * 1e3 << "ms), budget " << tiled.memory_budget / (1024 * 1024) << "MB, "
+			<< pause_ms << "ms pause between frames:" << std::endl;
+		std::cout << "  " << agent_count << " agents x " << frames << " frames: "
+			<< "walk " << tiled_us << "us/step tiled vs. " << flat_us << "us/step resident, "
+			<< "update " << update_time / frames * 1e6 << "us/frame, worst frame " << worst_frame * 1e3 << "ms, "
+			<< crossings << " tile crossings, " << mismatches << " mismatches" << std::endl;
+		std::cout << "  resident " << tiled.metrics.resident_tiles << " tiles / " << tiled.metrics.resident_bytes / 1024 << "KB "
+			<< "(peak " << peak_bytes / 1024 << "KB), "
+			<< tiled.metrics.loads << " loads, " << tiled.metrics.evictions << " evictions, "
+			<< tiled.metrics.stalls << " stalls, " << tiled.metrics.pending_tiles << " pending" << std::endl;
+	}
+
+	TiledWalkMesh tiled(index);
+	for (uint32_t tile = 0; tile < tiled.infos.size(); ++tile) {
+		std::remove(tiled.tile_filename(tile).c_str());
+	}
+	std::remove(index.c_str());
+});
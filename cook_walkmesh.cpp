@@ -0,0 +1,59 @@
+#include "WalkMesh.hpp"
+#include "TiledWalkMesh.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+//cook_walkmesh converts a walkmesh exported by meshes/export-walkmesh.py into the cooked format,
+// which can be memory-mapped and used without rebuilding anything at load time:
+//   cook_walkmesh dist/walkmesh.blob dist/walkmesh.walkmesh
+//or, for levels too large to keep resident, into a grid of cooked tiles (see TiledWalkMesh):
+//   cook_walkmesh --tiles 32 dist/walkmesh.blob dist/walkmesh.tiles
+
+int main(int argc, char **argv) {
+	bool tiled = (argc == 5 && std::string(argv[1]) == "--tiles");
+	if (argc != 3 && !tiled) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.blob> <out.walkmesh>\n"
+			"\t" << argv[0] << " --tiles <tile size> <in.blob> <out.tiles>\n"
+			"Builds walkmesh acceleration structures and writes them in a memory-mappable format." << std::endl;
+		return 1;
+	}
+	try {
+		if (tiled) {
+			float tile_size = std::stof(argv[2]);
+			WalkMesh mesh(argv[3]);
+			TiledWalkMesh::cook(mesh, tile_size, argv[4]);
+
+			//make sure the result loads:
+			TiledWalkMesh cooked(argv[4]);
+			uint32_t triangles = 0, tiles = 0;
+			for (auto const &info : cooked.infos) {
+				triangles += info.triangle_count;
+				if (info.triangle_count) ++tiles;
+			}
+			if (triangles != mesh.triangles.size()) {
+				throw std::runtime_error("Re-loaded tiled walkmesh doesn't match.");
+			}
+			std::cout << "Cooked " << mesh.triangles.size() << " triangles from '" << argv[3] << "' into "
+				<< tiles << " tiles (" << cooked.grid.tiles_x << "x" << cooked.grid.tiles_y << " grid, "
+				<< cooked.links.size() << " links) indexed by '" << argv[4] << "'." << std::endl;
+			return 0;
+		}
+
+		WalkMesh mesh(argv[1]);
+		mesh.save_cooked(argv[2]);
+		std::cout << "Cooked " << mesh.vertices.size() << " vertices and " << mesh.triangles.size() << " triangles from '"
+			<< argv[1] << "' into '" << argv[2] << "'." << std::endl;
+
+		//make sure the result loads:
+		WalkMesh cooked(argv[2]);
+		if (cooked.triangles.size() != mesh.triangles.size()) {
+			throw std::runtime_error("Re-loaded cooked walkmesh doesn't match.");
+		}
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
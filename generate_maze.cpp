@@ -0,0 +1,38 @@
+#include "Maze.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+//generate_maze writes a random maze level that CratesMode can play (see Maze):
+//   generate_maze 1000 1000 dist/big
+//   dist/main --level big
+
+int main(int argc, char **argv) {
+	if (argc < 4 || argc > 6) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <width> <height> <out prefix> [seed] [threads]\n"
+			"Writes <out prefix>.walkmesh, <out prefix>.pnc, <out prefix>.scene, and <out prefix>.pvs." << std::endl;
+		return 1;
+	}
+	try {
+		uint32_t width = uint32_t(std::stoul(argv[1]));
+		uint32_t height = uint32_t(std::stoul(argv[2]));
+		std::string prefix = argv[3];
+		uint32_t seed = (argc > 4 ? uint32_t(std::stoul(argv[4])) : 0);
+		uint32_t threads = (argc > 5 ? uint32_t(std::stoul(argv[5])) : 0);
+
+		auto before = std::chrono::high_resolution_clock::now();
+		Maze maze(width, height, seed, threads);
+		maze.save(prefix);
+		auto after = std::chrono::high_resolution_clock::now();
+
+		std::cout << "Generated a " << maze.width << "x" << maze.height << " maze (seed " << maze.seed << ", "
+			<< maze.threads << " threads) into '" << prefix << ".*' in "
+			<< std::chrono::duration< double >(after - before).count() << "s." << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
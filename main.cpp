@@ -7,6 +7,9 @@
 //The 'GameMode' mode plays the game:
 #include "GameMode.hpp"
 
+//CratesMode.hpp is included to select the level (crates_level) from the command line:
+#include "CratesMode.hpp"
+
 //The 'Sound' header has functions for managing sound:
 #include "Sound.hpp"
 
@@ -36,6 +39,19 @@ int main(int argc, char **argv) {
 		glm::uvec2 size = glm::uvec2(640 * 1.5, 400 * 1.5);
 	} config;
 
+	//------------  command line ------------
+	//  --level <name> plays "<name>.scene" (etc) from the data directory, e.g. a level written by generate_maze
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--level" && i + 1 < argc) {
+			crates_level = argv[++i];
+		} else {
+			std::cerr << "Usage:\n\t" << argv[0] << " [--level <name>]" << std::endl;
+			return 1;
+		}
+	}
+
 	//------------  initialization ------------
 
 	//Initialize SDL library:
@@ -1,62 +1,115 @@
 #include "vertex_color_program.hpp"
 
 #include "compile_program.hpp"
+#include "Scene.hpp"
 
-VertexColorProgram::VertexColorProgram() {
-	program = compile_program(
-		"#version 330\n"
-		"uniform mat4 object_to_clip;\n"
-		"uniform mat4x3 object_to_light;\n"
-		"uniform mat3 normal_to_light;\n"
-		"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
-		"in vec3 Normal;\n"
-		"in vec4 Color;\n"
-		"out vec3 position;\n"
-		"out vec3 normal;\n"
-		"out vec4 color;\n"
-		"void main() {\n"
-		"	gl_Position = object_to_clip * Position;\n"
-		"	position = object_to_light * Position;\n"
-		"	normal = normal_to_light * Normal;\n"
-		"	color = Color;\n"
-		"}\n"
-		,
-		"#version 330\n"
-		"uniform vec3 sun_direction;\n"
-		"uniform vec3 sun_color;\n"
-		"uniform vec3 sky_direction;\n"
-		"uniform vec3 sky_color;\n"
-		"in vec3 position;\n"
-		"in vec3 normal;\n"
-		"in vec4 color;\n"
-		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	vec3 total_light = vec3(0.0, 0.0, 0.0);\n"
-		"	vec3 n = normalize(normal);\n"
-		"	{ //sky (hemisphere) light:\n"
-		"		vec3 l = sky_direction;\n"
-		"		float nl = 0.5 + 0.5 * dot(n,l);\n"
-		"		total_light += nl * sky_color;\n"
-		"	}\n"
-		"	{ //sun (directional) light:\n"
-		"		vec3 l = sun_direction;\n"
-		"		float nl = max(0.0, dot(n,l));\n"
-		"		total_light += nl * sun_color;\n"
-		"	}\n"
-		"	fragColor = vec4(color.rgb * total_light, color.a);\n"
-		"}\n"
-	);
-
-	object_to_clip_mat4 = glGetUniformLocation(program, "object_to_clip");
-	object_to_light_mat4x3 = glGetUniformLocation(program, "object_to_light");
-	normal_to_light_mat3 = glGetUniformLocation(program, "normal_to_light");
-
-	sun_direction_vec3 = glGetUniformLocation(program, "sun_direction");
-	sun_color_vec3 = glGetUniformLocation(program, "sun_color");
-	sky_direction_vec3 = glGetUniformLocation(program, "sky_direction");
-	sky_color_vec3 = glGetUniformLocation(program, "sky_color");
+//(the same lighting for both variants)
+static char const *fragment_shader =
+	"#version 330\n"
+	"layout(std140) uniform Lighting {\n" //(as Scene::Lighting)
+	"	vec4 sun_direction;\n"
+	"	vec4 sun_color;\n"
+	"	vec4 sky_direction;\n"
+	"	vec4 sky_color;\n"
+	"};\n"
+	"uniform vec4 tint;\n"
+	"in vec3 position;\n"
+	"in vec3 normal;\n"
+	"in vec4 color;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	vec3 total_light = vec3(0.0, 0.0, 0.0);\n"
+	"	vec3 n = normalize(normal);\n"
+	"	{ //sky (hemisphere) light:\n"
+	"		vec3 l = sky_direction.xyz;\n"
+	"		float nl = 0.5 + 0.5 * dot(n,l);\n"
+	"		total_light += nl * sky_color.rgb;\n"
+	"	}\n"
+	"	{ //sun (directional) light:\n"
+	"		vec3 l = sun_direction.xyz;\n"
+	"		float nl = max(0.0, dot(n,l));\n"
+	"		total_light += nl * sun_color.rgb;\n"
+	"	}\n"
+	"	fragColor = tint * vec4(color.rgb * total_light, color.a);\n"
+	"}\n";
+
+VertexColorProgram::VertexColorProgram(bool instanced) {
+	if (!instanced) {
+		program = compile_program(
+			"#version 330\n"
+			"uniform mat4 object_to_clip;\n"
+			"uniform mat4x3 object_to_light;\n"
+			"uniform mat3 normal_to_light;\n"
+			"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
+			"in vec3 Normal;\n"
+			"in vec4 Color;\n"
+			"out vec3 position;\n"
+			"out vec3 normal;\n"
+			"out vec4 color;\n"
+			"void main() {\n"
+			"	gl_Position = object_to_clip * Position;\n"
+			"	position = object_to_light * Position;\n"
+			"	normal = normal_to_light * Normal;\n"
+			"	color = Color;\n"
+			"}\n"
+			, fragment_shader
+		);
+
+		object_to_clip_mat4 = glGetUniformLocation(program, "object_to_clip");
+		object_to_light_mat4x3 = glGetUniformLocation(program, "object_to_light");
+		normal_to_light_mat3 = glGetUniformLocation(program, "normal_to_light");
+	} else {
+		program = compile_program(
+			"#version 330\n"
+			"uniform mat4 world_to_clip;\n"
+			"uniform samplerBuffer instance_transforms;\n" //rows of object_to_light, then rows of normal_to_light, per instance
+			"uniform int instance_offset;\n"
+			"layout(location=0) in vec4 Position;\n"
+			"in vec3 Normal;\n"
+			"in vec4 Color;\n"
+			"out vec3 position;\n"
+			"out vec3 normal;\n"
+			"out vec4 color;\n"
+			"void main() {\n"
+			"	int at = 6 * (instance_offset + gl_InstanceID);\n"
+			"	mat4x3 object_to_light = transpose(mat3x4(\n"
+			"		texelFetch(instance_transforms, at+0),\n"
+			"		texelFetch(instance_transforms, at+1),\n"
+			"		texelFetch(instance_transforms, at+2)));\n"
+			"	mat3 normal_to_light = transpose(mat3(\n"
+			"		texelFetch(instance_transforms, at+3).xyz,\n"
+			"		texelFetch(instance_transforms, at+4).xyz,\n"
+			"		texelFetch(instance_transforms, at+5).xyz));\n"
+			"	position = object_to_light * Position;\n"
+			"	gl_Position = world_to_clip * vec4(position, 1.0);\n"
+			"	normal = normal_to_light * Normal;\n"
+			"	color = Color;\n"
+			"}\n"
+			, fragment_shader
+		);
+
+		world_to_clip_mat4 = glGetUniformLocation(program, "world_to_clip");
+		instance_offset_int = glGetUniformLocation(program, "instance_offset");
+
+		//instance transforms are always on texture unit zero:
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "instance_transforms"), 0);
+		glUseProgram(0);
+	}
+
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lighting"), Scene::LightingBinding);
+
+	//(white, in case an object doesn't say where its material goes)
+	tint_vec4 = glGetUniformLocation(program, "tint");
+	glUseProgram(program);
+	glUniform4f(tint_vec4, 1.0f, 1.0f, 1.0f, 1.0f);
+	glUseProgram(0);
 }
 
 Load< VertexColorProgram > vertex_color_program(LoadTagInit, [](){
 	return new VertexColorProgram();
 });
+
+Load< VertexColorProgram > vertex_color_program_instanced(LoadTagInit, [](){
+	return new VertexColorProgram(true);
+});
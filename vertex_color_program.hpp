@@ -9,12 +9,16 @@ struct VertexColorProgram {
 	GLuint object_to_clip_mat4 = -1U;
 	GLuint object_to_light_mat4x3 = -1U;
 	GLuint normal_to_light_mat3 = -1U;
-	GLuint sun_direction_vec3 = -1U;
-	GLuint sun_color_vec3 = -1U;
-	GLuint sky_direction_vec3 = -1U;
-	GLuint sky_color_vec3 = -1U;
+	GLuint tint_vec4 = -1U; //(Scene::Material::tint; starts as white)
+	//lighting comes from the "Lighting" uniform block, bound to Scene::LightingBinding
 
-	VertexColorProgram();
+	//instanced variant only (in place of the three matrices above):
+	// per-instance transforms come from a buffer texture on texture unit zero, laid out as in Scene::instance_transforms
+	GLuint world_to_clip_mat4 = -1U;
+	GLuint instance_offset_int = -1U;
+
+	VertexColorProgram(bool instanced = false);
 };
 
 extern Load< VertexColorProgram > vertex_color_program;
+extern Load< VertexColorProgram > vertex_color_program_instanced;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cassert>
+#include <cstdint>
+
+//write a chunk in the layout read_chunk() expects: magic, size in bytes, data
+template< typename T >
+void write_chunk(std::ostream &to, std::string const &magic, std::vector< T > const &from) {
+	assert(magic.size() == 4);
+
+	uint32_t size = uint32_t(from.size() * sizeof(T));
+	to.write(magic.data(), 4);
+	to.write(reinterpret_cast< char const * >(&size), sizeof(size));
+	to.write(reinterpret_cast< char const * >(from.data()), size);
+}